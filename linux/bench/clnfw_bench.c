@@ -0,0 +1,537 @@
+/*
+ * libclnfw micro and macro benchmarks
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <cln_fw.h>
+#include <err_status.h>
+#include <time.h>
+#include "internal.h"
+#include "buffer_stream.h"
+#include "class.h"
+#include "crc32.h"
+
+#define BENCH_DEFAULT_MIN_MSEC		200
+#define BENCH_CRC32_LEN			0x10000
+#define BENCH_BS_LEN			0x10000
+#define BENCH_BS_STEP			16
+#define BENCH_KEY_LEN			1024
+#define BENCH_MAX_RESULT		64
+
+typedef struct {
+	const char *name;
+	/* Exercising a single routine or a whole command */
+	const char *kind;
+	/* The operations done by each call of run() */
+	unsigned long ops;
+	/* The bytes processed by each operation, 0 if not applicable */
+	unsigned long (*bytes)(void);
+	err_status_t (*run)(void);
+} bench_t;
+
+typedef struct {
+	char name[48];
+	double ns_per_op;
+} bench_result_t;
+
+/* The fixture shared by all benchmarks */
+static uint8_t *fw;
+static unsigned long fw_len;
+static uint8_t *key;
+
+static unsigned long nr_alloc;
+
+/* Keep the CRC32 from being optimized out */
+static volatile uint32_t crc32_sink;
+
+/*
+ * The allocations are counted by wrapping the allocator at link time so
+ * that the library needs no instrumentation.
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *
+__wrap_malloc(size_t size)
+{
+	__atomic_add_fetch(&nr_alloc, 1, __ATOMIC_RELAXED);
+
+	return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&nr_alloc, 1, __ATOMIC_RELAXED);
+
+	return __real_calloc(nmemb, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&nr_alloc, 1, __ATOMIC_RELAXED);
+
+	return __real_realloc(ptr, size);
+}
+
+static uint64_t
+now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *
+pdata_buf(void)
+{
+	return fw + fw_len + platform_data_offset();
+}
+
+static void *
+mfh_buf(void)
+{
+	return fw + fw_len + mfh_offset();
+}
+
+static unsigned long
+crc32_bytes(void)
+{
+	return BENCH_CRC32_LEN;
+}
+
+static err_status_t
+run_crc32(void)
+{
+	crc32_sink = crc32(fw, BENCH_CRC32_LEN);
+
+	return CLN_FW_ERR_NONE;
+}
+
+static unsigned long
+pdata_bytes(void)
+{
+	return platform_data_size(pdata_buf());
+}
+
+static err_status_t
+run_pdata_probe(void)
+{
+	platform_data_view_t view;
+
+	return platform_data_probe(pdata_buf(), platform_data_max_size(),
+				   &view);
+}
+
+static unsigned long
+mfh_bytes(void)
+{
+	return mfh_size(mfh_buf());
+}
+
+static err_status_t
+run_mfh_probe(void)
+{
+	unsigned long len = platform_data_offset() - mfh_offset();
+
+	return mfh_probe(mfh_buf(), &len);
+}
+
+static err_status_t
+run_class_instantiate(void)
+{
+	void *obj;
+	err_status_t err;
+
+	err = obj_new("mfh_context_t", &obj);
+	if (is_err_status(err))
+		return err;
+
+	obj_unref(obj);
+
+	return CLN_FW_ERR_NONE;
+}
+
+static unsigned long
+bs_step_bytes(void)
+{
+	return BENCH_BS_STEP;
+}
+
+static err_status_t
+run_bs_post_get(void)
+{
+	buffer_stream_t bs;
+	void *p;
+	unsigned long i;
+	err_status_t err;
+
+	bs_init(&bs, fw, BENCH_BS_LEN);
+
+	for (i = 0; i < BENCH_BS_LEN / BENCH_BS_STEP; ++i) {
+		err = bs_post_get(&bs, &p, BENCH_BS_STEP);
+		if (is_err_status(err))
+			return err;
+	}
+
+	return CLN_FW_ERR_NONE;
+}
+
+static err_status_t
+run_bs_post_put(void)
+{
+	static uint8_t out[BENCH_BS_LEN];
+	buffer_stream_t bs;
+	unsigned long i;
+	err_status_t err;
+
+	bs_init(&bs, out, sizeof(out));
+
+	for (i = 0; i < BENCH_BS_LEN / BENCH_BS_STEP; ++i) {
+		err = bs_post_put(&bs, fw + i * BENCH_BS_STEP, BENCH_BS_STEP);
+		if (is_err_status(err))
+			return err;
+	}
+
+	return CLN_FW_ERR_NONE;
+}
+
+/* Walk backward from the end as the parser locates the regions */
+static err_status_t
+run_bs_get_at(void)
+{
+	buffer_stream_t bs;
+	void *p;
+	long i;
+	err_status_t err;
+
+	bs_init(&bs, fw, BENCH_BS_LEN);
+
+	for (i = 1; i <= BENCH_BS_LEN / BENCH_BS_STEP; ++i) {
+		err = bs_get_at(&bs, &p, BENCH_BS_STEP, -i * BENCH_BS_STEP);
+		if (is_err_status(err))
+			return err;
+	}
+
+	return CLN_FW_ERR_NONE;
+}
+
+static unsigned long
+fw_bytes(void)
+{
+	return fw_len;
+}
+
+static err_status_t
+run_show_firmware(void)
+{
+	return cln_fw_util_show_firmware(fw, fw_len);
+}
+
+static err_status_t
+run_embed_sb_keys(void)
+{
+	void *out;
+	unsigned long out_len;
+	err_status_t err;
+
+	err = cln_fw_util_embed_sb_keys(fw, fw_len, key, BENCH_KEY_LEN,
+					key, BENCH_KEY_LEN, key,
+					BENCH_KEY_LEN, NULL, 0, &out,
+					&out_len);
+	if (is_err_status(err))
+		return err;
+
+	eee_mfree(out);
+
+	return CLN_FW_ERR_NONE;
+}
+
+static err_status_t
+run_generate_capsule(void)
+{
+	void *out;
+	unsigned long out_len;
+	err_status_t err;
+
+	err = cln_fw_util_generate_capsule(fw, fw_len, 0, &out, &out_len);
+	if (is_err_status(err))
+		return err;
+
+	eee_mfree(out);
+
+	return CLN_FW_ERR_NONE;
+}
+
+static const bench_t benches[] = {
+	{ "crc32", "micro", 1, crc32_bytes, run_crc32 },
+	{ "platform_data_probe", "micro", 1, pdata_bytes, run_pdata_probe },
+	{ "mfh_probe", "micro", 1, mfh_bytes, run_mfh_probe },
+	{ "class_instantiate", "micro", 1, NULL, run_class_instantiate },
+	{ "bs_post_get", "micro", BENCH_BS_LEN / BENCH_BS_STEP,
+	  bs_step_bytes, run_bs_post_get },
+	{ "bs_post_put", "micro", BENCH_BS_LEN / BENCH_BS_STEP,
+	  bs_step_bytes, run_bs_post_put },
+	{ "bs_get_at", "micro", BENCH_BS_LEN / BENCH_BS_STEP,
+	  bs_step_bytes, run_bs_get_at },
+	{ "cln_fw_util_show_firmware", "macro", 1, fw_bytes,
+	  run_show_firmware },
+	{ "cln_fw_util_embed_sb_keys", "macro", 1, fw_bytes,
+	  run_embed_sb_keys },
+	{ "cln_fw_util_generate_capsule", "macro", 1, fw_bytes,
+	  run_generate_capsule },
+};
+
+static bench_result_t baseline[BENCH_MAX_RESULT];
+static unsigned int nr_baseline;
+
+static void
+show_usage(const char *prog)
+{
+	info_cont(T("usage: %s <args>\n"), prog);
+	info_cont(T("\nargs:\n"));
+	info_cont(T("  -f <name>\n")
+		  T("    (optional) Only run the benchmarks whose name ")
+		  T("contains the string\n"));
+	info_cont(T("\n  -t <msec>\n")
+		  T("    (optional) The minimum time measured for each ")
+		  T("benchmark. Default: %d\n"), BENCH_DEFAULT_MIN_MSEC);
+	info_cont(T("\n  -o <file>\n")
+		  T("    (optional) Write the results as tab separated ")
+		  T("values\n"));
+	info_cont(T("\n  -c <file>\n")
+		  T("    (optional) Compare ns/op with the results written ")
+		  T("by -o before\n"));
+}
+
+static int
+load_baseline(const char *path)
+{
+	char line[256];
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		err(T("Failed to open the baseline %s\n"), path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)
+			&& nr_baseline < BENCH_MAX_RESULT) {
+		bench_result_t *r = baseline + nr_baseline;
+
+		if (line[0] == '#')
+			continue;
+
+		if (sscanf(line, "%47s %*s %lf", r->name,
+			   &r->ns_per_op) == 2)
+			++nr_baseline;
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+static const bench_result_t *
+find_baseline(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_baseline; ++i) {
+		if (!strcmp(baseline[i].name, name))
+			return baseline + i;
+	}
+
+	return NULL;
+}
+
+/*
+ * Double the number of calls until the batch lasts for the minimum time,
+ * and report the last batch.
+ */
+static err_status_t
+run_bench(const bench_t *b, uint64_t min_nsec, double *ns_per_op,
+	  double *mb_per_s, double *allocs_per_op)
+{
+	unsigned long n, i, allocs;
+	uint64_t start, elapsed;
+	err_status_t err;
+
+	/* Warm up and validate the fixture */
+	err = b->run();
+	if (is_err_status(err))
+		return err;
+
+	for (n = 1; ; n <<= 1) {
+		allocs = __atomic_load_n(&nr_alloc, __ATOMIC_RELAXED);
+		start = now_nsec();
+
+		for (i = 0; i < n; ++i) {
+			err = b->run();
+			if (is_err_status(err))
+				return err;
+		}
+
+		elapsed = now_nsec() - start;
+		allocs = __atomic_load_n(&nr_alloc, __ATOMIC_RELAXED)
+			 - allocs;
+
+		if (elapsed >= min_nsec)
+			break;
+	}
+
+	*ns_per_op = (double)elapsed / (n * b->ops);
+	*mb_per_s = b->bytes ? b->bytes() * 1000.0 / *ns_per_op : 0;
+	*allocs_per_op = (double)allocs / (n * b->ops);
+
+	return CLN_FW_ERR_NONE;
+}
+
+/* Generate the image and the key shared by all benchmarks */
+static void
+setup_fixture(void)
+{
+	cln_fw_gen_param_t param = {
+		.nr_flash_item = 4,
+		.nr_boot_item = 2,
+		.nr_pdata_item = 6,
+		.pdata_item_len = 16,
+		.fw_version = 0x01020300,
+	};
+	void *buf;
+	unsigned int i;
+	err_status_t err;
+
+	err = cln_fw_util_generate_firmware(&param, &buf, &fw_len);
+	if (is_err_status(err))
+		die("Failed to generate the firmware\n");
+
+	fw = buf;
+
+	key = eee_malloc(BENCH_KEY_LEN);
+	if (!key)
+		die("Failed to allocate the key\n");
+
+	for (i = 0; i < BENCH_KEY_LEN; ++i)
+		key[i] = i * 7;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *filter = NULL, *output = NULL;
+	uint64_t min_nsec = BENCH_DEFAULT_MIN_MSEC * 1000000ULL;
+	FILE *out_fp = NULL;
+	unsigned int i, nr_fail;
+	int opt, null_fd, stdout_fd;
+
+	libclnfw_init();
+
+	while ((opt = getopt(argc, argv, "f:t:o:c:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			filter = optarg;
+			break;
+		case 't':
+			min_nsec = strtoull(optarg, NULL, 0) * 1000000ULL;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'c':
+			if (load_baseline(optarg))
+				return EXIT_FAILURE;
+			break;
+		default:
+			show_usage(argv[0]);
+			return opt == 'h' ? 0 : EXIT_FAILURE;
+		}
+	}
+
+	setup_fixture();
+
+	if (output) {
+		out_fp = fopen(output, "w");
+		if (!out_fp)
+			die("Failed to create %s\n", output);
+
+		fprintf(out_fp, "# clnfw_bench %s, %ld-byte image\n",
+			VERSION, fw_len);
+		fprintf(out_fp, "# name\tkind\tns_per_op\tmb_per_s\t"
+			"allocs_per_op\n");
+	}
+
+	/* Keep the output of show routines out of the report */
+	null_fd = open("/dev/null", O_WRONLY);
+	stdout_fd = dup(STDOUT_FILENO);
+	if (null_fd < 0 || stdout_fd < 0)
+		die("Failed to redirect stdout\n");
+
+	info_cont(T("%-30s %-6s %12s %10s %10s%s\n"), T("benchmark"),
+		  T("kind"), T("ns/op"), T("MB/s"), T("allocs/op"),
+		  nr_baseline ? T("   vs base") : T(""));
+
+	for (i = 0, nr_fail = 0; i < sizeof(benches) / sizeof(benches[0]);
+			++i) {
+		const bench_t *b = benches + i;
+		const bench_result_t *base;
+		double ns_per_op, mb_per_s, allocs_per_op;
+		err_status_t err;
+
+		if (filter && !strstr(b->name, filter))
+			continue;
+
+		fflush(stdout);
+		dup2(null_fd, STDOUT_FILENO);
+		err = run_bench(b, min_nsec, &ns_per_op, &mb_per_s,
+				&allocs_per_op);
+		fflush(stdout);
+		dup2(stdout_fd, STDOUT_FILENO);
+
+		if (is_err_status(err)) {
+			err(T("%s: failed with 0x%lx\n"), b->name, err);
+			++nr_fail;
+			continue;
+		}
+
+		info_cont(T("%-30s %-6s %12.1f "), b->name, b->kind,
+			  ns_per_op);
+		if (b->bytes)
+			info_cont(T("%10.1f "), mb_per_s);
+		else
+			info_cont(T("%10s "), T("-"));
+		info_cont(T("%10.2f"), allocs_per_op);
+
+		base = find_baseline(b->name);
+		if (base && base->ns_per_op > 0)
+			info_cont(T(" %+9.1f%%"),
+				  (ns_per_op / base->ns_per_op - 1) * 100);
+		info_cont(T("\n"));
+
+		if (out_fp)
+			fprintf(out_fp, "%s\t%s\t%.1f\t%.1f\t%.2f\n", b->name,
+				b->kind, ns_per_op, mb_per_s, allocs_per_op);
+	}
+
+	close(null_fd);
+	close(stdout_fd);
+
+	if (out_fp && fclose(out_fp))
+		die("Failed to write %s\n", output);
+
+	eee_mfree(key);
+	eee_mfree(fw);
+
+	return nr_fail ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,376 @@
+/*
+ * libclnfw concurrent handle stress test
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <cln_fw.h>
+#include <err_status.h>
+#include <pthread.h>
+#include "internal.h"
+#include "sha256.h"
+
+#define STRESS_NR_IMAGE			4
+#define STRESS_DEFAULT_NR_JOB		32
+#define STRESS_DEFAULT_NR_ROUND		2
+#define STRESS_DEFAULT_NR_THREAD	8
+#define STRESS_KEY_LEN			1024
+
+/* What a job produces, compared with the single-threaded run */
+typedef struct {
+	err_status_t err;
+	/* SHA-256 of the flushed image */
+	uint8_t image[SHA256_DIGEST_SIZE];
+	/* SHA-256 of the region digests of the flushed image */
+	uint8_t regions[SHA256_DIGEST_SIZE];
+	unsigned long nr_region;
+	/* The messages delivered to the sink of the thread */
+	unsigned long nr_msg;
+} stress_result_t;
+
+typedef struct {
+	pthread_t thread;
+	unsigned long nr_msg;
+	/* The messages of other threads delivered to this sink */
+	unsigned long nr_foreign;
+} stress_sink_t;
+
+/* The images shared read-only by all handles */
+static uint8_t *fw[STRESS_NR_IMAGE];
+static unsigned long fw_len[STRESS_NR_IMAGE];
+
+static stress_result_t *expected;
+static unsigned long nr_job;
+static unsigned long nr_round;
+static unsigned long next_job;
+static unsigned long nr_mismatch;
+
+static void
+show_usage(const char *prog)
+{
+	info_cont(T("usage: %s <args>\n"), prog);
+	info_cont(T("\nargs:\n"));
+	info_cont(T("  -j <threads>\n")
+		  T("    (optional) The number of threads running the jobs. ")
+		  T("Default: %d\n"), STRESS_DEFAULT_NR_THREAD);
+	info_cont(T("\n  -n <jobs>\n")
+		  T("    (optional) The number of jobs, each opening its own ")
+		  T("handle. Default: %d\n"), STRESS_DEFAULT_NR_JOB);
+	info_cont(T("\n  -r <rounds>\n")
+		  T("    (optional) The times each job is run in parallel. ")
+		  T("Default: %d\n"), STRESS_DEFAULT_NR_ROUND);
+}
+
+static void
+log_sink(cln_fw_log_level_t level, const char *msg, void *data)
+{
+	stress_sink_t *sink = data;
+
+	/* The sink is only ever written by its own thread */
+	if (!pthread_equal(sink->thread, pthread_self()))
+		__atomic_add_fetch(&sink->nr_foreign, 1, __ATOMIC_RELAXED);
+	else
+		++sink->nr_msg;
+}
+
+static void
+hash_regions(cln_fw_digest_t *digest, unsigned long nr_digest,
+	     uint8_t out[SHA256_DIGEST_SIZE])
+{
+	sha256_context_t ctx;
+	unsigned long i;
+
+	sha256_init(&ctx);
+
+	for (i = 0; i < nr_digest; ++i) {
+		cln_fw_region_t *region = &digest[i].region;
+
+		sha256_update(&ctx, region->name, eee_strlen(region->name));
+		sha256_update(&ctx, &region->offset, sizeof(region->offset));
+		sha256_update(&ctx, &region->length, sizeof(region->length));
+		sha256_update(&ctx, digest[i].digest,
+			      sizeof(digest[i].digest));
+	}
+
+	sha256_final(&ctx, out);
+}
+
+static err_status_t
+__run_job(unsigned long job, stress_result_t *result)
+{
+	cln_fw_handle_t handle;
+	cln_fw_digest_t *digest;
+	uint8_t key[STRESS_KEY_LEN];
+	unsigned long i, out_len;
+	void *out;
+	err_status_t err;
+
+	for (i = 0; i < sizeof(key); ++i)
+		key[i] = job * 31 + i * 7;
+
+	handle = NULL;
+	err = cln_fw_handle_open(&handle, fw[job % STRESS_NR_IMAGE],
+				 fw_len[job % STRESS_NR_IMAGE]);
+	if (is_err_status(err))
+		return err;
+
+	err = cln_fw_handle_embed_sb_keys(handle, key, sizeof(key), key,
+					  sizeof(key) / 2, key,
+					  sizeof(key) / 4, NULL, 0);
+	if (!is_err_status(err))
+		err = cln_fw_handle_flush(handle, &out, &out_len);
+	cln_fw_handle_close(handle);
+	if (is_err_status(err))
+		return err;
+
+	sha256(out, out_len, result->image);
+
+	handle = NULL;
+	err = cln_fw_handle_open(&handle, out, out_len);
+	if (!is_err_status(err)) {
+		err = cln_fw_handle_digest(handle, 1, &digest,
+					   &result->nr_region);
+		cln_fw_handle_close(handle);
+	}
+
+	if (!is_err_status(err)) {
+		hash_regions(digest, result->nr_region, result->regions);
+		eee_mfree(digest);
+	}
+
+	eee_mfree(out);
+
+	return err;
+}
+
+/* Embed the keys, flush and digest with a handle of the job's own */
+static void
+run_job(unsigned long job, stress_sink_t *sink, stress_result_t *result)
+{
+	unsigned long nr_msg = sink->nr_msg;
+
+	eee_memset(result, 0, sizeof(*result));
+
+	/* Half of the jobs are verbose to tell the verbosity is per thread */
+	cln_fw_thread_set_verbosity(job & 1);
+	result->err = __run_job(job, result);
+	cln_fw_thread_set_verbosity(0);
+
+	result->nr_msg = sink->nr_msg - nr_msg;
+}
+
+static int
+same_result(const stress_result_t *a, const stress_result_t *b)
+{
+	return a->err == b->err && a->nr_region == b->nr_region
+	       && a->nr_msg == b->nr_msg
+	       && !eee_memcmp(a->image, b->image, sizeof(a->image))
+	       && !eee_memcmp(a->regions, b->regions, sizeof(a->regions));
+}
+
+static void *
+stress_thread(void *arg)
+{
+	stress_sink_t sink = {
+		.thread = pthread_self(),
+	};
+	stress_result_t result;
+	unsigned long n;
+
+	cln_fw_thread_set_log_sink(log_sink, &sink);
+
+	while ((n = __atomic_fetch_add(&next_job, 1, __ATOMIC_RELAXED))
+			< nr_job * nr_round) {
+		run_job(n % nr_job, &sink, &result);
+
+		if (same_result(&result, expected + n % nr_job))
+			continue;
+
+		err(T("Job %ld mismatches the single-threaded run ")
+		    T("(err 0x%lx, %ld messages)\n"), n % nr_job,
+		    result.err, result.nr_msg);
+		__atomic_add_fetch(&nr_mismatch, 1, __ATOMIC_RELAXED);
+	}
+
+	cln_fw_thread_set_log_sink(NULL, NULL);
+
+	if (sink.nr_foreign) {
+		err(T("%ld messages of other threads are delivered\n"),
+		    sink.nr_foreign);
+		__atomic_add_fetch(&nr_mismatch, 1, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+/* Generate the images with different layouts */
+static void
+setup_fixture(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < STRESS_NR_IMAGE; ++i) {
+		cln_fw_gen_param_t param = {
+			.nr_flash_item = 4 + i,
+			.nr_boot_item = 2,
+			.nr_pdata_item = 4 + i * 2,
+			.pdata_item_len = 16,
+			.fw_version = 0x01020300,
+			.seed = i + 1,
+		};
+		void *buf;
+
+		if (is_err_status(cln_fw_util_generate_firmware(&param, &buf,
+								 fw_len + i)))
+			die("Failed to generate the firmware\n");
+
+		fw[i] = buf;
+	}
+}
+
+static err_status_t
+embed_dbx(void *fw_buf, unsigned long fw_buf_len, void **out,
+	  unsigned long *out_len, unsigned long *nr_pdata_item)
+{
+	cln_fw_handle_t handle = NULL;
+	platform_data_view_t view;
+	uint8_t key[STRESS_KEY_LEN / 4];
+	err_status_t err;
+
+	eee_memset(key, 0xdb, sizeof(key));
+
+	err = cln_fw_handle_open(&handle, fw_buf, fw_buf_len);
+	if (is_err_status(err))
+		return err;
+
+	err = cln_fw_handle_embed_key(handle, CLN_FW_SB_KEY_DBX, key,
+				      sizeof(key));
+	if (!is_err_status(err))
+		err = cln_fw_handle_flush(handle, out, out_len);
+	cln_fw_handle_close(handle);
+	if (is_err_status(err))
+		return err;
+
+	err = platform_data_probe(*out + *out_len + platform_data_offset(),
+				  platform_data_max_size(), &view);
+	if (is_err_status(err)) {
+		eee_mfree(*out);
+		return err;
+	}
+
+	*nr_pdata_item = view.nr_item;
+
+	return CLN_FW_ERR_NONE;
+}
+
+/* Embedding dbx into an image already carrying it updates the record */
+static void
+check_dbx_embed(void)
+{
+	void *once, *twice;
+	unsigned long once_len, twice_len;
+	unsigned long nr_once, nr_twice;
+
+	if (is_err_status(embed_dbx(fw[0], fw_len[0], &once, &once_len,
+				    &nr_once)))
+		die("Failed to embed dbx\n");
+
+	if (is_err_status(embed_dbx(once, once_len, &twice, &twice_len,
+				    &nr_twice)))
+		die("Failed to embed dbx again\n");
+
+	if (nr_twice != nr_once)
+		die("Embedding dbx again adds a record (%ld -> %ld items)\n",
+		    nr_once, nr_twice);
+
+	eee_mfree(twice);
+	eee_mfree(once);
+}
+
+int
+main(int argc, char *argv[])
+{
+	stress_sink_t sink;
+	pthread_t *thread;
+	unsigned long nr_thread = STRESS_DEFAULT_NR_THREAD;
+	unsigned long i, nr_msg;
+	int opt;
+
+	libclnfw_init();
+
+	nr_job = STRESS_DEFAULT_NR_JOB;
+	nr_round = STRESS_DEFAULT_NR_ROUND;
+
+	while ((opt = getopt(argc, argv, "j:n:r:h")) != -1) {
+		switch (opt) {
+		case 'j':
+			nr_thread = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			nr_job = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			nr_round = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			show_usage(argv[0]);
+			return opt == 'h' ? 0 : EXIT_FAILURE;
+		}
+	}
+
+	if (!nr_thread || !nr_job) {
+		show_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	setup_fixture();
+	check_dbx_embed();
+
+	expected = eee_malloc(nr_job * sizeof(*expected));
+	thread = eee_malloc(nr_thread * sizeof(*thread));
+	if (!expected || !thread)
+		die("Failed to allocate the jobs\n");
+
+	/* The results of the single-threaded run are expected */
+	sink.thread = pthread_self();
+	sink.nr_msg = 0;
+	sink.nr_foreign = 0;
+	cln_fw_thread_set_log_sink(log_sink, &sink);
+
+	for (i = 0, nr_msg = 0; i < nr_job; ++i) {
+		run_job(i, &sink, expected + i);
+		if (is_err_status(expected[i].err))
+			die("Job %ld failed with 0x%lx\n", i,
+			    expected[i].err);
+		nr_msg += expected[i].nr_msg;
+	}
+
+	cln_fw_thread_set_log_sink(NULL, NULL);
+
+	if (!nr_msg)
+		die("No message is logged by the verbose jobs\n");
+
+	for (i = 0; i < nr_thread; ++i) {
+		if (pthread_create(thread + i, NULL, stress_thread, NULL))
+			die("Failed to create the thread\n");
+	}
+
+	for (i = 0; i < nr_thread; ++i)
+		pthread_join(thread[i], NULL);
+
+	info_cont(T("%-30s %ld jobs x %ld rounds on %ld threads, ")
+		  T("%ld mismatches\n"), T("clnfw_stress"), nr_job, nr_round,
+		  nr_thread, nr_mismatch);
+
+	eee_mfree(thread);
+	eee_mfree(expected);
+	for (i = 0; i < STRESS_NR_IMAGE; ++i)
+		eee_mfree(fw[i]);
+
+	return nr_mismatch ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * CRC32 kernel micro-benchmark
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <cln_fw.h>
+#include <err_status.h>
+#include <time.h>
+#include "crc32.h"
+
+#define BENCH_BUF_SIZE			(8 * 1024 * 1024)
+#define BENCH_MIN_NSEC			500000000ULL
+/* The tails and misaligned heads checked against the reference */
+#define VERIFY_MAX_LEN			300
+#define VERIFY_MAX_OFFSET		16
+
+static uint64_t
+now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t
+crc32_of(const crc32_kernel_t *kernel, const uint8_t *buf, unsigned long len)
+{
+	return crc32_final(kernel->update(crc32_begin(), buf, len));
+}
+
+/* Every length and offset exercises the unrolled loop and its tails */
+static int
+verify_kernel(const crc32_kernel_t *kernel, const crc32_kernel_t *ref,
+	      const uint8_t *buf)
+{
+	unsigned long offset, len;
+
+	for (offset = 0; offset < VERIFY_MAX_OFFSET; ++offset) {
+		for (len = 0; len <= VERIFY_MAX_LEN; ++len) {
+			uint32_t crc = crc32_of(kernel, buf + offset, len);
+			uint32_t expected = crc32_of(ref, buf + offset, len);
+
+			if (crc == expected)
+				continue;
+
+			err(T("%s: CRC mismatch 0x%08x at offset %lu and ")
+			    T("length %lu, expected 0x%08x\n"), kernel->name,
+			    crc, offset, len, expected);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+bench_kernel(const crc32_kernel_t *kernel, uint8_t *buf,
+	     unsigned long len, uint32_t expected)
+{
+	uint64_t start, elapsed, bytes;
+	uint32_t crc;
+
+	crc = crc32_of(kernel, buf, len);
+	if (crc != expected) {
+		err(T("%s: CRC mismatch 0x%08x, expected 0x%08x\n"),
+		    kernel->name, crc, expected);
+		return -1;
+	}
+
+	bytes = 0;
+	start = now_nsec();
+	do {
+		crc = kernel->update(crc, buf, len);
+		bytes += len;
+		elapsed = now_nsec() - start;
+	} while (elapsed < BENCH_MIN_NSEC);
+
+	info_cont(T("%-10s %10lu %10.3f GB/s\n"), kernel->name, len,
+		  (double)bytes / elapsed);
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const unsigned long sizes[] = {
+		64, 4096, 0x20000, BENCH_BUF_SIZE
+	};
+	const crc32_kernel_t *ref;
+	uint8_t *buf;
+	unsigned int i, k;
+	int ret = 0;
+
+	libclnfw_init();
+
+	buf = eee_malloc(BENCH_BUF_SIZE);
+	if (!buf)
+		die("Failed to allocate the benchmark buffer\n");
+
+	srand(0);
+	for (i = 0; i < BENCH_BUF_SIZE; ++i)
+		buf[i] = rand();
+
+	/* The bytewise kernel is the reference */
+	ref = crc32_get_kernel(crc32_nr_kernel() - 1);
+
+	for (k = 0; k < crc32_nr_kernel(); ++k) {
+		const crc32_kernel_t *kernel = crc32_get_kernel(k);
+
+		if (kernel->available && !kernel->available())
+			continue;
+
+		if (verify_kernel(kernel, ref, buf))
+			ret = 1;
+	}
+
+	info_cont(T("Default kernel: %s\n\n"), crc32_current_kernel()->name);
+	info_cont(T("%-10s %10s %15s\n"), T("kernel"), T("size"),
+		  T("throughput"));
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		uint32_t expected = crc32_of(ref, buf, sizes[i]);
+
+		for (k = 0; k < crc32_nr_kernel(); ++k) {
+			const crc32_kernel_t *kernel = crc32_get_kernel(k);
+
+			if (kernel->available && !kernel->available()) {
+				info_cont(T("%-10s %10lu %15s\n"),
+					  kernel->name, sizes[i],
+					  T("unsupported"));
+				continue;
+			}
+
+			if (bench_kernel(kernel, buf, sizes[i], expected))
+				ret = 1;
+		}
+	}
+
+	eee_mfree(buf);
+
+	return ret;
+}
@@ -27,6 +27,13 @@ extern cln_fwtool_command_t command_sbembed;
 extern cln_fwtool_command_t command_show;
 extern cln_fwtool_command_t command_capsule;
 extern cln_fwtool_command_t command_diagnosis;
+extern cln_fwtool_command_t command_digest;
+extern cln_fwtool_command_t command_batch;
+extern cln_fwtool_command_t command_diff;
+extern cln_fwtool_command_t command_scan;
+extern cln_fwtool_command_t command_generate;
+extern cln_fwtool_command_t command_extract;
+extern cln_fwtool_command_t command_update;
 
 int
 cln_fwtool_add_command(cln_fwtool_command_t *cmd);
@@ -11,11 +11,14 @@
 #include <eee.h>
 #include <cln_fw.h>
 #include <err_status.h>
+#include <inttypes.h>
 #include "cln_fwtool.h"
 
 #define CLN_FWTOOL_MAX_COMMANDS			16
 
 static int opt_quiet;
+static int opt_stats;
+static int opt_stats_json;
 static cln_fwtool_command_t *curr_command;
 static unsigned int cln_fwtool_nr_command;
 static cln_fwtool_command_t *cln_fwtool_commands[CLN_FWTOOL_MAX_COMMANDS];
@@ -47,6 +50,9 @@ show_usage(const tchar_t *prog)
 	info_cont(T("  --version, -V: Show version number\n"));
 	info_cont(T("  --verbose, -v: Show verbose messages\n"));
 	info_cont(T("  --quite, -q: Don't show banner information\n"));
+	info_cont(T("  --stats[=json]: Print the time spent in each phase ")
+		  T("and the\n")
+		  T("    allocations to stderr, in JSON if specified\n"));
 	info_cont(T("\ncommand:\n"));
 	info_cont(T("  help: Display the help information for the ")
 		  T("specified command\n"));
@@ -55,6 +61,15 @@ show_usage(const tchar_t *prog)
 		  T("enablement\n"));
 	info_cont(T("  capsule: Generate capsule image\n"));
 	info_cont(T("  diagnosis: Give the diagosis information\n"));
+	info_cont(T("  digest: Print the SHA-256 manifest of firmware ")
+		  T("regions\n"));
+	info_cont(T("  batch: Embed the keys into a set of firmware ")
+		  T("images\n"));
+	info_cont(T("  diff: Compare two firmware images by regions\n"));
+	info_cont(T("  scan: Print the versions of many firmware images\n"));
+	info_cont(T("  generate: Generate synthetic firmware images\n"));
+	info_cont(T("  extract: Extract the MFH flash items to files\n"));
+	info_cont(T("  update: Replace or add the MFH flash items\n"));
 	info_cont(T("\nfile:\n"));
 	info_cont(T("  Input file to be parsed\n"));
 	info_cont(T("\nargs:\n"));
@@ -91,6 +106,47 @@ cln_fwtool_find_command(char *command)
 	return cln_fwtool_commands[i];
 }
 
+static void
+show_stats(void)
+{
+	cln_fw_stats_t stats;
+	unsigned int i;
+
+	if (is_err_status(cln_fw_stats_get(&stats)))
+		return;
+
+	if (opt_stats_json) {
+		fprintf(stderr, "{\"timers\": {");
+		for (i = 0; i < CLN_FW_STAT_MAX; ++i)
+			fprintf(stderr, "%s\"%s\": {\"count\": %" PRIu64
+				", \"nsec\": %" PRIu64 "}", i ? ", " : "",
+				cln_fw_stat_name(i), stats.timer[i].count,
+				stats.timer[i].nsec);
+		fprintf(stderr, "}, \"alloc\": {\"count\": %" PRIu64 ", "
+			"\"bytes\": %" PRIu64 "}, \"pool\": {\"hit\": %"
+			PRIu64 ", \"miss\": %" PRIu64 "}}\n", stats.nr_alloc,
+			stats.alloc_bytes, stats.nr_pool_hit,
+			stats.nr_pool_miss);
+		return;
+	}
+
+	fprintf(stderr, "\n%-20s %10s %12s %12s\n", "phase", "count",
+		"total (ms)", "avg (us)");
+	for (i = 0; i < CLN_FW_STAT_MAX; ++i) {
+		cln_fw_stat_timer_t *timer = stats.timer + i;
+
+		fprintf(stderr, "%-20s %10" PRIu64 " %12.3f %12.3f\n",
+			cln_fw_stat_name(i), timer->count,
+			timer->nsec / 1e6,
+			timer->count ? timer->nsec / 1e3 / timer->count : 0);
+	}
+	fprintf(stderr, "%-20s %10" PRIu64 " %12s %" PRIu64 " bytes\n",
+		"eee_malloc", stats.nr_alloc, "", stats.alloc_bytes);
+	fprintf(stderr, "%-20s %10" PRIu64 " %12s %" PRIu64
+		" from the pools\n", "class_instantiate", stats.nr_pool_hit + stats.nr_pool_miss,
+		"", stats.nr_pool_hit);
+}
+
 static int
 parse_command(char *prog, char *command, int argc, tchar_t *argv[])
 {
@@ -157,6 +213,7 @@ parse_options(int argc, tchar_t *argv[])
 		{ T("version"), no_argument, NULL, T('V') },
 		{ T("verbose"), no_argument, NULL, T('v') },
 		{ T("quiet"), no_argument, NULL, T('q') },
+		{ T("stats"), optional_argument, NULL, T('S') },
 		{ 0 },	/* NULL terminated */
 	};
 
@@ -183,6 +240,21 @@ parse_options(int argc, tchar_t *argv[])
 		case T('q'):
 			opt_quiet = 1;
 			break;
+		case T('S'):
+			if (optarg && eee_strcmp(optarg, T("json"))) {
+				err(T("Unrecognized format of stats: %s\n"),
+				    optarg);
+				return -1;
+			}
+
+			if (is_err_status(cln_fw_stats_enable(1))) {
+				warn(T("The statistics are not built in\n"));
+				break;
+			}
+
+			opt_stats = 1;
+			opt_stats_json = !!optarg;
+			break;
 		case 1:
 			index = optind;
 			optind = 1;
@@ -214,6 +286,13 @@ main(int argc, tchar_t *argv[])
 	cln_fwtool_add_command(&command_show);
 	cln_fwtool_add_command(&command_capsule);
 	cln_fwtool_add_command(&command_diagnosis);
+	cln_fwtool_add_command(&command_digest);
+	cln_fwtool_add_command(&command_batch);
+	cln_fwtool_add_command(&command_diff);
+	cln_fwtool_add_command(&command_scan);
+	cln_fwtool_add_command(&command_generate);
+	cln_fwtool_add_command(&command_extract);
+	cln_fwtool_add_command(&command_update);
 
 	ret = parse_options(argc, argv);
 	if (ret)
@@ -227,5 +306,10 @@ main(int argc, tchar_t *argv[])
 		exit(EXIT_SUCCESS);
 	}
 
-	return curr_command->run(argv[0]);
+	ret = curr_command->run(argv[0]);
+
+	if (opt_stats)
+		show_stats();
+
+	return ret;
 }
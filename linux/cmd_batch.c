@@ -0,0 +1,589 @@
+/*
+ * Batch command
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <cln_fw.h>
+#include <err_status.h>
+#include <pthread.h>
+#include <glob.h>
+#include <time.h>
+#include "cln_fwtool.h"
+
+#define BATCH_MAX_THREADS		64
+
+enum {
+	KEY_PK,
+	KEY_KEK,
+	KEY_DB,
+	KEY_DBX,
+	KEY_MAX
+};
+
+typedef struct {
+	char *path;
+	uint8_t *buf;
+	unsigned long len;
+} batch_key_t;
+
+typedef struct {
+	char *input;
+	char *output;
+	/* Per-job key files overriding the default keys */
+	char *key_path[KEY_MAX];
+	const char *result;
+	unsigned long elapsed_ms;
+} batch_job_t;
+
+static const char *key_names[KEY_MAX] = {
+	[KEY_PK] = "pk",
+	[KEY_KEK] = "kek",
+	[KEY_DB] = "db",
+	[KEY_DBX] = "dbx",
+};
+
+static char *opt_manifest;
+static char *opt_glob;
+static char *opt_output_dir;
+static unsigned int opt_threads;
+static batch_key_t default_keys[KEY_MAX];
+
+static batch_job_t *batch_jobs;
+static unsigned long batch_nr_job;
+static unsigned long batch_next_job;
+
+static void
+show_usage(tchar_t *prog)
+{
+	info_cont(T("\nusage: %s batch <manifest|directory> <args>\n"), prog);
+	info_cont(T("Embed the UEFI Secure Boot keys into a set of firmware ")
+		  T("images\n"));
+	info_cont(T("\nmanifest:\n"));
+	info_cont(T("  A text file with one job per line in the format of\n")
+		  T("    <input> <output> [pk=<file>] [kek=<file>] ")
+		  T("[db=<file>] [dbx=<file>]\n")
+		  T("  Empty lines and lines starting with '#' are ignored\n"));
+	info_cont(T("\ndirectory:\n"));
+	info_cont(T("  Process all regular files in the directory. ")
+		  T("--output-dir is required\n"));
+	info_cont(T("\nargs:\n"));
+	info_cont(T("  --glob, -g\n")
+		  T("    (optional) Process the files matching the pattern ")
+		  T("instead. --output-dir is required\n"));
+	info_cont(T("\n  --output-dir, -O\n")
+		  T("    (optional) The directory where the output files ")
+		  T("are saved with the input file names\n"));
+	info_cont(T("\n  --threads, -j\n")
+		  T("    (optional) The number of worker threads. ")
+		  T("By default, one thread per online CPU is used\n"));
+	info_cont(T("\n  --pk, -p\n")
+		  T("    (optional) Specify default DER formatted PK file\n"));
+	info_cont(T("\n  --kek, -k\n")
+		  T("    (optional) Specify default DER formatted KEK file\n"));
+	info_cont(T("\n  --db, -d\n")
+		  T("    (optional) Specify default DER formatted DB file\n"));
+	info_cont(T("\n  --dbx, -x\n")
+		  T("    (optional) Specify default DER formatted DBX file\n"));
+}
+
+static int
+set_default_key(int key, char *path)
+{
+	if (access(path, R_OK)) {
+		err(T("Invalid %s file specified\n"), key_names[key]);
+		return -1;
+	}
+
+	default_keys[key].path = path;
+
+	return 0;
+}
+
+static int
+parse_arg(int opt, char *optarg)
+{
+	switch (opt) {
+	case 1:
+		if (access(optarg, R_OK)) {
+			err(T("Invalid manifest or directory specified\n"));
+			return -1;
+		}
+		opt_manifest = optarg;
+		break;
+	case 'g':
+		opt_glob = optarg;
+		break;
+	case 'O':
+		opt_output_dir = optarg;
+		break;
+	case 'j':
+		opt_threads = strtoul(optarg, NULL, 0);
+		break;
+	case 'p':
+		return set_default_key(KEY_PK, optarg);
+	case 'k':
+		return set_default_key(KEY_KEK, optarg);
+	case 'd':
+		return set_default_key(KEY_DB, optarg);
+	case 'x':
+		return set_default_key(KEY_DBX, optarg);
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+static batch_job_t *
+add_job(void)
+{
+	batch_job_t *jobs;
+
+	jobs = realloc(batch_jobs, (batch_nr_job + 1) * sizeof(*jobs));
+	if (!jobs) {
+		err(T("Failed to allocate memory for batch job\n"));
+		return NULL;
+	}
+
+	batch_jobs = jobs;
+	memset(jobs + batch_nr_job, 0, sizeof(*jobs));
+
+	return jobs + batch_nr_job++;
+}
+
+static int
+parse_manifest_line(char *line, unsigned long line_no)
+{
+	batch_job_t *job;
+	char *tok, *save;
+	int key;
+
+	tok = strtok_r(line, " \t\r\n", &save);
+	if (!tok || *tok == '#')
+		return 0;
+
+	job = add_job();
+	if (!job)
+		return -1;
+
+	job->input = strdup(tok);
+	if (!job->input)
+		goto err_nomem;
+
+	tok = strtok_r(NULL, " \t\r\n", &save);
+	if (!tok) {
+		err(T("Missing output file at manifest line %ld\n"), line_no);
+		return -1;
+	}
+	job->output = strdup(tok);
+	if (!job->output)
+		goto err_nomem;
+
+	while ((tok = strtok_r(NULL, " \t\r\n", &save))) {
+		char *val;
+
+		val = strchr(tok, '=');
+		if (!val)
+			goto err_syntax;
+		*val++ = 0;
+
+		for (key = 0; key < KEY_MAX; ++key) {
+			if (!eee_strcmp(tok, key_names[key]))
+				break;
+		}
+		if (key == KEY_MAX || !*val)
+			goto err_syntax;
+
+		job->key_path[key] = strdup(val);
+		if (!job->key_path[key])
+			goto err_nomem;
+	}
+
+	return 0;
+
+err_syntax:
+	err(T("Invalid key specification at manifest line %ld\n"), line_no);
+
+	return -1;
+
+err_nomem:
+	err(T("Failed to allocate the job at manifest line %ld\n"), line_no);
+
+	return -1;
+}
+
+static int
+parse_manifest(const char *path)
+{
+	FILE *fp;
+	char *line;
+	size_t line_size;
+	unsigned long line_no;
+	int ret;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		err(T("Failed to open manifest %s\n"), path);
+		return -1;
+	}
+
+	line = NULL;
+	line_size = 0;
+	line_no = 0;
+	ret = 0;
+
+	while (getline(&line, &line_size, fp) != -1) {
+		ret = parse_manifest_line(line, ++line_no);
+		if (ret)
+			break;
+	}
+
+	free(line);
+	fclose(fp);
+
+	return ret;
+}
+
+static int
+glob_jobs(const char *pattern)
+{
+	glob_t g;
+	size_t i;
+	int ret;
+
+	if (!opt_output_dir) {
+		err(T("No output directory specified\n"));
+		return -1;
+	}
+
+	ret = glob(pattern, 0, NULL, &g);
+	if (ret == GLOB_NOMATCH) {
+		err(T("No file matches %s\n"), pattern);
+		return -1;
+	} else if (ret) {
+		err(T("Failed to expand %s\n"), pattern);
+		return -1;
+	}
+
+	for (i = 0, ret = 0; i < g.gl_pathc; ++i) {
+		batch_job_t *job;
+		struct stat st;
+		char *name;
+
+		if (stat(g.gl_pathv[i], &st) || !S_ISREG(st.st_mode))
+			continue;
+
+		job = add_job();
+		if (!job) {
+			ret = -1;
+			break;
+		}
+
+		name = strrchr(g.gl_pathv[i], '/');
+		name = name ? name + 1 : g.gl_pathv[i];
+
+		job->input = strdup(g.gl_pathv[i]);
+		if (asprintf(&job->output, "%s/%s", opt_output_dir, name) < 0)
+			job->output = NULL;
+
+		if (!job->input || !job->output) {
+			err(T("Failed to allocate the job for %s\n"),
+			    g.gl_pathv[i]);
+			ret = -1;
+			break;
+		}
+	}
+
+	globfree(&g);
+
+	return ret;
+}
+
+static int
+collect_jobs(void)
+{
+	struct stat st;
+	char *pattern;
+	int ret;
+
+	if (opt_glob)
+		return glob_jobs(opt_glob);
+
+	if (!opt_manifest) {
+		err(T("Neither manifest, directory nor glob specified\n"));
+		return -1;
+	}
+
+	if (stat(opt_manifest, &st)) {
+		err(T("Failed to stat %s\n"), opt_manifest);
+		return -1;
+	}
+
+	if (!S_ISDIR(st.st_mode))
+		return parse_manifest(opt_manifest);
+
+	if (asprintf(&pattern, "%s/*", opt_manifest) < 0)
+		return -1;
+
+	ret = glob_jobs(pattern);
+	free(pattern);
+
+	return ret;
+}
+
+static void
+free_jobs(void)
+{
+	unsigned long i;
+	int key;
+
+	for (i = 0; i < batch_nr_job; ++i) {
+		free(batch_jobs[i].input);
+		free(batch_jobs[i].output);
+		for (key = 0; key < KEY_MAX; ++key)
+			free(batch_jobs[i].key_path[key]);
+	}
+
+	free(batch_jobs);
+	batch_jobs = NULL;
+	batch_nr_job = 0;
+}
+
+static const char *
+process_job(batch_job_t *job)
+{
+	batch_key_t keys[KEY_MAX];
+	cln_fw_handle_t handle;
+	const char *result;
+	char *tmp_path;
+	err_status_t err;
+	int key, fd, nr_key;
+
+	nr_key = 0;
+	for (key = 0; key < KEY_MAX; ++key) {
+		keys[key] = default_keys[key];
+		if (job->key_path[key]) {
+			keys[key].path = job->key_path[key];
+			if (load_file(keys[key].path, &keys[key].buf,
+				      &keys[key].len)) {
+				result = "key load failed";
+				goto err_load_key;
+			}
+		}
+
+		if (keys[key].buf)
+			++nr_key;
+	}
+
+	if (!nr_key) {
+		result = "no key";
+		goto err_load_key;
+	}
+
+	handle = NULL;
+	err = cln_fw_handle_open_file(&handle, job->input);
+	if (is_err_status(err)) {
+		result = "parse failed";
+		goto err_load_key;
+	}
+
+	err = cln_fw_handle_embed_sb_keys(handle,
+					  keys[KEY_PK].buf, keys[KEY_PK].len,
+					  keys[KEY_KEK].buf, keys[KEY_KEK].len,
+					  keys[KEY_DB].buf, keys[KEY_DB].len,
+					  keys[KEY_DBX].buf, keys[KEY_DBX].len);
+	if (is_err_status(err)) {
+		result = "embed failed";
+		goto err_embed_key;
+	}
+
+	result = "write failed";
+
+	fd = open_output_tmp_file(job->output, &tmp_path);
+	if (fd >= 0) {
+		err = cln_fw_handle_flush_fd(handle, fd);
+		if (!close_output_tmp_file(fd, tmp_path, job->output,
+					   is_err_status(err)))
+			result = NULL;
+	}
+
+err_embed_key:
+	cln_fw_handle_close(handle);
+
+err_load_key:
+	while (key-- > 0) {
+		if (job->key_path[key])
+			free(keys[key].buf);
+	}
+
+	return result;
+}
+
+static unsigned long
+elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000 +
+	       (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static void *
+batch_worker(void *arg)
+{
+	unsigned long i;
+
+	/* Jobs are handed out one at a time to balance uneven images */
+	while ((i = __sync_fetch_and_add(&batch_next_job, 1)) < batch_nr_job) {
+		batch_job_t *job = batch_jobs + i;
+		struct timespec start;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		job->result = process_job(job);
+		job->elapsed_ms = elapsed_ms(&start);
+	}
+
+	return NULL;
+}
+
+static int
+load_default_keys(void)
+{
+	int key;
+
+	for (key = 0; key < KEY_MAX; ++key) {
+		if (!default_keys[key].path)
+			continue;
+
+		if (load_file(default_keys[key].path, &default_keys[key].buf,
+			      &default_keys[key].len))
+			return -1;
+	}
+
+	return 0;
+}
+
+static void
+free_default_keys(void)
+{
+	int key;
+
+	for (key = 0; key < KEY_MAX; ++key) {
+		free(default_keys[key].buf);
+		default_keys[key].buf = NULL;
+	}
+}
+
+static unsigned long
+show_result(unsigned long total_ms)
+{
+	unsigned long i, nr_fail;
+
+	info_cont(T("%-6s %-16s %-10s %s\n"), T("Job"), T("Result"),
+		  T("Time(ms)"), T("Input -> Output"));
+
+	for (i = 0, nr_fail = 0; i < batch_nr_job; ++i) {
+		batch_job_t *job = batch_jobs + i;
+
+		if (job->result)
+			++nr_fail;
+
+		info_cont(T("%-6ld %-16s %-10ld %s -> %s\n"), i,
+			  job->result ? job->result : T("ok"),
+			  job->elapsed_ms, job->input, job->output);
+	}
+
+	info_cont(T("\n%ld job(s), %ld succeeded, %ld failed, %ld ms\n"),
+		  batch_nr_job, batch_nr_job - nr_fail, nr_fail, total_ms);
+
+	return nr_fail;
+}
+
+static int
+run_batch(tchar_t *prog)
+{
+	pthread_t threads[BATCH_MAX_THREADS];
+	struct timespec start;
+	unsigned int nr_thread, i;
+	int ret;
+
+	ret = collect_jobs();
+	if (ret)
+		goto err_collect_jobs;
+
+	if (!batch_nr_job) {
+		err(T("No job to run\n"));
+		ret = -1;
+		goto err_collect_jobs;
+	}
+
+	/* Keys shared by all jobs are loaded only once */
+	ret = load_default_keys();
+	if (ret)
+		goto err_load_keys;
+
+	nr_thread = opt_threads;
+	if (!nr_thread) {
+		long nr_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+		nr_thread = nr_cpu > 0 ? nr_cpu : 1;
+	}
+	if (nr_thread > BATCH_MAX_THREADS)
+		nr_thread = BATCH_MAX_THREADS;
+	if (nr_thread > batch_nr_job)
+		nr_thread = batch_nr_job;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	batch_next_job = 0;
+	for (i = 0; i < nr_thread; ++i) {
+		if (pthread_create(threads + i, NULL, batch_worker, NULL))
+			break;
+	}
+
+	/* Fall back to run the remaining jobs in the current thread */
+	if (!i)
+		batch_worker(NULL);
+
+	while (i--)
+		pthread_join(threads[i], NULL);
+
+	if (show_result(elapsed_ms(&start)))
+		ret = -1;
+
+err_load_keys:
+	free_default_keys();
+
+err_collect_jobs:
+	free_jobs();
+
+	return ret;
+}
+
+static struct option long_opts[] = {
+	{ T("glob"), required_argument, NULL, T('g') },
+	{ T("output-dir"), required_argument, NULL, T('O') },
+	{ T("threads"), required_argument, NULL, T('j') },
+	{ T("pk"), required_argument, NULL, T('p') },
+	{ T("kek"), required_argument, NULL, T('k') },
+	{ T("db"), required_argument, NULL, T('d') },
+	{ T("dbx"), required_argument, NULL, T('x') },
+	{ 0 },	/* NULL terminated */
+};
+
+cln_fwtool_command_t command_batch = {
+	.name = T("batch"),
+	.optstring = T("-g:O:j:p:k:d:x:"),
+	.long_opts = long_opts,
+	.parse_arg = parse_arg,
+	.show_usage = show_usage,
+	.run = run_batch,
+};
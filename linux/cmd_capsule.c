@@ -18,6 +18,7 @@
 static char *opt_input_file;
 static char *opt_output_file = DEF_OUTPUT_NAME;
 static int opt_bios_only;
+static char *opt_base_file;
 
 static void
 show_usage(tchar_t *prog)
@@ -35,6 +36,11 @@ show_usage(tchar_t *prog)
 		  T("the BIOS part in firmware image only.\n")
 		  T("    By default, the entire input firmware image is ")
 		  T("wrapped with capsule header\n"));
+	info_cont(T("\n  --base, -B <file>\n")
+		  T("    (optional) The base firmware image currently ")
+		  T("programmed. Only the blocks\n")
+		  T("    changed since the base image are carried by ")
+		  T("the generated capsule\n"));
 }
 
 static int
@@ -54,6 +60,13 @@ parse_arg(int opt, char *optarg)
 	case 'b':
 		opt_bios_only = 1;
 		break;
+	case 'B':
+		if (access(optarg, R_OK)) {
+			err(T("Invalid base file specified\n"));
+			return -1;
+		}
+		opt_base_file = optarg;
+		break;
 	default:
 		return -1;
 	}
@@ -64,31 +77,59 @@ parse_arg(int opt, char *optarg)
 static int
 run_capsule(tchar_t *prog)
 {
-	void *fw, *out;
-	unsigned long fw_len, out_len;
+	cln_fw_handle_t handle, base_handle;
+	char *tmp_path;
+	unsigned int nr_extent;
+	unsigned long payload_len;
 	err_status_t err;
-	int ret;
+	int fd, ret;
 
 	if (!opt_input_file)
 		die("No input file specified\n");
 
-	ret = load_file(opt_input_file, (uint8_t **)&fw, &fw_len);
-	if (ret)
-		return ret;
-
-	err = cln_fw_util_generate_capsule(fw, fw_len, opt_bios_only,
-					   &out, &out_len);
+	handle = NULL;
+	err = cln_fw_handle_open_file(&handle, opt_input_file);
 	if (is_err_status(err))
-		ret = -1;
+		return -1;
 
-	free(fw);
+	base_handle = NULL;
+	if (opt_base_file) {
+		err = cln_fw_handle_open_file(&base_handle, opt_base_file);
+		if (is_err_status(err)) {
+			cln_fw_handle_close(handle);
+			return -1;
+		}
+	}
 
-	if (!ret) {
-		ret = save_output_file(opt_output_file, out, out_len);
-		if (!ret)
-			free(out);
+	ret = -1;
+
+	/*
+	 * The payload is streamed from the input without being staged.
+	 * The output file is only replaced once the capsule is written.
+	 */
+	fd = open_output_tmp_file(opt_output_file, &tmp_path);
+	if (fd >= 0) {
+		if (base_handle) {
+			err = cln_fw_handle_write_delta_capsule(handle,
+								base_handle,
+								opt_bios_only,
+								fd, &nr_extent,
+								&payload_len);
+			if (!is_err_status(err))
+				info(T("Carried %u extents in %lu bytes ")
+				     T("of payload\n"), nr_extent,
+				     payload_len);
+		} else
+			err = cln_fw_handle_write_capsule(handle,
+							  opt_bios_only, fd);
+		ret = close_output_tmp_file(fd, tmp_path, opt_output_file,
+					    is_err_status(err));
 	}
 
+	if (base_handle)
+		cln_fw_handle_close(base_handle);
+	cln_fw_handle_close(handle);
+
 	if (!ret)
 		info(T("Saved the unsigned capsule\n"));
 	else
@@ -100,12 +141,13 @@ run_capsule(tchar_t *prog)
 static struct option long_opts[] = {
 	{ T("output"), required_argument, NULL, T('o') },
 	{ T("bios-only"), no_argument, NULL, T('b') },
+	{ T("base"), required_argument, NULL, T('B') },
 	{ 0 },	/* NULL terminated */
 };
 
 cln_fwtool_command_t command_capsule = {
 	.name = T("capsule"),
-	.optstring = T("-o:b"),
+	.optstring = T("-o:bB:"),
 	.long_opts = long_opts,
 	.parse_arg = parse_arg,
 	.show_usage = show_usage,
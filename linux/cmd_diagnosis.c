@@ -46,42 +46,36 @@ parse_arg(int opt, char *optarg)
 static int
 run_diagnosis(tchar_t *prog)
 {
-	void *fw;
-	unsigned long fw_len;
 	cln_fw_handle_t handle;
 	err_status_t err;
 	int ret;
 
+	handle = NULL;
+
 	if (!opt_input_file) {
 		if (!cln_fw_util_cpu_is_clanton())
 			die("No input file specified\n");
 
-		fw_len = 0x800000;
-		ret = read_phys_mem("/dev/mem", (uint8_t **)&fw, fw_len,
-				    0xFF800000);
+		/* Only the windows parsed are mapped from the flash */
+		err = cln_fw_handle_open_phys(&handle, "/dev/mem",
+					      0xFF800000, 0x800000);
 	} else
-		ret = load_file(opt_input_file, (uint8_t **)&fw, &fw_len);
+		err = cln_fw_handle_open_file_lazy(&handle,
+						   opt_input_file);
 
-	if (ret)
-		return ret;
-
-	handle = NULL;
-	err = cln_fw_handle_open(&handle, fw, fw_len);
 	if (is_err_status(err))
-		goto err_open_handle;
+		return -1;
+
+	ret = 0;
 
-	err = cln_fw_handle_diagnose_firmware(handle, fw, fw_len);
+	/* Don't fetch the entire firmware which is not needed */
+	err = cln_fw_handle_diagnose_firmware(handle, NULL, 0);
 	if (is_err_status(err))
-		goto err_diagnose_firmware;
+		ret = -1;
 
 	cln_fw_handle_close(handle);
 
 	return ret;
-
-err_diagnose_firmware:
-err_open_handle:
-	eee_mfree(fw);
-	return -1;
 }
 
 static struct option long_opts[] = {
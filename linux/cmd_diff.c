@@ -0,0 +1,415 @@
+/*
+ * Firmware diff command
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <cln_fw.h>
+#include <err_status.h>
+#include <pthread.h>
+#include "cln_fwtool.h"
+
+#define DIFF_MAX_THREADS		64
+
+typedef struct {
+	char *old_file;
+	char *new_file;
+	/* The one-line summary, or NULL if failed */
+	char *result;
+} diff_pair_t;
+
+static char *opt_old_file;
+static char *opt_new_file;
+static char *opt_pairs_file;
+static int opt_summary;
+static unsigned int opt_threads;
+
+static diff_pair_t *diff_pairs;
+static unsigned long diff_nr_pair;
+static unsigned long diff_next_pair;
+
+static void
+show_usage(tchar_t *prog)
+{
+	info_cont(T("\nusage: %s diff <old> <new> <args>\n"), prog);
+	info_cont(T("Compare two firmware images and attribute the ")
+		  T("differences to the regions\n"));
+	info_cont(T("\nold, new:\n"));
+	info_cont(T("  Firmware images in the same size. The regions are ")
+		  T("located in the new image\n"));
+	info_cont(T("\nargs:\n"));
+	info_cont(T("  --summary, -s\n")
+		  T("    (optional) Only print the changed bytes per ")
+		  T("region\n"));
+	info_cont(T("\n  --pairs, -P <file>\n")
+		  T("    (optional) Compare the image pairs listed in the ")
+		  T("file with one\n")
+		  T("    \"<old> <new>\" pair per line, and print one line ")
+		  T("for each pair\n"));
+	info_cont(T("\n  --threads, -j\n")
+		  T("    (optional) The number of threads comparing the ")
+		  T("pairs in parallel.\n")
+		  T("    By default, one thread per online CPU is used\n"));
+}
+
+static int
+parse_arg(int opt, char *optarg)
+{
+	switch (opt) {
+	case 1:
+		if (access(optarg, R_OK)) {
+			err(T("Invalid input file specified\n"));
+			return -1;
+		}
+
+		if (!opt_old_file)
+			opt_old_file = optarg;
+		else if (!opt_new_file)
+			opt_new_file = optarg;
+		else {
+			err(T("Too many input files specified\n"));
+			return -1;
+		}
+		break;
+	case 's':
+		opt_summary = 1;
+		break;
+	case 'P':
+		if (access(optarg, R_OK)) {
+			err(T("Invalid pair list specified\n"));
+			return -1;
+		}
+		opt_pairs_file = optarg;
+		break;
+	case 'j':
+		opt_threads = strtoul(optarg, NULL, 0);
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+diff_files(const char *old_file, const char *new_file,
+	   cln_fw_diff_range_t **range, unsigned long *nr_range,
+	   cln_fw_diff_region_t **region, unsigned long *nr_region)
+{
+	cln_fw_handle_t old_handle, new_handle;
+	err_status_t err;
+
+	old_handle = NULL;
+	err = cln_fw_handle_open_file(&old_handle, old_file);
+	if (is_err_status(err))
+		return -1;
+
+	new_handle = NULL;
+	err = cln_fw_handle_open_file(&new_handle, new_file);
+	if (is_err_status(err)) {
+		cln_fw_handle_close(old_handle);
+		return -1;
+	}
+
+	err = cln_fw_handle_diff(new_handle, old_handle, range, nr_range,
+				 region, nr_region);
+
+	cln_fw_handle_close(new_handle);
+	cln_fw_handle_close(old_handle);
+
+	return is_err_status(err) ? -1 : 0;
+}
+
+static void
+show_diff(cln_fw_diff_range_t *range, unsigned long nr_range,
+	  cln_fw_diff_region_t *region, unsigned long nr_region)
+{
+	unsigned long i;
+
+	if (!opt_summary && nr_range) {
+		info_cont(T("%-10s %-10s %-10s %s\n"), T("Offset"),
+			  T("Length"), T("Changed"), T("Region"));
+
+		for (i = 0; i < nr_range; ++i)
+			info_cont(T("0x%08lx 0x%08lx %-10ld %s\n"),
+				  range[i].offset, range[i].length,
+				  range[i].nr_changed,
+				  region[range[i].region].region.name);
+
+		info_cont(T("\n"));
+	}
+
+	info_cont(T("%-10s %-10s %-10s %s\n"), T("Offset"), T("Length"),
+		  T("Changed"), T("Region"));
+
+	for (i = 0; i < nr_region; ++i) {
+		if (!region[i].nr_changed)
+			continue;
+
+		info_cont(T("0x%08lx 0x%08lx %-10ld %s\n"),
+			  region[i].region.offset, region[i].region.length,
+			  region[i].nr_changed, region[i].region.name);
+	}
+
+	info_cont(T("\n%ld byte(s) changed in %ld range(s)\n"),
+		  nr_region ? region[0].nr_changed : 0, nr_range);
+}
+
+/*
+ * Format the changed bytes and the most specific regions changed, e.g,
+ * "12 2 mfh item 3 (kernel),skm csbh signature"
+ */
+static char *
+format_pair_result(cln_fw_diff_range_t *range, unsigned long nr_range,
+		   cln_fw_diff_region_t *region, unsigned long nr_region)
+{
+	unsigned long i, nr;
+	uint8_t *used;
+	char *buf;
+	size_t size;
+	FILE *fp;
+
+	used = calloc(nr_region, 1);
+	if (!used)
+		return NULL;
+
+	for (i = 0; i < nr_range; ++i)
+		used[range[i].region] = 1;
+
+	buf = NULL;
+	fp = open_memstream(&buf, &size);
+	if (!fp) {
+		free(used);
+		return NULL;
+	}
+
+	fprintf(fp, "%ld %ld ", nr_region ? region[0].nr_changed : 0,
+		nr_range);
+
+	for (i = 0, nr = 0; i < nr_region; ++i) {
+		if (used[i])
+			fprintf(fp, "%s%s", nr++ ? "," : "",
+				region[i].region.name);
+	}
+
+	if (!nr_range)
+		fprintf(fp, "-");
+
+	fclose(fp);
+	free(used);
+
+	return buf;
+}
+
+static void *
+diff_worker(void *arg)
+{
+	unsigned long i;
+
+	while ((i = __sync_fetch_and_add(&diff_next_pair, 1)) < diff_nr_pair) {
+		diff_pair_t *pair = diff_pairs + i;
+		cln_fw_diff_range_t *range;
+		cln_fw_diff_region_t *region;
+		unsigned long nr_range, nr_region;
+
+		if (diff_files(pair->old_file, pair->new_file, &range,
+			       &nr_range, &region, &nr_region))
+			continue;
+
+		pair->result = format_pair_result(range, nr_range, region,
+						  nr_region);
+
+		eee_mfree(range);
+		eee_mfree(region);
+	}
+
+	return NULL;
+}
+
+static int
+parse_pairs(const char *path)
+{
+	FILE *fp;
+	char *line;
+	size_t line_size;
+	unsigned long line_no;
+	int ret;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		err(T("Failed to open pair list %s\n"), path);
+		return -1;
+	}
+
+	line = NULL;
+	line_size = 0;
+	line_no = 0;
+	ret = 0;
+
+	while (getline(&line, &line_size, fp) != -1) {
+		diff_pair_t *pairs;
+		char *old_file, *new_file, *save;
+
+		++line_no;
+
+		old_file = strtok_r(line, " \t\r\n", &save);
+		if (!old_file || *old_file == '#')
+			continue;
+
+		new_file = strtok_r(NULL, " \t\r\n", &save);
+		if (!new_file) {
+			err(T("Missing new file at line %ld\n"), line_no);
+			ret = -1;
+			break;
+		}
+
+		pairs = realloc(diff_pairs, (diff_nr_pair + 1)
+					    * sizeof(*pairs));
+		if (!pairs) {
+			ret = -1;
+			break;
+		}
+
+		diff_pairs = pairs;
+
+		old_file = strdup(old_file);
+		new_file = strdup(new_file);
+		if (!old_file || !new_file) {
+			free(new_file);
+			free(old_file);
+			err(T("Failed to allocate the pair at line %ld\n"),
+			    line_no);
+			ret = -1;
+			break;
+		}
+
+		pairs[diff_nr_pair].old_file = old_file;
+		pairs[diff_nr_pair].new_file = new_file;
+		pairs[diff_nr_pair].result = NULL;
+		++diff_nr_pair;
+	}
+
+	free(line);
+	fclose(fp);
+
+	return ret;
+}
+
+static void
+free_pairs(void)
+{
+	unsigned long i;
+
+	for (i = 0; i < diff_nr_pair; ++i) {
+		free(diff_pairs[i].old_file);
+		free(diff_pairs[i].new_file);
+		free(diff_pairs[i].result);
+	}
+
+	free(diff_pairs);
+	diff_pairs = NULL;
+	diff_nr_pair = 0;
+}
+
+static int
+run_pairs(void)
+{
+	pthread_t threads[DIFF_MAX_THREADS];
+	unsigned long i, nr_fail;
+	unsigned int nr_thread;
+	int ret;
+
+	ret = parse_pairs(opt_pairs_file);
+	if (ret)
+		goto out;
+
+	nr_thread = opt_threads;
+	if (!nr_thread) {
+		long nr_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+		nr_thread = nr_cpu > 0 ? nr_cpu : 1;
+	}
+	if (nr_thread > DIFF_MAX_THREADS)
+		nr_thread = DIFF_MAX_THREADS;
+	if (nr_thread > diff_nr_pair)
+		nr_thread = diff_nr_pair;
+
+	diff_next_pair = 0;
+	for (i = 0; i < nr_thread; ++i) {
+		if (pthread_create(threads + i, NULL, diff_worker, NULL))
+			break;
+	}
+
+	/* Fall back to compare the remaining pairs in the current thread */
+	if (!i)
+		diff_worker(NULL);
+
+	while (i--)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0, nr_fail = 0; i < diff_nr_pair; ++i) {
+		diff_pair_t *pair = diff_pairs + i;
+
+		if (!pair->result)
+			++nr_fail;
+
+		info_cont(T("%s %s %s\n"), pair->old_file, pair->new_file,
+			  pair->result ? pair->result : T("failed"));
+	}
+
+	if (nr_fail)
+		ret = -1;
+
+out:
+	free_pairs();
+
+	return ret;
+}
+
+static int
+run_diff(tchar_t *prog)
+{
+	cln_fw_diff_range_t *range;
+	cln_fw_diff_region_t *region;
+	unsigned long nr_range, nr_region;
+
+	if (opt_pairs_file)
+		return run_pairs();
+
+	if (!opt_old_file || !opt_new_file)
+		die("Two input files are required\n");
+
+	if (diff_files(opt_old_file, opt_new_file, &range, &nr_range,
+		       &region, &nr_region)) {
+		err(T("Failed to compare the firmware images\n"));
+		return -1;
+	}
+
+	show_diff(range, nr_range, region, nr_region);
+
+	eee_mfree(range);
+	eee_mfree(region);
+
+	return 0;
+}
+
+static struct option long_opts[] = {
+	{ T("summary"), no_argument, NULL, T('s') },
+	{ T("pairs"), required_argument, NULL, T('P') },
+	{ T("threads"), required_argument, NULL, T('j') },
+	{ 0 },	/* NULL terminated */
+};
+
+cln_fwtool_command_t command_diff = {
+	.name = T("diff"),
+	.optstring = T("-sP:j:"),
+	.long_opts = long_opts,
+	.parse_arg = parse_arg,
+	.show_usage = show_usage,
+	.run = run_diff,
+};
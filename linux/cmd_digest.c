@@ -0,0 +1,107 @@
+/*
+ * Firmware digest command
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <cln_fw.h>
+#include <err_status.h>
+#include "cln_fwtool.h"
+
+static char *opt_input_file;
+static unsigned int opt_threads;
+
+static void
+show_usage(tchar_t *prog)
+{
+	info_cont(T("\nusage: %s digest <file> <args>\n"), prog);
+	info_cont(T("Print the SHA-256 manifest of the firmware regions\n"));
+	info_cont(T("\nfile:\n"));
+	info_cont(T("  Input firmware to be parsed\n"));
+	info_cont(T("\nargs:\n"));
+	info_cont(T("  --threads, -j\n")
+		  T("    (optional) The number of threads hashing the ")
+		  T("regions in parallel.\n")
+		  T("    By default, one thread per online CPU is used\n"));
+}
+
+static int
+parse_arg(int opt, char *optarg)
+{
+	switch (opt) {
+	case 1:
+		if (access(optarg, R_OK)) {
+			err(T("Invalid input file specified\n"));
+			return -1;
+		}
+		opt_input_file = optarg;
+		break;
+	case 'j':
+		opt_threads = strtoul(optarg, NULL, 0);
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+run_digest(tchar_t *prog)
+{
+	cln_fw_handle_t handle;
+	cln_fw_digest_t *digest;
+	unsigned long i, nr_digest;
+	err_status_t err;
+
+	if (!opt_input_file)
+		die("No input file specified\n");
+
+	handle = NULL;
+	err = cln_fw_handle_open_file(&handle, opt_input_file);
+	if (is_err_status(err))
+		return -1;
+
+	err = cln_fw_handle_digest(handle, opt_threads, &digest, &nr_digest);
+	cln_fw_handle_close(handle);
+	if (is_err_status(err)) {
+		err(T("Failed to digest the firmware\n"));
+		return -1;
+	}
+
+	info_cont(T("%-10s %-10s %-64s %s\n"), T("Offset"), T("Length"),
+		  T("SHA-256"), T("Region"));
+
+	for (i = 0; i < nr_digest; ++i) {
+		unsigned int k;
+
+		info_cont(T("0x%08lx 0x%08lx "), digest[i].region.offset,
+			  digest[i].region.length);
+		for (k = 0; k < CLN_FW_DIGEST_SIZE; ++k)
+			info_cont(T("%02x"), digest[i].digest[k]);
+		info_cont(T(" %s\n"), digest[i].region.name);
+	}
+
+	eee_mfree(digest);
+
+	return 0;
+}
+
+static struct option long_opts[] = {
+	{ T("threads"), required_argument, NULL, T('j') },
+	{ 0 },	/* NULL terminated */
+};
+
+cln_fwtool_command_t command_digest = {
+	.name = T("digest"),
+	.optstring = T("-j:"),
+	.long_opts = long_opts,
+	.parse_arg = parse_arg,
+	.show_usage = show_usage,
+	.run = run_digest,
+};
@@ -0,0 +1,325 @@
+/*
+ * MFH flash item extraction command
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <cln_fw.h>
+#include <err_status.h>
+#include <errno.h>
+#include "cln_fwtool.h"
+
+#define EXTRACT_MAX_LIST		32
+
+static char *opt_input_file;
+static char *opt_output_dir = ".";
+static unsigned int opt_threads;
+static int opt_list;
+static char *opt_type[EXTRACT_MAX_LIST];
+static unsigned int opt_nr_type;
+static unsigned long opt_index[EXTRACT_MAX_LIST];
+static unsigned int opt_nr_index;
+
+static void
+show_usage(tchar_t *prog)
+{
+	info_cont(T("\nusage: %s extract <file> <args>\n"), prog);
+	info_cont(T("Extract the MFH flash items to files\n"));
+	info_cont(T("\nfile:\n"));
+	info_cont(T("  Input firmware to be parsed\n"));
+	info_cont(T("\nargs:\n"));
+	info_cont(T("  --type, -t <type,...>\n")
+		  T("    (optional) Extract the items of the types, given ")
+		  T("by name, e.g, kernel,\n")
+		  T("    or by number\n"));
+	info_cont(T("\n  --index, -i <index,...>\n")
+		  T("    (optional) Extract the items at the indexes in ")
+		  T("the MFH flash item table.\n")
+		  T("    By default, all the items laid out in the ")
+		  T("firmware are extracted\n"));
+	info_cont(T("\n  --output-dir, -O\n")
+		  T("    (optional) The directory where the items are ")
+		  T("saved as\n")
+		  T("    item-<index>-<type>.bin. By default, the current ")
+		  T("directory is used\n"));
+	info_cont(T("\n  --threads, -j\n")
+		  T("    (optional) The number of threads extracting the ")
+		  T("items in parallel.\n")
+		  T("    By default, one thread per online CPU is used\n"));
+	info_cont(T("\n  --list, -l\n")
+		  T("    (optional) List the flash items without ")
+		  T("extracting them\n"));
+}
+
+static int
+parse_type_list(char *arg)
+{
+	char *tok, *save;
+
+	for (tok = strtok_r(arg, ",", &save); tok;
+			tok = strtok_r(NULL, ",", &save)) {
+		if (opt_nr_type == EXTRACT_MAX_LIST) {
+			err(T("Too many types specified\n"));
+			return -1;
+		}
+
+		opt_type[opt_nr_type++] = tok;
+	}
+
+	return 0;
+}
+
+static int
+parse_index_list(char *arg)
+{
+	char *tok, *save;
+
+	for (tok = strtok_r(arg, ",", &save); tok;
+			tok = strtok_r(NULL, ",", &save)) {
+		if (opt_nr_index == EXTRACT_MAX_LIST) {
+			err(T("Too many indexes specified\n"));
+			return -1;
+		}
+
+		opt_index[opt_nr_index++] = strtoul(tok, NULL, 0);
+	}
+
+	return 0;
+}
+
+static int
+parse_arg(int opt, char *optarg)
+{
+	switch (opt) {
+	case 1:
+		if (access(optarg, R_OK)) {
+			err(T("Invalid input file specified\n"));
+			return -1;
+		}
+		opt_input_file = optarg;
+		break;
+	case 't':
+		return parse_type_list(optarg);
+	case 'i':
+		return parse_index_list(optarg);
+	case 'O':
+		opt_output_dir = optarg;
+		break;
+	case 'j':
+		opt_threads = strtoul(optarg, NULL, 0);
+		break;
+	case 'l':
+		opt_list = 1;
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+type_selected(cln_fw_flash_item_t *item)
+{
+	unsigned int i;
+
+	for (i = 0; i < opt_nr_type; ++i) {
+		char *end;
+		unsigned long type;
+
+		if (!eee_strcmp(opt_type[i], item->type_name))
+			return 1;
+
+		type = strtoul(opt_type[i], &end, 0);
+		if (end != opt_type[i] && !*end && type == item->type)
+			return 1;
+	}
+
+	return 0;
+}
+
+static int
+item_selected(cln_fw_flash_item_t *item)
+{
+	unsigned int i;
+
+	if (!opt_nr_type && !opt_nr_index)
+		return 1;
+
+	for (i = 0; i < opt_nr_index; ++i) {
+		if (opt_index[i] == item->index)
+			return 1;
+	}
+
+	return type_selected(item);
+}
+
+static void
+list_items(cln_fw_flash_item_t *item, unsigned long nr_item)
+{
+	unsigned long i;
+
+	info_cont(T("%-5s %-4s %-10s %-10s %-10s %s\n"), T("Index"),
+		  T("Type"), T("Address"), T("Length"), T("Offset"),
+		  T("Name"));
+
+	for (i = 0; i < nr_item; ++i) {
+		info_cont(T("%-5ld 0x%02x 0x%08x 0x%08lx "), item[i].index,
+			  item[i].type, item[i].addr, item[i].length);
+		if (item[i].offset == CLN_FW_OFFSET_NONE)
+			info_cont(T("%-10s "), T("-"));
+		else
+			info_cont(T("0x%08lx "), item[i].offset);
+		info_cont(T("%s\n"), item[i].type_name);
+	}
+}
+
+static int
+extract_items(cln_fw_handle_t handle, cln_fw_flash_item_t *item,
+	      unsigned long nr_item)
+{
+	cln_fw_extract_t *extract;
+	char **path;
+	unsigned long i, nr;
+	err_status_t err;
+	int extracted, ret;
+
+	extract = eee_malloc(nr_item * sizeof(*extract));
+	path = eee_malloc(nr_item * sizeof(*path));
+	if (!extract || !path) {
+		eee_mfree(path);
+		eee_mfree(extract);
+		return -1;
+	}
+
+	ret = -1;
+	extracted = 0;
+	nr = 0;
+
+	if (mkdir(opt_output_dir, 0777) && errno != EEXIST) {
+		err(T("Failed to create the directory %s\n"), opt_output_dir);
+		goto out;
+	}
+
+	for (i = 0; i < nr_item; ++i) {
+		if (!item_selected(item + i))
+			continue;
+
+		if (!item[i].length || item[i].offset == CLN_FW_OFFSET_NONE) {
+			/* Only complain about the items asked for */
+			if (opt_nr_type || opt_nr_index)
+				warn(T("Skipping flash item %ld not laid ")
+				     T("out in the firmware\n"),
+				     item[i].index);
+			continue;
+		}
+
+		if (asprintf(path + nr, "%s/item-%03ld-%s.bin",
+			     opt_output_dir, item[i].index,
+			     item[i].type_name) < 0)
+			goto close_files;
+
+		extract[nr].offset = item[i].offset;
+		extract[nr].length = item[i].length;
+		extract[nr].fd = open_output_file(path[nr]);
+		if (extract[nr].fd < 0) {
+			free(path[nr]);
+			goto close_files;
+		}
+
+		++nr;
+	}
+
+	if (!nr) {
+		err(T("No flash item to be extracted\n"));
+		goto close_files;
+	}
+
+	err = cln_fw_handle_extract(handle, extract, nr, opt_threads);
+	ret = is_err_status(err) ? -1 : 0;
+	extracted = 1;
+
+close_files:
+	for (i = 0; i < nr; ++i) {
+		if (close(extract[i].fd))
+			extract[i].status = CLN_FW_ERR_IO;
+
+		if (extracted && !is_err_status(extract[i].status))
+			info(T("Extracted %s (0x%lx bytes)\n"), path[i],
+			     extract[i].length);
+		else if (extracted) {
+			err(T("Failed to extract %s\n"), path[i]);
+			ret = -1;
+		}
+
+		free(path[i]);
+	}
+
+out:
+	eee_mfree(path);
+	eee_mfree(extract);
+
+	return ret;
+}
+
+static int
+run_extract(tchar_t *prog)
+{
+	cln_fw_handle_t handle;
+	cln_fw_flash_item_t *item;
+	unsigned long nr_item;
+	err_status_t err;
+	int ret;
+
+	if (!opt_input_file)
+		die("No input file specified\n");
+
+	handle = NULL;
+	err = cln_fw_handle_open_file(&handle, opt_input_file);
+	if (is_err_status(err))
+		return -1;
+
+	err = cln_fw_handle_flash_items(handle, &item, &nr_item);
+	if (is_err_status(err)) {
+		err(T("Failed to enumerate the flash items\n"));
+		cln_fw_handle_close(handle);
+		return -1;
+	}
+
+	if (opt_list) {
+		list_items(item, nr_item);
+		ret = 0;
+	} else
+		ret = extract_items(handle, item, nr_item);
+
+	eee_mfree(item);
+	cln_fw_handle_close(handle);
+
+	if (ret)
+		err(T("Failed to extract the flash items\n"));
+
+	return ret;
+}
+
+static struct option long_opts[] = {
+	{ T("type"), required_argument, NULL, T('t') },
+	{ T("index"), required_argument, NULL, T('i') },
+	{ T("output-dir"), required_argument, NULL, T('O') },
+	{ T("threads"), required_argument, NULL, T('j') },
+	{ T("list"), no_argument, NULL, T('l') },
+	{ 0 },	/* NULL terminated */
+};
+
+cln_fwtool_command_t command_extract = {
+	.name = T("extract"),
+	.optstring = T("-t:i:O:j:l"),
+	.long_opts = long_opts,
+	.parse_arg = parse_arg,
+	.show_usage = show_usage,
+	.run = run_extract,
+};
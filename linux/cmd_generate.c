@@ -0,0 +1,236 @@
+/*
+ * Synthetic firmware generation command
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <cln_fw.h>
+#include <err_status.h>
+#include <errno.h>
+#include "cln_fwtool.h"
+
+#define GEN_MAX_LIST			32
+
+static char *opt_output;
+static unsigned long opt_count = 1;
+static unsigned int opt_item_type[GEN_MAX_LIST];
+static unsigned int opt_pdata_id[GEN_MAX_LIST];
+
+static cln_fw_gen_param_t opt_param = {
+	.nr_flash_item = 4,
+	.nr_boot_item = 2,
+	.nr_pdata_item = 6,
+	.pdata_item_len = 16,
+	.fw_version = 0x01020300,
+};
+
+static void
+show_usage(tchar_t *prog)
+{
+	info_cont(T("\nusage: %s generate <args>\n"), prog);
+	info_cont(T("Generate synthetic firmware images in the Quark ")
+		  T("layout\n"));
+	info_cont(T("\nargs:\n"));
+	info_cont(T("  --output, -o <file|dir>\n")
+		  T("    The image generated, or the directory holding the ")
+		  T("images if\n")
+		  T("    more than one image is generated\n"));
+	info_cont(T("\n  --count, -n <n>\n")
+		  T("    (optional) The number of images. Image i is ")
+		  T("generated with\n")
+		  T("    seed + i. Default: 1\n"));
+	info_cont(T("\n  --size, -s <bytes>\n")
+		  T("    (optional) The size of image. Default: 0x800000\n"));
+	info_cont(T("\n  --flash-items, -f <n>\n")
+		  T("    (optional) The flash items with contents. The ")
+		  T("version item is\n")
+		  T("    always added. Default: 4\n"));
+	info_cont(T("\n  --flash-item-len, -L <bytes>\n")
+		  T("    (optional) The length of each flash item. ")
+		  T("Default: sharing the\n")
+		  T("    room below MFH\n"));
+	info_cont(T("\n  --flash-item-types, -t <type,...>\n")
+		  T("    (optional) The MFH types assigned to the flash ")
+		  T("items in turn.\n")
+		  T("    Default: 0x10,0x12,0xb,0x3\n"));
+	info_cont(T("\n  --boot-items, -b <n>\n")
+		  T("    (optional) The boot priority list size. ")
+		  T("Default: 2\n"));
+	info_cont(T("\n  --pdata-items, -p <n>\n")
+		  T("    (optional) The platform data items. Default: 6\n"));
+	info_cont(T("\n  --pdata-item-len, -l <bytes>\n")
+		  T("    (optional) The data length of each platform data ")
+		  T("item. Default: 16\n"));
+	info_cont(T("\n  --pdata-ids, -i <id,...>\n")
+		  T("    (optional) The ids assigned to the platform data ")
+		  T("items in turn.\n")
+		  T("    Default: 1,2,3,4,5,6\n"));
+	info_cont(T("\n  --fw-version, -V <version>\n")
+		  T("    (optional) Default: 0x01020300\n"));
+	info_cont(T("\n  --seed, -S <n>\n")
+		  T("    (optional) Default: 0\n"));
+}
+
+static int
+parse_list(char *arg, unsigned int *list, unsigned int *nr)
+{
+	char *tok, *save;
+
+	*nr = 0;
+
+	for (tok = strtok_r(arg, ",", &save); tok;
+			tok = strtok_r(NULL, ",", &save)) {
+		if (*nr == GEN_MAX_LIST) {
+			err(T("Too many values in the list\n"));
+			return -1;
+		}
+
+		list[(*nr)++] = strtoul(tok, NULL, 0);
+	}
+
+	return *nr ? 0 : -1;
+}
+
+static int
+parse_arg(int opt, char *optarg)
+{
+	switch (opt) {
+	case 'o':
+		opt_output = optarg;
+		break;
+	case 'n':
+		opt_count = strtoul(optarg, NULL, 0);
+		break;
+	case 's':
+		opt_param.fw_len = strtoul(optarg, NULL, 0);
+		break;
+	case 'f':
+		opt_param.nr_flash_item = strtoul(optarg, NULL, 0);
+		break;
+	case 'L':
+		opt_param.flash_item_len = strtoul(optarg, NULL, 0);
+		break;
+	case 't':
+		opt_param.flash_item_type = opt_item_type;
+		return parse_list(optarg, opt_item_type,
+				  &opt_param.nr_flash_item_type);
+	case 'b':
+		opt_param.nr_boot_item = strtoul(optarg, NULL, 0);
+		break;
+	case 'p':
+		opt_param.nr_pdata_item = strtoul(optarg, NULL, 0);
+		break;
+	case 'l':
+		opt_param.pdata_item_len = strtoul(optarg, NULL, 0);
+		break;
+	case 'i':
+		opt_param.pdata_item_id = opt_pdata_id;
+		return parse_list(optarg, opt_pdata_id,
+				  &opt_param.nr_pdata_item_id);
+	case 'V':
+		opt_param.fw_version = strtoul(optarg, NULL, 0);
+		break;
+	case 'S':
+		opt_param.seed = strtoul(optarg, NULL, 0);
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+generate_file(const char *path, unsigned long seed)
+{
+	cln_fw_gen_param_t param = opt_param;
+	void *fw;
+	unsigned long fw_len;
+	err_status_t err;
+	int fd, ret;
+
+	param.seed = seed;
+	err = cln_fw_util_generate_firmware(&param, &fw, &fw_len);
+	if (is_err_status(err)) {
+		err(T("Failed to generate the firmware\n"));
+		return -1;
+	}
+
+	fd = open_output_file(path);
+	if (fd < 0) {
+		eee_mfree(fw);
+		return -1;
+	}
+
+	ret = write_buffer(fd, fw, fw_len);
+	if (close(fd))
+		ret = -1;
+
+	eee_mfree(fw);
+
+	return ret;
+}
+
+static int
+run_generate(tchar_t *prog)
+{
+	unsigned long i;
+
+	if (!opt_output)
+		die("No output specified\n");
+
+	if (opt_count == 1)
+		return generate_file(opt_output, opt_param.seed);
+
+	if (mkdir(opt_output, 0777) && errno != EEXIST) {
+		err(T("Failed to create the directory %s\n"), opt_output);
+		return -1;
+	}
+
+	for (i = 0; i < opt_count; ++i) {
+		char *path;
+		int ret;
+
+		if (asprintf(&path, "%s/fw-%06ld.bin", opt_output, i) < 0)
+			return -1;
+
+		ret = generate_file(path, opt_param.seed + i);
+		free(path);
+		if (ret)
+			return -1;
+	}
+
+	info_cont(T("%ld image(s) generated in %s\n"), opt_count, opt_output);
+
+	return 0;
+}
+
+static struct option long_opts[] = {
+	{ T("output"), required_argument, NULL, T('o') },
+	{ T("count"), required_argument, NULL, T('n') },
+	{ T("size"), required_argument, NULL, T('s') },
+	{ T("flash-items"), required_argument, NULL, T('f') },
+	{ T("flash-item-len"), required_argument, NULL, T('L') },
+	{ T("flash-item-types"), required_argument, NULL, T('t') },
+	{ T("boot-items"), required_argument, NULL, T('b') },
+	{ T("pdata-items"), required_argument, NULL, T('p') },
+	{ T("pdata-item-len"), required_argument, NULL, T('l') },
+	{ T("pdata-ids"), required_argument, NULL, T('i') },
+	{ T("fw-version"), required_argument, NULL, T('V') },
+	{ T("seed"), required_argument, NULL, T('S') },
+	{ 0 },	/* NULL terminated */
+};
+
+cln_fwtool_command_t command_generate = {
+	.name = T("generate"),
+	.optstring = T("-o:n:s:f:L:t:b:p:l:i:V:S:"),
+	.long_opts = long_opts,
+	.parse_arg = parse_arg,
+	.show_usage = show_usage,
+	.run = run_generate,
+};
@@ -92,10 +92,12 @@ parse_arg(int opt, char *optarg)
 static int
 run_sbembed(tchar_t *prog)
 {
-	uint8_t *fw, *pk, *kek, *db, *dbx, *out;
-	unsigned long fw_len, pk_len, kek_len, db_len, dbx_len, out_len;
+	uint8_t *pk, *kek, *db, *dbx;
+	unsigned long pk_len, kek_len, db_len, dbx_len;
+	cln_fw_handle_t handle;
+	char *tmp_path;
 	err_status_t err;
-	int ret;
+	int fd, ret;
 
 	if (!opt_input_file)
 		die("No input file specified\n");
@@ -105,9 +107,10 @@ run_sbembed(tchar_t *prog)
 		return -1;
 	}
 
-	ret = load_file(opt_input_file, &fw, &fw_len);
-	if (ret)
-		return ret;
+	handle = NULL;
+	err = cln_fw_handle_open_file(&handle, opt_input_file);
+	if (is_err_status(err))
+		return -1;
 
 	if (opt_pk_file) {
 		ret = load_file(opt_pk_file, &pk, &pk_len);
@@ -145,14 +148,23 @@ run_sbembed(tchar_t *prog)
 		dbx_len = 0;
 	}
 
-	err = cln_fw_util_embed_sb_keys(fw, fw_len, pk, pk_len, kek, kek_len,
-					db, db_len, dbx, dbx_len,
-					(void **)&out, &out_len);
+	ret = -1;
+
+	err = cln_fw_handle_embed_sb_keys(handle, pk, pk_len, kek, kek_len,
+					  db, db_len, dbx, dbx_len);
 	if (is_err_status(err))
 		goto err_embde_key;
 
-	ret = save_output_file(opt_output_file, out, out_len);
-	free(out);
+	/*
+	 * Only the platform data region is materialized. The rest of
+	 * output firmware is copied from the input file by kernel.
+	 */
+	fd = open_output_tmp_file(opt_output_file, &tmp_path);
+	if (fd >= 0) {
+		err = cln_fw_handle_flush_fd(handle, fd);
+		ret = close_output_tmp_file(fd, tmp_path, opt_output_file,
+					    is_err_status(err));
+	}
 
 	if (!ret)
 		info(T("Saved the ouput firmware\n"));
@@ -172,7 +184,7 @@ err_load_kek:
 	free(pk);
 
 err_load_pk:
-	free(fw);
+	cln_fw_handle_close(handle);
 
 	return ret;
 }
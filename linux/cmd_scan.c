@@ -0,0 +1,229 @@
+/*
+ * Firmware archive scan command
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <cln_fw.h>
+#include <err_status.h>
+#include <dirent.h>
+#include "cln_fwtool.h"
+
+typedef struct {
+	err_status_t status;
+	unsigned int fw_version;
+} scan_result_t;
+
+static cln_fw_loader_param_t opt_param;
+
+static char **scan_paths;
+static unsigned long scan_nr_path;
+static scan_result_t *scan_results;
+
+static void
+show_usage(tchar_t *prog)
+{
+	info_cont(T("\nusage: %s scan <file|dir> ... <args>\n"), prog);
+	info_cont(T("Print the version of each firmware image in bulk\n"));
+	info_cont(T("\nfile, dir:\n"));
+	info_cont(T("  Firmware images, or directories whose regular files ")
+		  T("are all scanned\n"));
+	info_cont(T("\nargs:\n"));
+	info_cont(T("  --depth, -d <n>\n")
+		  T("    (optional) The number of images loaded ")
+		  T("concurrently. Default: 32\n"));
+	info_cont(T("\n  --mem-cap, -m <MiB>\n")
+		  T("    (optional) The memory buffering the windows read ")
+		  T("ahead. Default: unlimited\n"));
+	info_cont(T("\n  --no-uring, -U\n")
+		  T("    (optional) Load the images with a thread pool ")
+		  T("instead of io_uring\n"));
+}
+
+static int
+add_path(const char *path)
+{
+	char **paths;
+
+	paths = realloc(scan_paths, (scan_nr_path + 1) * sizeof(*paths));
+	if (!paths)
+		return -1;
+
+	scan_paths = paths;
+	paths[scan_nr_path] = strdup(path);
+	if (!paths[scan_nr_path])
+		return -1;
+
+	++scan_nr_path;
+
+	return 0;
+}
+
+/* Add the regular files in the directory in the alphabetical order */
+static int
+add_dir(const char *dir)
+{
+	struct dirent **ent;
+	int i, nr, ret;
+
+	nr = scandir(dir, &ent, NULL, alphasort);
+	if (nr < 0) {
+		err(T("Failed to scan the directory %s\n"), dir);
+		return -1;
+	}
+
+	for (i = 0, ret = 0; i < nr; ++i) {
+		struct stat st;
+		char *path;
+
+		if (ret || ent[i]->d_name[0] == '.'
+				|| asprintf(&path, "%s/%s", dir,
+					    ent[i]->d_name) < 0) {
+			free(ent[i]);
+			continue;
+		}
+
+		if (!stat(path, &st) && S_ISREG(st.st_mode))
+			ret = add_path(path);
+
+		free(path);
+		free(ent[i]);
+	}
+
+	free(ent);
+
+	return ret;
+}
+
+static int
+parse_arg(int opt, char *optarg)
+{
+	struct stat st;
+
+	switch (opt) {
+	case 1:
+		if (stat(optarg, &st)) {
+			err(T("Invalid input file specified\n"));
+			return -1;
+		}
+
+		if (S_ISDIR(st.st_mode))
+			return add_dir(optarg);
+
+		return add_path(optarg);
+	case 'd':
+		opt_param.queue_depth = strtoul(optarg, NULL, 0);
+		break;
+	case 'm':
+		opt_param.mem_cap = strtoul(optarg, NULL, 0) << 20;
+		break;
+	case 'U':
+		opt_param.no_uring = 1;
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+scan_image(void *data, unsigned long index, const char *path,
+	   cln_fw_handle_t handle, err_status_t status)
+{
+	scan_result_t *result = scan_results + index;
+
+	result->status = status;
+	if (is_err_status(status))
+		return;
+
+	result->status = cln_fw_handle_firmware_version(handle,
+							&result->fw_version);
+}
+
+static void
+free_paths(void)
+{
+	unsigned long i;
+
+	for (i = 0; i < scan_nr_path; ++i)
+		free(scan_paths[i]);
+
+	free(scan_paths);
+	scan_paths = NULL;
+	scan_nr_path = 0;
+}
+
+static int
+run_scan(tchar_t *prog)
+{
+	unsigned long i, nr_fail;
+	err_status_t err;
+	int ret;
+
+	if (!scan_nr_path)
+		die("No input file specified\n");
+
+	ret = -1;
+
+	scan_results = calloc(scan_nr_path, sizeof(*scan_results));
+	if (!scan_results)
+		goto out;
+
+	err = cln_fw_util_open_files((const char **)scan_paths, scan_nr_path,
+				     &opt_param, scan_image, NULL);
+	if (is_err_status(err)) {
+		err(T("Failed to load the firmware images\n"));
+		goto out;
+	}
+
+	for (i = 0, nr_fail = 0; i < scan_nr_path; ++i) {
+		scan_result_t *result = scan_results + i;
+		unsigned int v = result->fw_version;
+
+		if (is_err_status(result->status)) {
+			info_cont(T("%s: failed\n"), scan_paths[i]);
+			++nr_fail;
+			continue;
+		}
+
+		info_cont(T("%s: %d.%d.%d (%s Edition %d)\n"), scan_paths[i],
+			  v >> 24, (v >> 16) & 0xff, (v >> 8) & 0xff,
+			  ((v >> 4) & 0xf) == 0xf ? "Wind River" : "Intel",
+			  v & 0xf);
+	}
+
+	info_cont(T("\n%ld image(s) scanned, %ld failed\n"), scan_nr_path,
+		  nr_fail);
+
+	if (!nr_fail)
+		ret = 0;
+
+out:
+	free(scan_results);
+	scan_results = NULL;
+	free_paths();
+
+	return ret;
+}
+
+static struct option long_opts[] = {
+	{ T("depth"), required_argument, NULL, T('d') },
+	{ T("mem-cap"), required_argument, NULL, T('m') },
+	{ T("no-uring"), no_argument, NULL, T('U') },
+	{ 0 },	/* NULL terminated */
+};
+
+cln_fwtool_command_t command_scan = {
+	.name = T("scan"),
+	.optstring = T("-d:m:U"),
+	.long_opts = long_opts,
+	.parse_arg = parse_arg,
+	.show_usage = show_usage,
+	.run = run_scan,
+};
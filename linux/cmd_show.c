@@ -45,31 +45,29 @@ parse_arg(int opt, char *optarg)
 static int
 run_show(tchar_t *prog)
 {
-	void *fw;
-	unsigned long fw_len;
+	cln_fw_handle_t handle;
 	err_status_t err;
-	int ret;
+
+	handle = NULL;
 
 	if (!opt_input_file) {
 		if (!cln_fw_util_cpu_is_clanton())
 			die("No input file specified\n");
 
-		fw_len = 0x800000;
-		ret = read_phys_mem("/dev/mem", (uint8_t **)&fw, fw_len,
-				    0xFF800000);
+		/* Only the windows parsed are mapped from the flash */
+		err = cln_fw_handle_open_phys(&handle, "/dev/mem",
+					      0xFF800000, 0x800000);
 	} else
-		ret = load_file(opt_input_file, (uint8_t **)&fw, &fw_len);
-
-	if (ret)
-		return ret;
+		err = cln_fw_handle_open_file_lazy(&handle,
+						   opt_input_file);
 
-	err = cln_fw_util_show_firmware(fw, fw_len);
 	if (is_err_status(err))
-		ret = -1;
+		return -1;
 
-	free(fw);
+	cln_fw_handle_show_all(handle);
+	cln_fw_handle_close(handle);
 
-	return ret;
+	return 0;
 }
 
 static struct option long_opts[] = {
@@ -0,0 +1,240 @@
+/*
+ * MFH flash item update command
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <cln_fw.h>
+#include <err_status.h>
+#include "cln_fwtool.h"
+
+#define DEF_OUTPUT_NAME			T("output.bin")
+#define UPDATE_MAX_ITEMS		32
+
+static char *opt_input_file;
+static char *opt_output_file = DEF_OUTPUT_NAME;
+static cln_fw_item_update_t opt_update[UPDATE_MAX_ITEMS];
+static char *opt_item_file[UPDATE_MAX_ITEMS];
+static unsigned long opt_nr_update;
+static unsigned long opt_erase_block;
+static int opt_dry_run;
+
+static void
+show_usage(tchar_t *prog)
+{
+	info_cont(T("\nusage: %s update <file> <args>\n"), prog);
+	info_cont(T("Replace or add the MFH flash items in place\n"));
+	info_cont(T("\nfile:\n"));
+	info_cont(T("  Input firmware to be parsed\n"));
+	info_cont(T("\nargs:\n"));
+	info_cont(T("  --replace, -r <index>=<file>\n")
+		  T("    Replace the contents of the flash item at the ")
+		  T("index in the MFH flash\n")
+		  T("    item table. The item is moved if it no longer ")
+		  T("fits in place\n"));
+	info_cont(T("\n  --add, -a <type>=<file>\n")
+		  T("    Add a flash item of the type, given by name, ")
+		  T("e.g, kernel, or by number\n"));
+	info_cont(T("\n  --add-boot, -A <type>=<file>\n")
+		  T("    Add a flash item and append it to the boot ")
+		  T("priority list\n"));
+	info_cont(T("\n  --output-file, -o\n")
+		  T("    (optional) The output file name to override the ")
+		  T("default name \"%s\"\n"), DEF_OUTPUT_NAME);
+	info_cont(T("\n  --erase-block, -e <bytes>\n")
+		  T("    (optional) The erase block size of the SPI flash, ")
+		  T("e.g, 4096 or 65536.\n")
+		  T("    The items are placed to dirty the fewest erase ")
+		  T("blocks. By default, 4096\n"));
+	info_cont(T("\n  --dry-run, -n\n")
+		  T("    (optional) Report the cost to program the output ")
+		  T("without writing it\n"));
+	info_cont(T("\nThe options above may be given several times and ")
+		  T("applied in order\n"));
+}
+
+static int
+add_update(int opt, char *optarg)
+{
+	cln_fw_item_update_t *update;
+	char *file, *end;
+	err_status_t err;
+
+	if (opt_nr_update == UPDATE_MAX_ITEMS) {
+		err(T("Too many flash items specified\n"));
+		return -1;
+	}
+
+	file = strchr(optarg, '=');
+	if (!file || file == optarg || !file[1]) {
+		err(T("Invalid flash item specified: %s\n"), optarg);
+		return -1;
+	}
+	*file++ = 0;
+
+	if (access(file, R_OK)) {
+		err(T("Invalid flash item file specified: %s\n"), file);
+		return -1;
+	}
+
+	update = opt_update + opt_nr_update;
+
+	if (opt == 'r') {
+		update->index = strtoul(optarg, &end, 0);
+		if (*end) {
+			err(T("Invalid flash item index: %s\n"), optarg);
+			return -1;
+		}
+	} else {
+		update->index = CLN_FW_FLASH_ITEM_NEW;
+		update->bootable = opt == 'A';
+
+		update->type = strtoul(optarg, &end, 0);
+		if (*end) {
+			err = cln_fw_util_flash_item_type(optarg,
+							  &update->type);
+			if (is_err_status(err)) {
+				err(T("Invalid flash item type: %s\n"),
+				    optarg);
+				return -1;
+			}
+		}
+	}
+
+	opt_item_file[opt_nr_update++] = file;
+
+	return 0;
+}
+
+static int
+parse_arg(int opt, char *optarg)
+{
+	switch (opt) {
+	case 1:
+		if (access(optarg, R_OK)) {
+			err(T("Invalid input file specified\n"));
+			return -1;
+		}
+		opt_input_file = optarg;
+		break;
+	case 'r':
+	case 'a':
+	case 'A':
+		return add_update(opt, optarg);
+	case 'o':
+		opt_output_file = optarg;
+		break;
+	case 'e':
+		opt_erase_block = strtoul(optarg, NULL, 0);
+		if (!opt_erase_block || opt_erase_block % 4096
+				|| opt_erase_block & (opt_erase_block - 1)) {
+			err(T("Invalid erase block size specified\n"));
+			return -1;
+		}
+		break;
+	case 'n':
+		opt_dry_run = 1;
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+run_update(tchar_t *prog)
+{
+	cln_fw_handle_t handle;
+	cln_fw_flash_cost_t cost;
+	unsigned long i, nr_loaded, out_len;
+	char *tmp_path;
+	void *out;
+	err_status_t err;
+	int fd, ret;
+
+	if (!opt_input_file)
+		die("No input file specified\n");
+
+	if (!opt_nr_update) {
+		err(T("No flash item to be replaced or added\n"));
+		return -1;
+	}
+
+	handle = NULL;
+	err = cln_fw_handle_open_file(&handle, opt_input_file);
+	if (is_err_status(err))
+		return -1;
+
+	ret = -1;
+
+	for (nr_loaded = 0; nr_loaded < opt_nr_update; ++nr_loaded) {
+		cln_fw_item_update_t *update = opt_update + nr_loaded;
+
+		if (load_file(opt_item_file[nr_loaded],
+			      (uint8_t **)&update->data, &update->data_len))
+			goto out;
+	}
+
+	err = cln_fw_handle_update_flash_items(handle, opt_update,
+					       opt_nr_update, opt_erase_block,
+					       &out, &out_len, &cost);
+	if (is_err_status(err))
+		goto out;
+
+	info(T("Erase %ld block(s) of 0x%lx bytes, program 0x%lx bytes ")
+	     T("(%ld block(s) without erasing)\n"), cost.nr_erase,
+	     cost.erase_block, cost.program_bytes, cost.nr_program);
+
+	if (opt_dry_run) {
+		ret = 0;
+		goto free_out;
+	}
+
+	fd = open_output_tmp_file(opt_output_file, &tmp_path);
+	if (fd >= 0) {
+		ret = write_buffer(fd, out, out_len);
+		ret = close_output_tmp_file(fd, tmp_path, opt_output_file,
+					    ret);
+	}
+
+free_out:
+	eee_mfree(out);
+
+out:
+	for (i = 0; i < nr_loaded; ++i)
+		free((void *)opt_update[i].data);
+
+	cln_fw_handle_close(handle);
+
+	if (ret)
+		err(T("Failed to update the flash items\n"));
+	else if (!opt_dry_run)
+		info(T("Saved the output firmware\n"));
+
+	return ret;
+}
+
+static struct option long_opts[] = {
+	{ T("replace"), required_argument, NULL, T('r') },
+	{ T("add"), required_argument, NULL, T('a') },
+	{ T("add-boot"), required_argument, NULL, T('A') },
+	{ T("output-file"), required_argument, NULL, T('o') },
+	{ T("erase-block"), required_argument, NULL, T('e') },
+	{ T("dry-run"), no_argument, NULL, T('n') },
+	{ 0 },	/* NULL terminated */
+};
+
+cln_fwtool_command_t command_update = {
+	.name = T("update"),
+	.optstring = T("-r:a:A:o:e:n"),
+	.long_opts = long_opts,
+	.parse_arg = parse_arg,
+	.show_usage = show_usage,
+	.run = run_update,
+};
@@ -11,10 +11,170 @@
 #ifndef CLN_FW_H
 #define CLN_FW_H
 
+#include <eee.h>
 #include <err_status.h>
 
 typedef unsigned long *				cln_fw_handle_t;
 
+#define CLN_FW_REGION_NAME_SIZE			48
+
+typedef struct {
+	char name[CLN_FW_REGION_NAME_SIZE];
+	/* Offset from the start of the firmware image */
+	unsigned long offset;
+	unsigned long length;
+} cln_fw_region_t;
+
+#define CLN_FW_DIGEST_SIZE			32
+
+typedef struct {
+	cln_fw_region_t region;
+	/* SHA-256 of the region */
+	unsigned char digest[CLN_FW_DIGEST_SIZE];
+} cln_fw_digest_t;
+
+/* The flash item is not laid out in the firmware image */
+#define CLN_FW_OFFSET_NONE			(~0UL)
+
+typedef struct {
+	/* The index in the MFH flash item table */
+	unsigned long index;
+	unsigned int type;
+	const char *type_name;
+	/* The flash address and length claimed by MFH */
+	unsigned int addr;
+	unsigned long length;
+	/* Offset from the start of the firmware image */
+	unsigned long offset;
+} cln_fw_flash_item_t;
+
+/* Add a flash item rather than replace one */
+#define CLN_FW_FLASH_ITEM_NEW			(~0UL)
+
+typedef struct {
+	/* The flash item to be replaced, or CLN_FW_FLASH_ITEM_NEW */
+	unsigned long index;
+	/* The type of the item added */
+	unsigned int type;
+	/* Append the item added to the boot priority list */
+	int bootable;
+	const void *data;
+	unsigned long data_len;
+} cln_fw_item_update_t;
+
+typedef struct {
+	/* The erase block size the cost is estimated for */
+	unsigned long erase_block;
+	/* The blocks erased, i.e, having any bit set back to 1 */
+	unsigned long nr_erase;
+	/* The blocks programmed without being erased */
+	unsigned long nr_program;
+	/* The bytes programmed, including the ones rewritten after erasing */
+	unsigned long program_bytes;
+} cln_fw_flash_cost_t;
+
+typedef struct {
+	/* The extent of the firmware image to be copied */
+	unsigned long offset;
+	unsigned long length;
+	/* Written from the current position */
+	int fd;
+	/* Set by the extraction for this extent */
+	err_status_t status;
+} cln_fw_extract_t;
+
+typedef struct {
+	/* Offset from the start of the firmware image */
+	unsigned long offset;
+	unsigned long length;
+	/* The number of differing bytes in the range */
+	unsigned long nr_changed;
+	/* Index of the most specific region covering the range */
+	unsigned long region;
+} cln_fw_diff_range_t;
+
+typedef struct {
+	cln_fw_region_t region;
+	/* The number of differing bytes in the region */
+	unsigned long nr_changed;
+} cln_fw_diff_region_t;
+
+typedef struct {
+	/* The number of images loaded concurrently, 0 for the default */
+	unsigned int queue_depth;
+	/* The bytes of images buffered at once, 0 for no limit */
+	unsigned long mem_cap;
+	/* Load through the thread pool even if io_uring is available */
+	int no_uring;
+} cln_fw_loader_param_t;
+
+/* The image buffer is only valid during the call */
+typedef void (*cln_fw_loader_fn_t)(void *data, unsigned long index,
+				   const char *path, void *fw,
+				   unsigned long fw_len, err_status_t status);
+
+/* The handle is only valid during the call, and NULL on failure */
+typedef void (*cln_fw_opener_fn_t)(void *data, unsigned long index,
+				   const char *path, cln_fw_handle_t handle,
+				   err_status_t status);
+
+typedef struct {
+	/* The size of image, 8 MiB if 0 */
+	unsigned long fw_len;
+	/* The flash items with contents, followed by the version item */
+	unsigned int nr_flash_item;
+	/* The length of each flash item, or sharing the room below MFH */
+	unsigned long flash_item_len;
+	/* The types assigned to the flash items in turn, or the defaults */
+	const unsigned int *flash_item_type;
+	unsigned int nr_flash_item_type;
+	/* Referring to the first flash items */
+	unsigned int nr_boot_item;
+	unsigned int nr_pdata_item;
+	/* The length of data of each platform data item */
+	unsigned int pdata_item_len;
+	/* The ids assigned to the platform data items in turn */
+	const unsigned int *pdata_item_id;
+	unsigned int nr_pdata_item_id;
+	unsigned int fw_version;
+	/* The contents of image are derived from the seed */
+	unsigned long seed;
+} cln_fw_gen_param_t;
+
+typedef enum {
+	CLN_FW_STAT_LOAD_FILE,
+	CLN_FW_STAT_PARSE,
+	CLN_FW_STAT_MFH_PROBE,
+	CLN_FW_STAT_PDATA_PROBE,
+	CLN_FW_STAT_SKM_PROBE,
+	CLN_FW_STAT_CSBH_PROBE,
+	CLN_FW_STAT_CRC32,
+	/* Including the write if flushed to a file descriptor */
+	CLN_FW_STAT_FLUSH,
+	CLN_FW_STAT_SAVE_FILE,
+	CLN_FW_STAT_MAX,
+} cln_fw_stat_t;
+
+/* 64-bit even on 32-bit hosts so that long runs do not wrap */
+typedef struct {
+	uint64_t count;
+	/* The total time in nanoseconds */
+	uint64_t nsec;
+} cln_fw_stat_timer_t;
+
+typedef struct {
+	cln_fw_stat_timer_t timer[CLN_FW_STAT_MAX];
+	/* The calls of eee_malloc() and the bytes requested */
+	uint64_t nr_alloc;
+	uint64_t alloc_bytes;
+	/*
+	 * The objects instantiated from and out of the recycled pools of
+	 * all classes, counted even while the statistics are disabled
+	 */
+	uint64_t nr_pool_hit;
+	uint64_t nr_pool_miss;
+} cln_fw_stats_t;
+
 typedef enum {
 	CLN_FW_SB_KEY_PK,
 	CLN_FW_SB_KEY_KEK,
@@ -37,6 +197,8 @@ typedef enum {
 #define CLN_FW_ERR_PDATA_ITEM_NOT_FOUND		CLN_FW_ERR(6)
 #define CLN_FW_ERR_MFH_FLASH_ITEM_NOT_FOUND	CLN_FW_ERR(7)
 #define CLN_FW_ERR_INVALID_CSBH			CLN_FW_ERR(8)
+#define CLN_FW_ERR_IO				CLN_FW_ERR(9)
+#define CLN_FW_ERR_UNSUPPORTED			CLN_FW_ERR(10)
 
 extern void __attribute__ ((constructor))
 libclnfw_init(void);
@@ -44,25 +206,93 @@ libclnfw_init(void);
 /* Handle routines */
 err_status_t
 cln_fw_handle_open(cln_fw_handle_t *handle, void *fw, unsigned long fw_len);
+err_status_t
+cln_fw_handle_open_file(cln_fw_handle_t *handle, const char *file_path);
+err_status_t
+cln_fw_handle_open_file_lazy(cln_fw_handle_t *handle, const char *file_path);
+err_status_t
+cln_fw_handle_open_phys(cln_fw_handle_t *handle, const char *mem_path,
+			unsigned long phys_addr, unsigned long fw_len);
 void
 cln_fw_handle_close(cln_fw_handle_t handle);
+err_status_t
+cln_fw_handle_firmware(cln_fw_handle_t handle, void **fw,
+		       unsigned long *fw_len);
+err_status_t
+cln_fw_handle_firmware_version(cln_fw_handle_t handle,
+			       unsigned int *fw_version);
 void
 cln_fw_handle_show_all(cln_fw_handle_t handle);
 err_status_t
 cln_fw_handle_embed_key(cln_fw_handle_t handle, cln_fw_sb_key_t key,
 			void *in, unsigned long in_len);
 err_status_t
+cln_fw_handle_embed_sb_keys(cln_fw_handle_t handle,
+			    void *pk, unsigned long pk_len,
+			    void *kek, unsigned long kek_len,
+			    void *db, unsigned long db_len,
+			    void *dbx, unsigned long dbx_len);
+err_status_t
 cln_fw_handle_flush(cln_fw_handle_t handle, void **out,
 		    unsigned long *out_len);
 err_status_t
+cln_fw_handle_flush_buffer(cln_fw_handle_t handle, void *buf,
+			   unsigned long buf_len);
+err_status_t
+cln_fw_handle_flush_fd(cln_fw_handle_t handle, int fd);
+err_status_t
 cln_fw_handle_generate_capsule(cln_fw_handle_t handle, int bios_only,
 			       void **out, unsigned long *out_len);
 err_status_t
+cln_fw_handle_write_capsule(cln_fw_handle_t handle, int bios_only, int fd);
+err_status_t
+cln_fw_handle_write_delta_capsule(cln_fw_handle_t handle,
+				  cln_fw_handle_t base_handle, int bios_only,
+				  int fd, unsigned int *nr_extent,
+				  unsigned long *payload_len);
+/* in is deprecated. Pass NULL to diagnose the firmware of the handle. */
+err_status_t
 cln_fw_handle_diagnose_firmware(cln_fw_handle_t handle, void *in,
 				unsigned long in_len);
+err_status_t
+cln_fw_handle_regions(cln_fw_handle_t handle, cln_fw_region_t **out,
+		      unsigned long *nr_region);
+err_status_t
+cln_fw_handle_digest(cln_fw_handle_t handle, unsigned int nr_thread,
+		     cln_fw_digest_t **out, unsigned long *nr_digest);
+err_status_t
+cln_fw_handle_flash_items(cln_fw_handle_t handle, cln_fw_flash_item_t **out,
+			  unsigned long *nr_item);
+err_status_t
+cln_fw_handle_extract(cln_fw_handle_t handle, cln_fw_extract_t *extract,
+		      unsigned long nr_extract, unsigned int nr_thread);
+err_status_t
+cln_fw_handle_update_flash_items(cln_fw_handle_t handle,
+				 const cln_fw_item_update_t *update,
+				 unsigned long nr_update,
+				 unsigned long erase_block, void **out,
+				 unsigned long *out_len,
+				 cln_fw_flash_cost_t *cost);
+err_status_t
+cln_fw_handle_diff(cln_fw_handle_t handle, cln_fw_handle_t other,
+		   cln_fw_diff_range_t **range, unsigned long *nr_range,
+		   cln_fw_diff_region_t **region, unsigned long *nr_region);
 
 /* Utility routines */
 err_status_t
+cln_fw_util_generate_firmware(const cln_fw_gen_param_t *param, void **out,
+			      unsigned long *out_len);
+err_status_t
+cln_fw_util_load_files(const char **path, unsigned long nr_path,
+		       const cln_fw_loader_param_t *param,
+		       cln_fw_loader_fn_t fn, void *data);
+err_status_t
+cln_fw_util_open_files(const char **path, unsigned long nr_path,
+		       const cln_fw_loader_param_t *param,
+		       cln_fw_opener_fn_t fn, void *data);
+err_status_t
+cln_fw_util_flash_item_type(const char *name, unsigned int *type);
+err_status_t
 cln_fw_util_show_firmware(void *fw, unsigned long fw_len);
 err_status_t
 cln_fw_util_embed_sb_keys(void *fw, unsigned long fw_len,
@@ -82,4 +312,39 @@ cln_fw_verbose(void);
 void
 cln_fw_set_verbosity(int verbose);
 
+/*
+ * Statistics routines. CLN_FW_ERR_UNSUPPORTED is returned if the library
+ * is built without the statistics.
+ */
+err_status_t
+cln_fw_stats_enable(int enable);
+err_status_t
+cln_fw_stats_get(cln_fw_stats_t *stats);
+const char *
+cln_fw_stat_name(cln_fw_stat_t stat);
+
+/*
+ * The log messages are written to stdout or stderr by default. A thread
+ * may override the verbosity and redirect its messages to a sink.
+ */
+typedef enum {
+	CLN_FW_LOG_DEBUG,
+	CLN_FW_LOG_INFO,
+	CLN_FW_LOG_WARN,
+	CLN_FW_LOG_ERROR,
+	/* The continuation of an error message, printed to stdout */
+	CLN_FW_LOG_ERROR_CONT,
+} cln_fw_log_level_t;
+
+typedef void (*cln_fw_log_sink_t)(cln_fw_log_level_t level,
+				  const char *msg, void *data);
+
+void
+cln_fw_log(cln_fw_log_level_t level, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void
+cln_fw_thread_set_verbosity(int verbose);
+void
+cln_fw_thread_set_log_sink(cln_fw_log_sink_t sink, void *data);
+
 #endif	/* CLN_FW_H */
\ No newline at end of file
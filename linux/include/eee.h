@@ -24,6 +24,7 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #define T(str)			str
 
@@ -39,29 +40,30 @@ typedef unsigned int		bool;
 #define dbg(fmt, ...) \
 	do {	\
 		if (cln_fw_verbose())	\
-			fprintf(stdout, T("DEBUG: ") fmt, ##__VA_ARGS__);	\
+			cln_fw_log(CLN_FW_LOG_DEBUG, T("DEBUG: ") fmt,	\
+				   ##__VA_ARGS__);	\
 	} while (0)
 
 #define dbg_cont(fmt, ...) \
 	do {	\
 		if (cln_fw_verbose())	\
-			fprintf(stdout, fmt, ##__VA_ARGS__);	\
+			cln_fw_log(CLN_FW_LOG_DEBUG, fmt, ##__VA_ARGS__); \
 	} while (0)
 
 #define info(fmt, ...) \
-	fprintf(stdout, T("INFO: ") fmt, ##__VA_ARGS__)
+	cln_fw_log(CLN_FW_LOG_INFO, T("INFO: ") fmt, ##__VA_ARGS__)
 
 #define info_cont(fmt, ...) \
-	fprintf(stdout, fmt, ##__VA_ARGS__)
+	cln_fw_log(CLN_FW_LOG_INFO, fmt, ##__VA_ARGS__)
 
 #define warn(fmt, ...) \
-	fprintf(stderr, T("WARNING: ") fmt, ##__VA_ARGS__)
+	cln_fw_log(CLN_FW_LOG_WARN, T("WARNING: ") fmt, ##__VA_ARGS__)
 
 #define err(fmt, ...) \
-	fprintf(stderr, T("ERROR: ") fmt, ##__VA_ARGS__)
+	cln_fw_log(CLN_FW_LOG_ERROR, T("ERROR: ") fmt, ##__VA_ARGS__)
 
 #define err_cont(fmt, ...) \
-	fprintf(stdout, fmt, ##__VA_ARGS__)
+	cln_fw_log(CLN_FW_LOG_ERROR_CONT, fmt, ##__VA_ARGS__)
 
 int
 read_phys_mem(const char *file_path, uint8_t **out, unsigned long len,
@@ -69,7 +71,28 @@ read_phys_mem(const char *file_path, uint8_t **out, unsigned long len,
 int
 load_file(const char *file_path, uint8_t **out, unsigned long *out_len);
 int
+map_file(const char *file_path, uint8_t **out, unsigned long *out_len,
+	 int *out_fd);
+int
+open_input_file(const char *file_path, unsigned long *out_len);
+void
+unmap_file(uint8_t *buf, unsigned long len);
+int
 save_output_file(const char *file_path, uint8_t *buf, unsigned long size);
+int
+open_output_file(const char *file_path);
+int
+open_output_tmp_file(const char *file_path, char **tmp_path);
+int
+close_output_tmp_file(int fd, char *tmp_path, const char *file_path,
+		      int failed);
+int
+write_buffer(int fd, const void *buf, unsigned long size);
+int
+write_vector(int fd, struct iovec *iov, int nr_iov);
+int
+write_file_extent(int out_fd, int in_fd, const void *in_buf,
+		  unsigned long offset, unsigned long size);
 
 size_t
 eee_strlen(const char *s);
@@ -84,6 +107,8 @@ eee_memcmp(const void *s1, const void *s2, unsigned long n);
 void *
 eee_memcpy(void *dst, const void *src, unsigned long size);
 void *
+eee_memmove(void *dst, const void *src, unsigned long size);
+void *
 eee_memset(void *s, int c, unsigned long n);
 void *
 eee_malloc(unsigned long size);
@@ -0,0 +1,173 @@
+/*
+ * Arena allocator
+ *
+ * The memory allocated from an arena is released all at once when the
+ * arena is destroyed. The allocation without an arena falls back to the
+ * heap.
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <err_status.h>
+#include <cln_fw.h>
+#include "internal.h"
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE		(16 * 1024)
+#define ARENA_ALIGN			16
+
+typedef struct __arena_chunk		arena_chunk_t;
+
+struct __arena_chunk {
+	arena_chunk_t *next;
+	unsigned long size;
+	unsigned long used;
+	unsigned long pad;
+	uint8_t data[0];
+};
+
+struct __arena {
+	arena_chunk_t *chunk;
+	bcll_t cleanup_list;
+};
+
+static arena_chunk_t *
+new_chunk(unsigned long size)
+{
+	arena_chunk_t *chunk;
+
+	chunk = eee_malloc(sizeof(*chunk) + size);
+	if (!chunk)
+		return NULL;
+
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+
+	return chunk;
+}
+
+err_status_t
+arena_create(arena_t **out)
+{
+	arena_t *arena;
+
+	if (!out)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	arena = eee_malloc(sizeof(*arena));
+	if (!arena)
+		return CLN_FW_ERR_OUT_OF_MEM;
+
+	arena->chunk = NULL;
+	bcll_init(&arena->cleanup_list);
+	*out = arena;
+
+	return CLN_FW_ERR_NONE;
+}
+
+void
+arena_destroy(arena_t *arena)
+{
+	arena_chunk_t *chunk, *next;
+
+	if (!arena)
+		return;
+
+	/*
+	 * Run the cleanups in the order of registration. A cleanup may
+	 * delete the others registered later.
+	 */
+	while (!bcll_empty(&arena->cleanup_list)) {
+		arena_cleanup_t *cleanup;
+
+		cleanup = container_of(arena->cleanup_list.next,
+				       arena_cleanup_t, link);
+		bcll_del_init(&cleanup->link);
+		cleanup->fn(cleanup);
+	}
+
+	for (chunk = arena->chunk; chunk; chunk = next) {
+		next = chunk->next;
+		eee_mfree(chunk);
+	}
+
+	eee_mfree(arena);
+}
+
+void *
+arena_alloc(arena_t *arena, unsigned long size)
+{
+	arena_chunk_t *chunk;
+	void *buf;
+
+	if (!arena)
+		return eee_malloc(size);
+
+	size = align_up(size, ARENA_ALIGN);
+
+	chunk = arena->chunk;
+	if (!chunk || chunk->used + size > chunk->size) {
+		/*
+		 * The large allocation gets a dedicated chunk which is
+		 * queued behind the current one to keep filling the
+		 * latter.
+		 */
+		if (size > ARENA_CHUNK_SIZE / 4) {
+			chunk = new_chunk(size);
+			if (!chunk)
+				return NULL;
+
+			chunk->used = size;
+			if (arena->chunk) {
+				chunk->next = arena->chunk->next;
+				arena->chunk->next = chunk;
+			} else
+				arena->chunk = chunk;
+
+			return chunk->data;
+		}
+
+		chunk = new_chunk(ARENA_CHUNK_SIZE);
+		if (!chunk)
+			return NULL;
+
+		chunk->next = arena->chunk;
+		arena->chunk = chunk;
+	}
+
+	buf = chunk->data + chunk->used;
+	chunk->used += size;
+
+	return buf;
+}
+
+/*
+ * The memory allocated from an arena is not reused until the arena is
+ * destroyed.
+ */
+void
+arena_free(arena_t *arena, void *buf)
+{
+	if (!arena)
+		eee_mfree(buf);
+}
+
+void
+arena_add_cleanup(arena_t *arena, arena_cleanup_t *cleanup,
+		  void (*fn)(arena_cleanup_t *cleanup))
+{
+	cleanup->fn = fn;
+	bcll_add_tail(&arena->cleanup_list, &cleanup->link);
+}
+
+void
+arena_del_cleanup(arena_cleanup_t *cleanup)
+{
+	bcll_del_init(&cleanup->link);
+}
@@ -0,0 +1,49 @@
+/*
+ * Arena allocator API
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <eee.h>
+#include <err_status.h>
+#include "bcll.h"
+
+typedef struct __arena			arena_t;
+typedef struct __arena_cleanup		arena_cleanup_t;
+
+/*
+ * The cleanup is called at the time of destroying the arena for the
+ * resource not allocated from the arena but bound to its lifetime.
+ */
+struct __arena_cleanup {
+	bcll_t link;
+	void (*fn)(arena_cleanup_t *cleanup);
+};
+
+err_status_t
+arena_create(arena_t **out);
+
+void
+arena_destroy(arena_t *arena);
+
+void *
+arena_alloc(arena_t *arena, unsigned long size);
+
+void
+arena_free(arena_t *arena, void *buf);
+
+void
+arena_add_cleanup(arena_t *arena, arena_cleanup_t *cleanup,
+		  void (*fn)(arena_cleanup_t *cleanup));
+
+void
+arena_del_cleanup(arena_cleanup_t *cleanup);
+
+#endif	/* __ARENA_H__ */
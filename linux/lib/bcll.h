@@ -50,6 +50,12 @@ bcll_add_tail(bcll_t *head, bcll_t *entry)
 	__bcll_add(head->prev, entry);
 }
 
+static inline int
+bcll_empty(bcll_t *head)
+{
+	return head->next == head;
+}
+
 static inline void
 bcll_del(bcll_t *entry)
 {
@@ -0,0 +1,291 @@
+/*
+ * Block comparison
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <err_status.h>
+#include <cln_fw.h>
+#include "block_cmp.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLOCK_CMP_HAVE_SIMD
+#endif
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#define BLOCK_CMP_HAVE_NEON
+#endif
+
+static const block_cmp_kernel_t *block_cmp_kernel;
+
+static int
+block_equal_generic(const uint8_t *a, const uint8_t *b, unsigned long len)
+{
+	while (len >= sizeof(uint64_t) * 4) {
+		uint64_t x[4], y[4];
+
+		/*
+		 * The blocks are not necessarily aligned. __builtin_memcpy()
+		 * compiles to plain unaligned loads.
+		 */
+		__builtin_memcpy(x, a, sizeof(x));
+		__builtin_memcpy(y, b, sizeof(y));
+
+		if ((x[0] ^ y[0]) | (x[1] ^ y[1]) | (x[2] ^ y[2])
+				| (x[3] ^ y[3]))
+			return 0;
+
+		a += sizeof(uint64_t) * 4;
+		b += sizeof(uint64_t) * 4;
+		len -= sizeof(uint64_t) * 4;
+	}
+
+	return !__builtin_memcmp(a, b, len);
+}
+
+#ifdef BLOCK_CMP_HAVE_SIMD
+static int
+block_cmp_sse2_available(void)
+{
+	__builtin_cpu_init();
+
+	return __builtin_cpu_supports("sse2");
+}
+
+__attribute__ ((target("sse2")))
+static int
+block_equal_sse2(const uint8_t *a, const uint8_t *b, unsigned long len)
+{
+	while (len >= 64) {
+		__m128i x0, x1, x2, x3;
+
+		x0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a),
+				    _mm_loadu_si128((const __m128i *)b));
+		x1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a + 1),
+				    _mm_loadu_si128((const __m128i *)b + 1));
+		x2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a + 2),
+				    _mm_loadu_si128((const __m128i *)b + 2));
+		x3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a + 3),
+				    _mm_loadu_si128((const __m128i *)b + 3));
+		x0 = _mm_and_si128(_mm_and_si128(x0, x1),
+				   _mm_and_si128(x2, x3));
+		if (_mm_movemask_epi8(x0) != 0xffff)
+			return 0;
+
+		a += 64;
+		b += 64;
+		len -= 64;
+	}
+
+	return block_equal_generic(a, b, len);
+}
+
+static int
+block_cmp_avx2_available(void)
+{
+	__builtin_cpu_init();
+
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__ ((target("avx2")))
+static int
+block_equal_avx2(const uint8_t *a, const uint8_t *b, unsigned long len)
+{
+	while (len >= 128) {
+		__m256i x0, x1, x2, x3;
+
+		x0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)a),
+				       _mm256_loadu_si256((const __m256i *)b));
+		x1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)a + 1),
+				       _mm256_loadu_si256((const __m256i *)b + 1));
+		x2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)a + 2),
+				       _mm256_loadu_si256((const __m256i *)b + 2));
+		x3 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)a + 3),
+				       _mm256_loadu_si256((const __m256i *)b + 3));
+		x0 = _mm256_and_si256(_mm256_and_si256(x0, x1),
+				      _mm256_and_si256(x2, x3));
+		if ((unsigned int)_mm256_movemask_epi8(x0) != 0xffffffffU)
+			return 0;
+
+		a += 128;
+		b += 128;
+		len -= 128;
+	}
+
+	return block_equal_generic(a, b, len);
+}
+#endif
+
+#ifdef BLOCK_CMP_HAVE_NEON
+/* NEON is always present when the compiler targets it */
+static int
+block_equal_neon(const uint8_t *a, const uint8_t *b, unsigned long len)
+{
+	while (len >= 64) {
+		uint8x16_t x0, x1, x2, x3;
+
+		x0 = vceqq_u8(vld1q_u8(a), vld1q_u8(b));
+		x1 = vceqq_u8(vld1q_u8(a + 16), vld1q_u8(b + 16));
+		x2 = vceqq_u8(vld1q_u8(a + 32), vld1q_u8(b + 32));
+		x3 = vceqq_u8(vld1q_u8(a + 48), vld1q_u8(b + 48));
+		x0 = vandq_u8(vandq_u8(x0, x1), vandq_u8(x2, x3));
+#ifdef __aarch64__
+		if (vminvq_u8(x0) != 0xff)
+			return 0;
+#else
+		{
+			uint64x2_t x = vreinterpretq_u64_u8(x0);
+
+			if ((vgetq_lane_u64(x, 0) & vgetq_lane_u64(x, 1))
+					!= ~0ULL)
+				return 0;
+		}
+#endif
+
+		a += 64;
+		b += 64;
+		len -= 64;
+	}
+
+	return block_equal_generic(a, b, len);
+}
+#endif
+
+static const block_cmp_kernel_t block_cmp_kernels[] = {
+#ifdef BLOCK_CMP_HAVE_SIMD
+	{
+		.name = "avx2",
+		.available = block_cmp_avx2_available,
+		.equal = block_equal_avx2,
+	},
+	{
+		.name = "sse2",
+		.available = block_cmp_sse2_available,
+		.equal = block_equal_sse2,
+	},
+#endif
+#ifdef BLOCK_CMP_HAVE_NEON
+	{
+		.name = "neon",
+		.available = NULL,
+		.equal = block_equal_neon,
+	},
+#endif
+	{
+		.name = "generic",
+		.available = NULL,
+		.equal = block_equal_generic,
+	},
+};
+
+#define BLOCK_CMP_NR_KERNEL	\
+	(sizeof(block_cmp_kernels) / sizeof(block_cmp_kernels[0]))
+
+static int
+block_cmp_kernel_available(const block_cmp_kernel_t *kernel)
+{
+	return !kernel->available || kernel->available();
+}
+
+void
+block_cmp_setup(void)
+{
+	unsigned int i;
+
+	if (block_cmp_current_kernel())
+		return;
+
+	/* The kernels are sorted by preference */
+	for (i = 0; i < BLOCK_CMP_NR_KERNEL; ++i) {
+		if (block_cmp_kernel_available(block_cmp_kernels + i))
+			break;
+	}
+
+	__atomic_store_n(&block_cmp_kernel, block_cmp_kernels + i,
+			 __ATOMIC_RELEASE);
+}
+
+unsigned int
+block_cmp_nr_kernel(void)
+{
+	return BLOCK_CMP_NR_KERNEL;
+}
+
+const block_cmp_kernel_t *
+block_cmp_get_kernel(unsigned int index)
+{
+	if (index >= BLOCK_CMP_NR_KERNEL)
+		return NULL;
+
+	return block_cmp_kernels + index;
+}
+
+const block_cmp_kernel_t *
+block_cmp_current_kernel(void)
+{
+	return __atomic_load_n(&block_cmp_kernel, __ATOMIC_ACQUIRE);
+}
+
+err_status_t
+block_cmp_select_kernel(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < BLOCK_CMP_NR_KERNEL; ++i) {
+		if (eee_strcmp(block_cmp_kernels[i].name, name))
+			continue;
+
+		if (!block_cmp_kernel_available(block_cmp_kernels + i))
+			return CLN_FW_ERR_INVALID_PARAMETER;
+
+		__atomic_store_n(&block_cmp_kernel, block_cmp_kernels + i,
+				 __ATOMIC_RELEASE);
+
+		return CLN_FW_ERR_NONE;
+	}
+
+	return CLN_FW_ERR_INVALID_PARAMETER;
+}
+
+int
+block_equal(const void *a, const void *b, unsigned long len)
+{
+	const block_cmp_kernel_t *kernel = block_cmp_current_kernel();
+
+	if (!kernel)
+		return block_equal_generic(a, b, len);
+
+	return kernel->equal(a, b, len);
+}
+
+/*
+ * Compare two buffers block by block. The changed map gets one byte
+ * per block, which is non-zero if the block differs. The last block
+ * may be partial. Return the number of changed blocks.
+ */
+unsigned long
+block_cmp_changed(const void *a, const void *b, unsigned long len,
+		  unsigned long block_size, uint8_t *changed)
+{
+	unsigned long off, nr_changed;
+
+	for (off = 0, nr_changed = 0; off < len; off += block_size) {
+		unsigned long size = len - off;
+
+		if (size > block_size)
+			size = block_size;
+
+		*changed = !block_equal(a + off, b + off, size);
+		nr_changed += *changed++;
+	}
+
+	return nr_changed;
+}
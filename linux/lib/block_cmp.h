@@ -0,0 +1,47 @@
+/*
+ * Block comparison API
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#ifndef __BLOCK_CMP_H__
+#define __BLOCK_CMP_H__
+
+#include <eee.h>
+#include <err_status.h>
+
+typedef struct {
+	const char *name;
+	/* NULL if the kernel is always available */
+	int (*available)(void);
+	/* Return non-zero if the blocks are identical */
+	int (*equal)(const uint8_t *a, const uint8_t *b, unsigned long len);
+} block_cmp_kernel_t;
+
+int
+block_equal(const void *a, const void *b, unsigned long len);
+
+unsigned long
+block_cmp_changed(const void *a, const void *b, unsigned long len,
+		  unsigned long block_size, uint8_t *changed);
+
+void
+block_cmp_setup(void);
+
+unsigned int
+block_cmp_nr_kernel(void);
+
+const block_cmp_kernel_t *
+block_cmp_get_kernel(unsigned int index);
+
+const block_cmp_kernel_t *
+block_cmp_current_kernel(void);
+
+err_status_t
+block_cmp_select_kernel(const char *name);
+
+#endif	/* __BLOCK_CMP_H__ */
@@ -10,6 +10,7 @@
 
 #include <eee.h>
 #include <err_status.h>
+#include <cln_fw.h>
 #include "buffer_stream.h"
 
 static long
@@ -27,6 +28,43 @@ bs_init(buffer_stream_t *bs, void *buf, unsigned long buf_len)
 	bs->buf = buf;
 	bs->buf_len = buf_len;
 	bs->current = 0;
+	bs->source = NULL;
+}
+
+void
+bs_init_source(buffer_stream_t *bs, bs_source_t *src)
+{
+	bs_init(bs, src->buf, src->buf_len);
+	bs->source = src;
+}
+
+static err_status_t
+__bs_fetch(buffer_stream_t *bs, unsigned long len, long offset)
+{
+	if (!bs->source || !len)
+		return BYTE_STREAM_ERR_NONE;
+
+	if (is_err_status(bs->source->fetch(bs->source, offset, len)))
+		return BYTE_STREAM_ERR_IO;
+
+	return BYTE_STREAM_ERR_NONE;
+}
+
+/* Make sure the extent is accessible through bs_head() */
+err_status_t
+bs_fetch_at(buffer_stream_t *bs, unsigned long len, long offset)
+{
+	offset = bs_abs_offset(bs, offset);
+	if (offset < 0 || offset + len > bs->buf_len)
+		return BYTE_STREAM_ERR_OUT_OF_RANGE;
+
+	return __bs_fetch(bs, len, offset);
+}
+
+err_status_t
+bs_fetch_all(buffer_stream_t *bs)
+{
+	return __bs_fetch(bs, bs->buf_len, 0);
 }
 
 unsigned long
@@ -123,8 +161,15 @@ __bs_get_at(buffer_stream_t *bs, void **in, unsigned long in_len,
 	if (offset < 0 || offset + in_len > bs->buf_len)
 		return BYTE_STREAM_ERR_OUT_OF_RANGE;
 
-	if (in)
+	if (in) {
+		err_status_t err;
+
+		err = __bs_fetch(bs, in_len, offset);
+		if (is_err_status(err))
+			return err;
+
 		*in = bs->buf + offset;
+	}
 
 	bs->current = offset;
 
@@ -15,6 +15,21 @@
 
 struct __buffer_stream;
 
+typedef struct __bs_source			bs_source_t;
+
+/*
+ * The backend supplying the buffer on demand. The buffer is laid out
+ * contiguously but only the extents fetched are accessible.
+ */
+struct __bs_source {
+	/* Make the extent at the offset of buffer accessible */
+	err_status_t (*fetch)(bs_source_t *src, unsigned long offset,
+			      unsigned long len);
+	void (*release)(bs_source_t *src);
+	void *buf;
+	unsigned long buf_len;
+};
+
 struct __buffer_stream {
 	void *buf;
 	unsigned long buf_len;
@@ -24,6 +39,7 @@ struct __buffer_stream {
 	void *out;
 	unsigned long out_len;
 	struct __buffer_stream *parent;
+	bs_source_t *source;
 };
 
 typedef struct __buffer_stream			buffer_stream_t;
@@ -38,6 +54,7 @@ typedef struct __buffer_stream			buffer_stream_t;
 #define BYTE_STREAM_ERR_INVALID_PARAMETER	BYTE_STREAM_ERR(1)
 #define BYTE_STREAM_ERR_OUT_OF_RANGE		BYTE_STREAM_ERR(2)
 #define BYTE_STREAM_ERR_OUT_OF_MEM		BYTE_STREAM_ERR(3)
+#define BYTE_STREAM_ERR_IO			BYTE_STREAM_ERR(4)
 
 err_status_t
 bs_alloc(buffer_stream_t **bs);
@@ -45,6 +62,15 @@ bs_alloc(buffer_stream_t **bs);
 void
 bs_init(buffer_stream_t *bs, void *buf, unsigned long buf_len);
 
+void
+bs_init_source(buffer_stream_t *bs, bs_source_t *src);
+
+err_status_t
+bs_fetch_at(buffer_stream_t *bs, unsigned long len, long offset);
+
+err_status_t
+bs_fetch_all(buffer_stream_t *bs);
+
 unsigned long
 bs_tell(buffer_stream_t *bs);
 
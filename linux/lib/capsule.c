@@ -11,21 +11,26 @@
 #include <err_status.h>
 #include <eee.h>
 #include <cln_fw.h>
+#include "internal.h"
 #include "capsule.h"
 
-err_status_t
-capsule_create_header(unsigned long payload_len, void **out,
-		      unsigned long *out_len)
+unsigned long
+capsule_header_size(void)
 {
-	capsule_header_t *cap_header;
-	unsigned long update_entry_len;
+	return sizeof(capsule_header_t);
+}
 
-	if (!payload_len)
-		return CLN_FW_ERR_INVALID_PARAMETER;
+unsigned long
+capsule_update_entry_size(void)
+{
+	return sizeof(capsule_update_entry_t) * CAPSULE_MAX_UPDATE_ENTRIES;
+}
 
-	cap_header = eee_malloc(sizeof(*cap_header));
-	if (!cap_header)
-		return CLN_FW_ERR_OUT_OF_MEM;
+void
+capsule_init_header(void *cap_header_buf, unsigned long payload_len)
+{
+	capsule_header_t *cap_header = cap_header_buf;
+	unsigned long update_entry_len;
 
 	eee_memcpy((void *)cap_header->guid, CAPSULE_GUID,
 		   sizeof(cap_header->guid));
@@ -37,6 +42,22 @@ capsule_create_header(unsigned long payload_len, void **out,
 	cap_header->image_size = sizeof(*cap_header) + update_entry_len
 				 + payload_len;
 	eee_memset(cap_header->reserved, 0xff, sizeof(cap_header->reserved));
+}
+
+err_status_t
+capsule_create_header(unsigned long payload_len, void **out,
+		      unsigned long *out_len)
+{
+	capsule_header_t *cap_header;
+
+	if (!payload_len)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	cap_header = eee_malloc(sizeof(*cap_header));
+	if (!cap_header)
+		return CLN_FW_ERR_OUT_OF_MEM;
+
+	capsule_init_header(cap_header, payload_len);
 
 	if (out)
 		*out = cap_header;
@@ -47,6 +68,49 @@ capsule_create_header(unsigned long payload_len, void **out,
 	return CLN_FW_ERR_NONE;
 }
 
+/*
+ * Fill the update entry table with the extents which are relative to
+ * the flash address addr. The payloads of extents are laid out in
+ * order right after the update entry table.
+ */
+void
+capsule_init_update_entries(void *update_entry_buf, uint32_t addr,
+			    const capsule_extent_t *extents,
+			    unsigned int nr_extent)
+{
+	capsule_update_entry_t *update_entry = update_entry_buf;
+	unsigned long update_entry_len = capsule_update_entry_size();
+	uint32_t offset;
+	unsigned int i;
+
+	offset = sizeof(capsule_header_t) + update_entry_len;
+	for (i = 0; i < nr_extent; ++i, ++update_entry) {
+		update_entry->addr = addr + extents[i].offset;
+		update_entry->size = (extents[i].size + (BLOCK_SIZE - 1))
+				     & ~(BLOCK_SIZE - 1);
+		update_entry->offset = offset;
+		update_entry->reserved = 0xffffffff;
+		offset += update_entry->size;
+	}
+
+	/* NULL update entry terminated */
+	eee_memset(update_entry, 0, sizeof(*update_entry));
+	eee_memset(update_entry + 1, 0xff, update_entry_len
+		   - sizeof(*update_entry) * (nr_extent + 1));
+}
+
+void
+capsule_init_update_entry(void *update_entry_buf, uint32_t addr,
+			  uint32_t payload_len)
+{
+	capsule_extent_t extent = {
+		.offset = 0,
+		.size = payload_len,
+	};
+
+	capsule_init_update_entries(update_entry_buf, addr, &extent, 1);
+}
+
 err_status_t
 capsule_create_update_entry(uint32_t addr, uint32_t payload_len,
 			    void **out, unsigned long *out_len)
@@ -54,21 +118,12 @@ capsule_create_update_entry(uint32_t addr, uint32_t payload_len,
 	capsule_update_entry_t *update_entry;
 	unsigned long update_entry_len;
 
-	update_entry_len = sizeof(*update_entry) * CAPSULE_MAX_UPDATE_ENTRIES;
+	update_entry_len = capsule_update_entry_size();
 	update_entry = eee_malloc(update_entry_len);
 	if (!update_entry)
 		return CLN_FW_ERR_OUT_OF_MEM;
 
-	update_entry->addr = addr;
-	update_entry->size = (payload_len + (BLOCK_SIZE - 1))
-			     & ~(BLOCK_SIZE - 1);
-	update_entry->offset = sizeof(capsule_header_t) + update_entry_len;
-	update_entry->reserved = 0xffffffff;
-
-	/* NULL update entry terminated */
-	eee_memset(update_entry + 1, 0, sizeof(*update_entry));
-	eee_memset(update_entry + 2, 0xff,
-		   update_entry_len - sizeof(*update_entry) * 2);
+	capsule_init_update_entry(update_entry, addr, payload_len);
 
 	if (out)
 		*out = update_entry;
@@ -11,6 +11,7 @@
 #include <eee.h>
 #include <err_status.h>
 #include <cln_fw.h>
+#include <pthread.h>
 #include "internal.h"
 #include "bcll.h"
 #include "class.h"
@@ -18,6 +19,10 @@
 typedef struct __class_meta			class_meta_t;
 typedef struct __object_meta			object_meta_t;
 
+#define CLASS_HASH_SIZE				32
+/* The maximum number of recycled objects kept per class */
+#define CLASS_POOL_SIZE				8
+
 struct __class_meta {
 	class_ctor_t obj_ctor;
 	class_dtor_t obj_dtor;
@@ -26,6 +31,15 @@ struct __class_meta {
 	class_meta_t *children;
 	class_meta_t *sibling;
 	bcll_t class_hierarchy;
+	/* The next class in the same hash bucket */
+	class_meta_t *hash_next;
+	/* The free list of recycled objects */
+	pthread_mutex_t pool_lock;
+	object_meta_t *pool;
+	unsigned int nr_pool;
+	/* The objects instantiated from and out of the pool */
+	uint64_t nr_hit;
+	uint64_t nr_miss;
 	/* Class name must be always at the end */
 	char *name;
 };
@@ -33,6 +47,11 @@ struct __class_meta {
 struct __object_meta {
 	class_meta_t *class_meta;
 	unsigned long ref_count;
+	/* The arena whose lifetime the object is bound to */
+	arena_t *arena;
+	arena_cleanup_t cleanup;
+	/* The next recycled object in the free list */
+	object_meta_t *pool_next;
 };
 
 static struct {
@@ -46,6 +65,12 @@ static struct {
 };
 
 static class_meta_t *base_class = &root_obj.class_meta;
+static class_meta_t *class_hash[CLASS_HASH_SIZE];
+/*
+ * The registry is read without lock once frozen so registration must
+ * be done before any handle is created.
+ */
+static int class_frozen;
 
 unsigned long
 obj_ref(void *ptr)
@@ -53,7 +78,62 @@ obj_ref(void *ptr)
 	object_meta_t *o;
 
 	o = (object_meta_t *)(ptr - sizeof(*o));
-	return ++o->ref_count;
+	return __atomic_add_fetch(&o->ref_count, 1, __ATOMIC_RELAXED);
+}
+
+static object_meta_t *
+alloc_object(class_meta_t *c)
+{
+	object_meta_t *o;
+
+	pthread_mutex_lock(&c->pool_lock);
+	o = c->pool;
+	if (o) {
+		c->pool = o->pool_next;
+		--c->nr_pool;
+		++c->nr_hit;
+	} else
+		++c->nr_miss;
+	pthread_mutex_unlock(&c->pool_lock);
+
+	if (!o)
+		o = eee_malloc(sizeof(*o) + c->obj_size);
+
+	return o;
+}
+
+static void
+free_object(object_meta_t *o)
+{
+	class_meta_t *c = o->class_meta;
+
+	pthread_mutex_lock(&c->pool_lock);
+	if (c->nr_pool < CLASS_POOL_SIZE) {
+		o->pool_next = c->pool;
+		c->pool = o;
+		++c->nr_pool;
+		o = NULL;
+	}
+	pthread_mutex_unlock(&c->pool_lock);
+
+	if (o)
+		eee_mfree(o);
+}
+
+static void
+finalize_object(object_meta_t *o)
+{
+	if (o->class_meta->obj_dtor)
+		o->class_meta->obj_dtor(o + 1);
+
+	free_object(o);
+}
+
+/* Called for the object still alive when its arena is destroyed */
+static void
+cleanup_object(arena_cleanup_t *cleanup)
+{
+	finalize_object(container_of(cleanup, object_meta_t, cleanup));
 }
 
 unsigned long
@@ -63,22 +143,45 @@ obj_unref(void *ptr)
 	unsigned long ref_count;
 
 	o = (object_meta_t *)(ptr - sizeof(*o));
-	ref_count = --o->ref_count;
+	ref_count = __atomic_sub_fetch(&o->ref_count, 1, __ATOMIC_ACQ_REL);
 	if (!ref_count) {
-		if (o->class_meta->obj_dtor)
-			o->class_meta->obj_dtor(ptr);
-		eee_mfree(o);
+		if (o->arena)
+			arena_del_cleanup(&o->cleanup);
+		finalize_object(o);
 	}
 
 	return ref_count;
 }
 
+arena_t *
+obj_arena(void *ptr)
+{
+	object_meta_t *o;
+
+	o = (object_meta_t *)(ptr - sizeof(*o));
+	return o->arena;
+}
+
+/* FNV-1a */
+static unsigned int
+hash_class_name(const char *name)
+{
+	uint32_t hash = 2166136261U;
+
+	while (*name) {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619U;
+	}
+
+	return hash % CLASS_HASH_SIZE;
+}
+
 static class_meta_t *
-search_class_hierarchy(const char *name)
+search_class(const char *name)
 {
 	class_meta_t *p;
 
-	bcll_for_each_link(p, &base_class->class_hierarchy, class_hierarchy) {
+	for (p = class_hash[hash_class_name(name)]; p; p = p->hash_next) {
 		if (!eee_strcmp(p->name, name))
 			return p;
 	}
@@ -87,22 +190,22 @@ search_class_hierarchy(const char *name)
 }
 
 err_status_t
-class_instantiate(const char *name, void **obj)
+class_instantiate_handle(arena_t *arena, class_handle_t handle, void **obj)
 {
-	class_meta_t *c;
+	class_meta_t *c = (class_meta_t *)handle;
 	object_meta_t *o;
 	err_status_t err;
 
-	c = search_class_hierarchy(name);
 	if (!c)
 		return CLASS_ERR_NOT_FOUND;
 
-	o = eee_malloc(sizeof(*o) + c->obj_size);
+	o = alloc_object(c);
 	if (!o)
 		return CLN_FW_ERR_OUT_OF_MEM;
 
 	o->class_meta = c;
 	o->ref_count = 1;
+	o->arena = arena;
 	*obj = o + 1;
 
 	if (c->obj_ctor)
@@ -111,13 +214,20 @@ class_instantiate(const char *name, void **obj)
 		err = CLN_FW_ERR_NONE;
 
 	if (is_err_status(err)) {
-		eee_mfree(o);
+		free_object(o);
 		*obj = NULL;
-	}
+	} else if (arena)
+		arena_add_cleanup(arena, &o->cleanup, cleanup_object);
 
 	return err;
 }
 
+err_status_t
+class_instantiate(arena_t *arena, const char *name, void **obj)
+{
+	return class_instantiate_handle(arena, search_class(name), obj);
+}
+
 static void
 set_class_hierarchy(class_meta_t *c, class_meta_t *parent)
 {
@@ -129,10 +239,19 @@ set_class_hierarchy(class_meta_t *c, class_meta_t *parent)
 	bcll_add_tail(&base_class->class_hierarchy, &c->class_hierarchy);
 }
 
+static void
+hash_class(class_meta_t *c)
+{
+	unsigned int bucket = hash_class_name(c->name);
+
+	c->hash_next = class_hash[bucket];
+	class_hash[bucket] = c;
+}
+
 err_status_t
 class_register(const char *name, const char *parent,
 	       const class_ctor_t obj_ctor, const class_dtor_t obj_dtor,
-	       unsigned int obj_size)
+	       unsigned int obj_size, class_handle_t *handle)
 {
 	class_meta_t *c, *p;
 	int nlen;
@@ -140,11 +259,14 @@ class_register(const char *name, const char *parent,
 	if (!name)
 		return CLN_FW_ERR_INVALID_PARAMETER;
 
+	if (__atomic_load_n(&class_frozen, __ATOMIC_ACQUIRE))
+		return CLASS_ERR_FROZEN;
+
 	nlen = eee_strlen(name);
 	if (!nlen)
 		return CLN_FW_ERR_INVALID_PARAMETER;
 
-	c = search_class_hierarchy(name);
+	c = search_class(name);
 	if (c)
 		return CLASS_ERR_REGISTERED;
 
@@ -152,7 +274,7 @@ class_register(const char *name, const char *parent,
 		if (!eee_strlen(parent))
 			return CLN_FW_ERR_INVALID_PARAMETER;
 
-		p = search_class_hierarchy(parent);
+		p = search_class(parent);
 		if (!p)
 			return CLASS_ERR_NOT_FOUND;
 	} else
@@ -167,11 +289,69 @@ class_register(const char *name, const char *parent,
 	c->obj_ctor = obj_ctor;
 	c->obj_dtor = obj_dtor;
 	c->obj_size = obj_size;
+	pthread_mutex_init(&c->pool_lock, NULL);
+	c->pool = NULL;
+	c->nr_pool = 0;
+	c->nr_hit = 0;
+	c->nr_miss = 0;
 	set_class_hierarchy(c, p);
+	hash_class(c);
+
+	if (handle)
+		*handle = c;
 
 	return CLN_FW_ERR_NONE;
 }
 
+/* Disallow the registration from now on */
+void
+class_freeze(void)
+{
+	__atomic_store_n(&class_frozen, 1, __ATOMIC_RELEASE);
+}
+
+/* Release all recycled objects */
+void
+class_drain_pool(void)
+{
+	class_meta_t *c;
+
+	bcll_for_each_link(c, &base_class->class_hierarchy, class_hierarchy) {
+		object_meta_t *o;
+
+		pthread_mutex_lock(&c->pool_lock);
+		while ((o = c->pool)) {
+			c->pool = o->pool_next;
+			eee_mfree(o);
+		}
+		c->nr_pool = 0;
+		pthread_mutex_unlock(&c->pool_lock);
+	}
+}
+
+/*
+ * Report the pool hits and misses of a class, or the sum of all classes
+ * if handle is NULL.
+ */
+void
+class_pool_stats(class_handle_t handle, uint64_t *nr_hit, uint64_t *nr_miss)
+{
+	class_meta_t *c;
+
+	*nr_hit = 0;
+	*nr_miss = 0;
+
+	bcll_for_each_link(c, &base_class->class_hierarchy, class_hierarchy) {
+		if (handle && c != handle)
+			continue;
+
+		pthread_mutex_lock(&c->pool_lock);
+		*nr_hit += c->nr_hit;
+		*nr_miss += c->nr_miss;
+		pthread_mutex_unlock(&c->pool_lock);
+	}
+}
+
 err_status_t
 class_unregister(const char *name)
 {
@@ -24,24 +24,47 @@
 #define CLASS_ERR_NONE				CLASS_ERR(0)
 #define CLASS_ERR_NOT_FOUND			CLASS_ERR(1)
 #define CLASS_ERR_REGISTERED			CLASS_ERR(2)
+#define CLASS_ERR_FROZEN			CLASS_ERR(3)
 
 typedef err_status_t (*class_ctor_t)(void *);
 typedef void (*class_dtor_t)(void *);
 
+/* The stable handle of a registered class */
+typedef const struct __class_meta *	class_handle_t;
+
 err_status_t
 class_register(const char *name, const char *parent,
 	       const class_ctor_t obj_ctor, const class_dtor_t obj_dtor,
-	       unsigned int obj_size);
+	       unsigned int obj_size, class_handle_t *handle);
+err_status_t
+class_instantiate(arena_t *arena, const char *name, void **obj);
 err_status_t
-class_instantiate(const char *name, void **obj);
+class_instantiate_handle(arena_t *arena, class_handle_t handle, void **obj);
+void
+class_drain_pool(void);
+void
+class_pool_stats(class_handle_t handle, uint64_t *nr_hit, uint64_t *nr_miss);
+void
+class_freeze(void);
 unsigned long
 obj_unref(void *ptr);
 unsigned long
 obj_ref(void *ptr);
+arena_t *
+obj_arena(void *ptr);
+
+#define obj_new(type, pptr)	obj_new_in(NULL, type, pptr)
+
+/* Instantiate the class by the handle without the name lookup */
+#define obj_new_from(arena, handle, pptr)	({	\
+	err_status_t __err;	\
+	__err = class_instantiate_handle(arena, handle, (void **)pptr); \
+	__err; })
 
-#define obj_new(type, pptr)	({	\
+/* The object still alive is released along with the arena if specified */
+#define obj_new_in(arena, type, pptr)	({	\
 	err_status_t __err;	\
-	__err = class_instantiate(type, (void **)pptr); \
+	__err = class_instantiate(arena, type, (void **)pptr); \
 	__err; })
 
 #define obj_destroy(pptr)	\
@@ -9,6 +9,15 @@
  */
 
 #include <eee.h>
+#include <err_status.h>
+#include <cln_fw.h>
+#include "crc32.h"
+#include "stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC32_HAVE_PCLMUL
+#endif
 
 static const uint32_t crc32tab[] = {
 	0x00000000L, 0x77073096L, 0xee0e612cL, 0x990951baL,
@@ -77,13 +86,362 @@ static const uint32_t crc32tab[] = {
 	0xb40bbe37L, 0xc30c8ea1L, 0x5a05df1bL, 0x2d02ef8dL
 };
 
+/*
+ * Lookup tables for slicing-by-N. crc32_slice_tab[0] is identical to
+ * crc32tab and the table k gives the CRC of a byte followed by k zero
+ * bytes. They are generated once by crc32_setup().
+ */
+static uint32_t crc32_slice_tab[16][256];
+static const crc32_kernel_t *crc32_kernel;
+
+static uint32_t
+crc32_update_bytewise(uint32_t crc, const uint8_t *buf, unsigned long len)
+{
+	while (len--)
+		crc = crc32tab[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+static int
+crc32_slice_available(void)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Load a word in host byte order. The slicing kernels are only selected
+ * on little-endian hosts. __builtin_memcpy() lets the compiler emit a
+ * single unaligned load instead of calling out.
+ */
+static inline uint32_t
+load_u32(const uint8_t *p)
+{
+	uint32_t v;
+
+	__builtin_memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+static uint32_t
+crc32_update_slice8(uint32_t crc, const uint8_t *buf, unsigned long len)
+{
+	const uint32_t (*t)[256] = crc32_slice_tab;
+
+	while (len >= 8) {
+		uint32_t one = load_u32(buf) ^ crc;
+		uint32_t two = load_u32(buf + 4);
+
+		crc = t[7][one & 0xff] ^ t[6][(one >> 8) & 0xff] ^
+		      t[5][(one >> 16) & 0xff] ^ t[4][one >> 24] ^
+		      t[3][two & 0xff] ^ t[2][(two >> 8) & 0xff] ^
+		      t[1][(two >> 16) & 0xff] ^ t[0][two >> 24];
+
+		buf += 8;
+		len -= 8;
+	}
+
+	return crc32_update_bytewise(crc, buf, len);
+}
+
+static uint32_t
+crc32_update_slice16(uint32_t crc, const uint8_t *buf, unsigned long len)
+{
+	const uint32_t (*t)[256] = crc32_slice_tab;
+
+	while (len >= 16) {
+		uint32_t one = load_u32(buf) ^ crc;
+		uint32_t two = load_u32(buf + 4);
+		uint32_t three = load_u32(buf + 8);
+		uint32_t four = load_u32(buf + 12);
+
+		crc = t[15][one & 0xff] ^ t[14][(one >> 8) & 0xff] ^
+		      t[13][(one >> 16) & 0xff] ^ t[12][one >> 24] ^
+		      t[11][two & 0xff] ^ t[10][(two >> 8) & 0xff] ^
+		      t[9][(two >> 16) & 0xff] ^ t[8][two >> 24] ^
+		      t[7][three & 0xff] ^ t[6][(three >> 8) & 0xff] ^
+		      t[5][(three >> 16) & 0xff] ^ t[4][three >> 24] ^
+		      t[3][four & 0xff] ^ t[2][(four >> 8) & 0xff] ^
+		      t[1][(four >> 16) & 0xff] ^ t[0][four >> 24];
+
+		buf += 16;
+		len -= 16;
+	}
+
+	return crc32_update_bytewise(crc, buf, len);
+}
+
+#ifdef CRC32_HAVE_PCLMUL
+static int
+crc32_pclmul_available(void)
+{
+	__builtin_cpu_init();
+
+	return __builtin_cpu_supports("pclmul")
+	       && __builtin_cpu_supports("sse4.1");
+}
+
+/*
+ * Fold the buffer with carry-less multiplication as described in
+ * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction" from Intel. The constants are given for the bit-reflected
+ * CRC32 polynomial 0x104c11db7. The length must be a multiple of 16 and
+ * no less than 64.
+ */
+__attribute__ ((target("pclmul,sse4.1")))
+static uint32_t
+crc32_fold_pclmul(uint32_t crc, const uint8_t *buf, unsigned long len)
+{
+	static const uint64_t k1k2[] __attribute__ ((aligned(16))) = {
+		0x0154442bd4ULL, 0x01c6e41596ULL
+	};
+	static const uint64_t k3k4[] __attribute__ ((aligned(16))) = {
+		0x01751997d0ULL, 0x00ccaa009eULL
+	};
+	static const uint64_t k5k0[] __attribute__ ((aligned(16))) = {
+		0x0163cd6124ULL, 0x0000000000ULL
+	};
+	static const uint64_t poly[] __attribute__ ((aligned(16))) = {
+		0x01db710641ULL, 0x01f7011641ULL
+	};
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+
+	buf += 64;
+	len -= 64;
+
+	/* Fold by 4 */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		buf += 64;
+		len -= 64;
+	}
+
+	/* Fold 4 lanes into one */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* Fold by 1 */
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)buf);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		buf += 16;
+		len -= 16;
+	}
+
+	/* Fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *)poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t
+crc32_update_pclmul(uint32_t crc, const uint8_t *buf, unsigned long len)
+{
+	if (len >= 64) {
+		unsigned long chunk = len & ~15UL;
+
+		crc = crc32_fold_pclmul(crc, buf, chunk);
+		buf += chunk;
+		len -= chunk;
+	}
+
+	return crc32_update_slice16(crc, buf, len);
+}
+#endif
+
+static const crc32_kernel_t crc32_kernels[] = {
+#ifdef CRC32_HAVE_PCLMUL
+	{
+		.name = "pclmul",
+		.available = crc32_pclmul_available,
+		.update = crc32_update_pclmul,
+	},
+#endif
+	{
+		.name = "slice16",
+		.available = crc32_slice_available,
+		.update = crc32_update_slice16,
+	},
+	{
+		.name = "slice8",
+		.available = crc32_slice_available,
+		.update = crc32_update_slice8,
+	},
+	{
+		.name = "bytewise",
+		.available = NULL,
+		.update = crc32_update_bytewise,
+	},
+};
+
+#define CRC32_NR_KERNEL	(sizeof(crc32_kernels) / sizeof(crc32_kernels[0]))
+
+static int
+crc32_kernel_available(const crc32_kernel_t *kernel)
+{
+	return !kernel->available || kernel->available();
+}
+
+void
+crc32_setup(void)
+{
+	unsigned int i, k;
+
+	if (crc32_current_kernel())
+		return;
+
+	for (i = 0; i < 256; ++i)
+		crc32_slice_tab[0][i] = crc32tab[i];
+
+	for (k = 1; k < 16; ++k) {
+		for (i = 0; i < 256; ++i) {
+			uint32_t crc = crc32_slice_tab[k - 1][i];
+
+			crc32_slice_tab[k][i] = crc32tab[crc & 0xff]
+						^ (crc >> 8);
+		}
+	}
+
+	/* The kernels are sorted by preference */
+	for (i = 0; i < CRC32_NR_KERNEL; ++i) {
+		if (crc32_kernel_available(crc32_kernels + i))
+			break;
+	}
+
+	/* Publish the kernel only after the tables are ready */
+	__atomic_store_n(&crc32_kernel, crc32_kernels + i, __ATOMIC_RELEASE);
+}
+
+unsigned int
+crc32_nr_kernel(void)
+{
+	return CRC32_NR_KERNEL;
+}
+
+const crc32_kernel_t *
+crc32_get_kernel(unsigned int index)
+{
+	if (index >= CRC32_NR_KERNEL)
+		return NULL;
+
+	return crc32_kernels + index;
+}
+
+const crc32_kernel_t *
+crc32_current_kernel(void)
+{
+	return __atomic_load_n(&crc32_kernel, __ATOMIC_ACQUIRE);
+}
+
+err_status_t
+crc32_select_kernel(const char *name)
+{
+	unsigned int i;
+
+	crc32_setup();
+
+	for (i = 0; i < CRC32_NR_KERNEL; ++i) {
+		if (eee_strcmp(crc32_kernels[i].name, name))
+			continue;
+
+		if (!crc32_kernel_available(crc32_kernels + i))
+			return CLN_FW_ERR_INVALID_PARAMETER;
+
+		__atomic_store_n(&crc32_kernel, crc32_kernels + i,
+				 __ATOMIC_RELEASE);
+
+		return CLN_FW_ERR_NONE;
+	}
+
+	return CLN_FW_ERR_INVALID_PARAMETER;
+}
+
+crc32_state_t
+crc32_update(crc32_state_t state, const void *buf, unsigned long len)
+{
+	const crc32_kernel_t *kernel = crc32_current_kernel();
+
+	/* Fall back to the table-driven loop until crc32_setup() is done */
+	if (!kernel)
+		return crc32_update_bytewise(state, buf, len);
+
+	return kernel->update(state, buf, len);
+}
+
 uint32_t
 crc32(uint8_t *buf, uint32_t size)
 {
-	uint32_t i, crc;
+	uint64_t start = stats_timer_start();
+	uint32_t crc;
+
+	crc = crc32_final(crc32_update(crc32_begin(), buf, size));
+	stats_timer_stop(CLN_FW_STAT_CRC32, start);
 
-	crc = 0xffffffff;
-	for (i = 0; i < size; i++)
-		crc = crc32tab[((int)crc ^ buf[i]) & 0xff] ^ (crc >> 8);
-	return crc ^ 0xffffffff;
-}
\ No newline at end of file
+	return crc;
+}
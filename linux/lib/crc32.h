@@ -0,0 +1,60 @@
+/*
+ * CRC32 API
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#ifndef __CRC32_H__
+#define __CRC32_H__
+
+#include <eee.h>
+#include <err_status.h>
+
+typedef uint32_t			crc32_state_t;
+
+typedef struct {
+	const char *name;
+	/* NULL if the kernel is always available */
+	int (*available)(void);
+	uint32_t (*update)(uint32_t crc, const uint8_t *buf,
+			   unsigned long len);
+} crc32_kernel_t;
+
+static inline crc32_state_t
+crc32_begin(void)
+{
+	return 0xffffffff;
+}
+
+static inline uint32_t
+crc32_final(crc32_state_t state)
+{
+	return state ^ 0xffffffff;
+}
+
+crc32_state_t
+crc32_update(crc32_state_t state, const void *buf, unsigned long len);
+
+uint32_t
+crc32(uint8_t *buf, uint32_t size);
+
+void
+crc32_setup(void);
+
+unsigned int
+crc32_nr_kernel(void);
+
+const crc32_kernel_t *
+crc32_get_kernel(unsigned int index);
+
+const crc32_kernel_t *
+crc32_current_kernel(void);
+
+err_status_t
+crc32_select_kernel(const char *name);
+
+#endif	/* __CRC32_H__ */
@@ -15,6 +15,7 @@
 #include "bcll.h"
 #include "class.h"
 #include "csbh.h"
+#include "stats.h"
 
 #pragma pack(1)
 
@@ -111,6 +112,42 @@ csbh_header_size(void)
 	       + sizeof(csbh_rsa_signature_t);
 }
 
+/*
+ * Fill the header and the sizes of public key for a module carrying the
+ * body. The modulus, signature and body are left to the caller.
+ */
+err_status_t
+csbh_create(void *csbh_buf, unsigned long csbh_buf_len,
+	    unsigned long body_size, void **body)
+{
+	csbh_header_t *header = csbh_buf;
+	csbh_rsa_pubkey_t *pubkey = (csbh_rsa_pubkey_t *)(header + 1);
+	unsigned long header_size = csbh_header_size();
+
+	if (csbh_buf_len < header_size + body_size)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	eee_memset(header, 0, sizeof(*header));
+	header->Identifier = CSBH_IDENTIFIER;
+	header->Version = CSBH_VERSION;
+	header->ModuleSize = header_size + body_size;
+	header->ReservedModuleVendor = CSBH_MODULE_VENDOR;
+	header->ModuleHeaderSize = header_size;
+	header->HashAlgorithm = CSBH_HASH_ALGO_SHA256;
+	header->CryptoAlgorithm = CSBH_CRYPTO_ALGO_RSA2048;
+	header->KeySize = sizeof(csbh_rsa_pubkey_t);
+	header->SignatureSize = sizeof(csbh_rsa_signature_t);
+
+	pubkey->ModulusSize = sizeof(pubkey->Modulus);
+	pubkey->ExponentSize = sizeof(pubkey->Exponent);
+	pubkey->Exponent = 65537;
+
+	if (body)
+		*body = csbh_buf + header_size;
+
+	return CLN_FW_ERR_NONE;
+}
+
 static csbh_key_type_t
 get_pubkey_type(csbh_context_t *csbh)
 {
@@ -129,6 +166,76 @@ get_pubkey_type(csbh_context_t *csbh)
 	return CSBH_KEY_TYPE_X102x;
 }
 
+enum {
+	CSBH_FIELD_HEADER,
+	CSBH_FIELD_PUBKEY,
+	CSBH_FIELD_SIGNATURE,
+	CSBH_FIELD_PAD,
+	CSBH_FIELD_BODY,
+	CSBH_FIELD_MAX
+};
+
+static const char *csbh_field_names[CSBH_FIELD_MAX] = {
+	[CSBH_FIELD_HEADER] = "header",
+	[CSBH_FIELD_PUBKEY] = "public key",
+	[CSBH_FIELD_SIGNATURE] = "signature",
+	[CSBH_FIELD_PAD] = "header pad",
+	[CSBH_FIELD_BODY] = "body",
+};
+
+static unsigned long
+get_nr_field(csbh_context_t *ctx)
+{
+	if (!ctx->priv)
+		return 0;
+
+	return CSBH_FIELD_MAX;
+}
+
+static err_status_t
+get_field(csbh_context_t *ctx, unsigned long index, const char **name,
+	  unsigned long *offset, unsigned long *len)
+{
+	csbh_internal_t *priv = ctx->priv;
+	void *base, *start, *end;
+
+	if (index >= get_nr_field(ctx))
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	base = priv->header;
+	switch (index) {
+	case CSBH_FIELD_HEADER:
+		start = priv->header;
+		end = priv->pubkey;
+		break;
+	case CSBH_FIELD_PUBKEY:
+		start = priv->pubkey;
+		end = priv->signature;
+		break;
+	case CSBH_FIELD_SIGNATURE:
+		start = priv->signature;
+		end = priv->signature + 1;
+		break;
+	case CSBH_FIELD_PAD:
+		start = priv->signature + 1;
+		end = priv->body;
+		break;
+	default:
+		start = priv->body;
+		end = priv->body + ctx->body_size;
+		break;
+	}
+
+	if (name)
+		*name = csbh_field_names[index];
+	if (offset)
+		*offset = start - base;
+	if (len)
+		*len = end - start;
+
+	return CLN_FW_ERR_NONE;
+}
+
 static void
 show_csbh(csbh_context_t *ctx)
 {
@@ -157,7 +264,7 @@ show_csbh(csbh_context_t *ctx)
 }
 
 static err_status_t
-probe_csbh(csbh_context_t *ctx, void *buf, unsigned long buf_len)
+__probe_csbh(csbh_context_t *ctx, void *buf, unsigned long buf_len)
 {
 	buffer_stream_t bs;
 	csbh_header_t *header;
@@ -260,7 +367,7 @@ probe_csbh(csbh_context_t *ctx, void *buf, unsigned long buf_len)
 		return err;
 	}
 
-	priv = eee_malloc(sizeof(*priv));
+	priv = arena_alloc(obj_arena(ctx), sizeof(*priv));
 	if (!priv)
 		return CLN_FW_ERR_OUT_OF_MEM;
 
@@ -276,6 +383,18 @@ probe_csbh(csbh_context_t *ctx, void *buf, unsigned long buf_len)
 	return CLN_FW_ERR_NONE;
 }
 
+static err_status_t
+probe_csbh(csbh_context_t *ctx, void *buf, unsigned long buf_len)
+{
+	uint64_t start = stats_timer_start();
+	err_status_t err;
+
+	err = __probe_csbh(ctx, buf, buf_len);
+	stats_timer_stop(CLN_FW_STAT_CSBH_PROBE, start);
+
+	return err;
+}
+
 static void
 destroy_csbh(csbh_context_t *ctx)
 {
@@ -288,7 +407,7 @@ csbh_context_dtor(void *ctx)
 	csbh_internal_t *priv = ((csbh_context_t *)ctx)->priv;
 
 	if (priv)
-		eee_mfree(priv);
+		arena_free(obj_arena(ctx), priv);
 }
 
 static err_status_t
@@ -301,22 +420,27 @@ csbh_context_ctor(void *ctx)
 	csbh_ctx->destroy = destroy_csbh;
 	csbh_ctx->show = show_csbh;
 	csbh_ctx->pubkey_type = get_pubkey_type;
+	csbh_ctx->nr_field = get_nr_field;
+	csbh_ctx->get_field = get_field;
 
 	return CLN_FW_ERR_NONE;
 }
 
+static class_handle_t csbh_context_class;
+
 err_status_t
-csbh_context_new(csbh_context_t **ctx)
+csbh_context_new(arena_t *arena, csbh_context_t **ctx)
 {
 	if (!ctx)
 		return CLN_FW_ERR_INVALID_PARAMETER;
 
-	return obj_new("csbh_context_t", ctx);
+	return obj_new_from(arena, csbh_context_class, ctx);
 }
 
 err_status_t
 csbh_context_class_init(void)
 {
 	return class_register("csbh_context_t", NULL, csbh_context_ctor,
-			      csbh_context_dtor, sizeof(csbh_context_t));
+			      csbh_context_dtor, sizeof(csbh_context_t),
+			      &csbh_context_class);
 }
\ No newline at end of file
@@ -12,6 +12,7 @@
 #define __CSBH_H__
 
 #include <eee.h>
+#include "arena.h"
 
 typedef enum {
 	CSBH_KEY_TYPE_NONE,
@@ -27,6 +28,11 @@ struct __csbh_context {
 	void (*destroy)(csbh_context_t *ctx);
 	void (*show)(csbh_context_t *ctx);
 	csbh_key_type_t (*pubkey_type)(csbh_context_t *ctx);
+	unsigned long (*nr_field)(csbh_context_t *ctx);
+	/* The offset is relative to the start of CSBH */
+	err_status_t (*get_field)(csbh_context_t *ctx, unsigned long index,
+				  const char **name, unsigned long *offset,
+				  unsigned long *len);
 	unsigned long csbh_size;
 	unsigned long body_size;
 	void *priv;
@@ -35,9 +41,13 @@ struct __csbh_context {
 unsigned long
 csbh_header_size(void);
 
+err_status_t
+csbh_create(void *csbh_buf, unsigned long csbh_buf_len,
+	    unsigned long body_size, void **body);
+
 err_status_t
 csbh_context_class_init(void);
 err_status_t
-csbh_context_new(csbh_context_t **ctx);
+csbh_context_new(arena_t *arena, csbh_context_t **ctx);
 
 #endif	/* __CSBH_H__ */
\ No newline at end of file
@@ -0,0 +1,280 @@
+/*
+ * Region-aware firmware diff
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <err_status.h>
+#include <cln_fw.h>
+#include "internal.h"
+#include "buffer_stream.h"
+#include "block_cmp.h"
+
+/* The differing bytes closer than this are reported as one range */
+#define DIFF_MERGE_GAP			16
+/* The chunk of a changed block compared at once before scanning bytes */
+#define DIFF_SKIP_SIZE			64
+
+typedef struct {
+	const uint8_t *a;
+	const uint8_t *b;
+	/* The sorted boundaries of all regions */
+	unsigned long *cut;
+	unsigned long nr_cut;
+	cln_fw_diff_range_t *range;
+	unsigned long nr_range;
+	unsigned long max_nr_range;
+	/* The range being extended */
+	cln_fw_diff_range_t *cur;
+	unsigned long next_cut;
+} diff_state_t;
+
+static int
+compare_offset(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static unsigned long *
+build_cuts(cln_fw_region_t *region, unsigned long nr_region,
+	   unsigned long *nr_cut)
+{
+	unsigned long *cut, i, nr;
+
+	cut = eee_malloc(nr_region * 2 * sizeof(*cut));
+	if (!cut)
+		return NULL;
+
+	for (i = 0; i < nr_region; ++i) {
+		cut[i * 2] = region[i].offset;
+		cut[i * 2 + 1] = region[i].offset + region[i].length;
+	}
+
+	qsort(cut, nr_region * 2, sizeof(*cut), compare_offset);
+
+	for (i = 1, nr = 1; i < nr_region * 2; ++i) {
+		if (cut[i] != cut[nr - 1])
+			cut[nr++] = cut[i];
+	}
+
+	*nr_cut = nr;
+
+	return cut;
+}
+
+/* Return the first boundary after the offset */
+static unsigned long
+next_cut(diff_state_t *s, unsigned long offset)
+{
+	unsigned long lo = 0, hi = s->nr_cut;
+
+	while (lo < hi) {
+		unsigned long mid = (lo + hi) / 2;
+
+		if (s->cut[mid] <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < s->nr_cut ? s->cut[lo] : ~0UL;
+}
+
+/*
+ * Account a differing byte. The range is extended if the byte is close
+ * enough and no region boundary is crossed, so that every range is
+ * covered by the same set of regions.
+ */
+static err_status_t
+add_changed_byte(diff_state_t *s, unsigned long offset)
+{
+	cln_fw_diff_range_t *cur = s->cur;
+
+	if (cur && offset - (cur->offset + cur->length) <= DIFF_MERGE_GAP
+			&& offset < s->next_cut) {
+		cur->length = offset + 1 - cur->offset;
+		++cur->nr_changed;
+		return CLN_FW_ERR_NONE;
+	}
+
+	if (s->nr_range == s->max_nr_range) {
+		unsigned long max_nr = s->max_nr_range ? s->max_nr_range * 2
+						       : 64;
+		cln_fw_diff_range_t *range;
+
+		range = eee_mrealloc(s->range, s->max_nr_range * sizeof(*range),
+				     max_nr * sizeof(*range));
+		if (!range)
+			return CLN_FW_ERR_OUT_OF_MEM;
+
+		s->range = range;
+		s->max_nr_range = max_nr;
+	}
+
+	cur = s->range + s->nr_range++;
+	cur->offset = offset;
+	cur->length = 1;
+	cur->nr_changed = 1;
+	cur->region = 0;
+	s->cur = cur;
+	s->next_cut = next_cut(s, offset);
+
+	return CLN_FW_ERR_NONE;
+}
+
+static err_status_t
+diff_block(diff_state_t *s, unsigned long offset, unsigned long len)
+{
+	unsigned long end = offset + len;
+	err_status_t err;
+
+	while (offset < end) {
+		unsigned long i, n = end - offset;
+
+		if (n > DIFF_SKIP_SIZE)
+			n = DIFF_SKIP_SIZE;
+
+		/* Skip the identical chunks quickly */
+		if (block_equal(s->a + offset, s->b + offset, n)) {
+			offset += n;
+			continue;
+		}
+
+		for (i = offset; i < offset + n; ++i) {
+			if (s->a[i] == s->b[i])
+				continue;
+
+			err = add_changed_byte(s, i);
+			if (is_err_status(err))
+				return err;
+		}
+
+		offset += n;
+	}
+
+	return CLN_FW_ERR_NONE;
+}
+
+/* Attribute the range to the smallest region covering it */
+static void
+attribute_ranges(diff_state_t *s, cln_fw_diff_region_t *region,
+		 unsigned long nr_region)
+{
+	unsigned long i, k;
+
+	for (i = 0; i < s->nr_range; ++i) {
+		cln_fw_diff_range_t *range = s->range + i;
+		unsigned long best_len = ~0UL;
+
+		for (k = 0; k < nr_region; ++k) {
+			cln_fw_region_t *r = &region[k].region;
+
+			/* The range never crosses a region boundary */
+			if (range->offset < r->offset
+					|| range->offset >= r->offset + r->length)
+				continue;
+
+			region[k].nr_changed += range->nr_changed;
+
+			if (r->length < best_len) {
+				best_len = r->length;
+				range->region = k;
+			}
+		}
+	}
+}
+
+/*
+ * Compare the firmware with another one in the same size. The regions
+ * are enumerated from the firmware, and each range of differing bytes
+ * is attributed to the most specific region covering it.
+ */
+err_status_t
+cln_fw_parser_diff(cln_fw_parser_t *parser, cln_fw_parser_t *other,
+		   cln_fw_diff_range_t **out_range, unsigned long *nr_range,
+		   cln_fw_diff_region_t **out_region, unsigned long *nr_region)
+{
+	unsigned long fw_len = bs_size(&parser->firmware);
+	cln_fw_region_t *region;
+	cln_fw_diff_region_t *diff_region;
+	diff_state_t s;
+	unsigned long i, nr, off;
+	err_status_t err;
+
+	if (!out_range || !nr_range || !out_region || !nr_region)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	if (bs_size(&other->firmware) != fw_len) {
+		err(T("The firmware sizes are different: 0x%lx vs 0x%lx\n"),
+		    bs_size(&other->firmware), fw_len);
+		return CLN_FW_ERR_INVALID_PARAMETER;
+	}
+
+	err = cln_fw_parser_fetch_all(parser);
+	if (!is_err_status(err))
+		err = cln_fw_parser_fetch_all(other);
+	if (is_err_status(err))
+		return err;
+
+	err = cln_fw_parser_detailed_regions(parser, &region, &nr);
+	if (is_err_status(err))
+		return err;
+
+	eee_memset(&s, 0, sizeof(s));
+	s.a = bs_head(&parser->firmware);
+	s.b = bs_head(&other->firmware);
+
+	diff_region = eee_malloc(nr * sizeof(*diff_region));
+	s.cut = build_cuts(region, nr, &s.nr_cut);
+	if (!diff_region || !s.cut) {
+		err = CLN_FW_ERR_OUT_OF_MEM;
+		goto err;
+	}
+
+	for (i = 0; i < nr; ++i) {
+		diff_region[i].region = region[i];
+		diff_region[i].nr_changed = 0;
+	}
+
+	for (off = 0; off < fw_len; off += BLOCK_SIZE) {
+		unsigned long len = fw_len - off;
+
+		if (len > BLOCK_SIZE)
+			len = BLOCK_SIZE;
+
+		if (block_equal(s.a + off, s.b + off, len))
+			continue;
+
+		err = diff_block(&s, off, len);
+		if (is_err_status(err))
+			goto err;
+	}
+
+	attribute_ranges(&s, diff_region, nr);
+
+	eee_mfree(s.cut);
+	eee_mfree(region);
+
+	*out_range = s.range;
+	*nr_range = s.nr_range;
+	*out_region = diff_region;
+	*nr_region = nr;
+
+	return CLN_FW_ERR_NONE;
+
+err:
+	eee_mfree(s.range);
+	eee_mfree(s.cut);
+	eee_mfree(diff_region);
+	eee_mfree(region);
+
+	return err;
+}
@@ -0,0 +1,109 @@
+/*
+ * Per-region firmware digest
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <err_status.h>
+#include <cln_fw.h>
+#include "internal.h"
+#include "buffer_stream.h"
+#include "sha256.h"
+#include "thread_pool.h"
+
+typedef struct {
+	cln_fw_digest_t *digest;
+	void *buf;
+} digest_job_t;
+
+static void
+run_digest_job(void *arg)
+{
+	digest_job_t *job = arg;
+
+	sha256(job->buf, job->digest->region.length, job->digest->digest);
+}
+
+err_status_t
+cln_fw_parser_digest(cln_fw_parser_t *parser, unsigned int nr_thread,
+		     cln_fw_digest_t **out, unsigned long *nr_digest)
+{
+	cln_fw_region_t *region;
+	cln_fw_digest_t *digest;
+	digest_job_t *job;
+	thread_pool_t *pool;
+	unsigned long i, nr_region;
+	err_status_t err;
+
+	if (!out || !nr_digest)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	err = cln_fw_parser_regions(parser, &region, &nr_region);
+	if (is_err_status(err))
+		return err;
+
+	digest = eee_malloc(nr_region * sizeof(*digest));
+	job = eee_malloc(nr_region * sizeof(*job));
+	if (!digest || !job) {
+		err = CLN_FW_ERR_OUT_OF_MEM;
+		goto err_alloc;
+	}
+
+	for (i = 0; i < nr_region; ++i) {
+		digest[i].region = region[i];
+		job[i].digest = digest + i;
+
+		err = bs_get_at(&parser->firmware, &job[i].buf,
+				region[i].length, region[i].offset);
+		if (is_err_status(err))
+			goto err_alloc;
+	}
+
+	if (!nr_thread)
+		nr_thread = thread_pool_nr_cpu();
+
+	if (nr_thread > nr_region)
+		nr_thread = nr_region;
+
+	pool = NULL;
+	if (nr_thread > 1) {
+		err = thread_pool_create(nr_thread, &pool);
+		if (is_err_status(err))
+			goto err_alloc;
+	}
+
+	/*
+	 * The whole image comes first so that the longest job overlaps
+	 * with the per-region ones.
+	 */
+	for (i = 0; i < nr_region; ++i) {
+		if (pool)
+			err = thread_pool_submit(pool, run_digest_job, job + i);
+
+		if (!pool || is_err_status(err))
+			run_digest_job(job + i);
+	}
+
+	thread_pool_wait(pool);
+	thread_pool_destroy(pool);
+
+	eee_mfree(job);
+	eee_mfree(region);
+
+	*out = digest;
+	*nr_digest = nr_region;
+
+	return CLN_FW_ERR_NONE;
+
+err_alloc:
+	eee_mfree(job);
+	eee_mfree(digest);
+	eee_mfree(region);
+
+	return err;
+}
@@ -0,0 +1,177 @@
+/*
+ * MFH flash item extraction
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <err_status.h>
+#include <cln_fw.h>
+#include "internal.h"
+#include "buffer_stream.h"
+#include "mfh.h"
+#include "thread_pool.h"
+
+typedef struct {
+	cln_fw_parser_t *parser;
+	cln_fw_extract_t *extract;
+} extract_job_t;
+
+err_status_t
+cln_fw_parser_flash_items(cln_fw_parser_t *parser,
+			  cln_fw_flash_item_t **out, unsigned long *nr_item)
+{
+	buffer_stream_t *fw = &parser->firmware;
+	cln_fw_flash_item_t *item;
+	mfh_context_t *mfh_ctx;
+	mfh_item_iter_t iter;
+	unsigned long nr;
+	err_status_t err;
+
+	if (!out || !nr_item)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	if (bs_empty(&parser->mfh))
+		return CLN_FW_ERR_INVALID_MFH;
+
+	err = mfh_context_new(parser->arena, &mfh_ctx);
+	if (is_err_status(err))
+		return err;
+
+	err = mfh_ctx->probe(mfh_ctx, bs_head(&parser->mfh),
+			     bs_size(&parser->mfh));
+	if (is_err_status(err))
+		goto out;
+
+	item = eee_malloc(mfh_ctx->nr_item(mfh_ctx) * sizeof(*item));
+	if (!item) {
+		err = CLN_FW_ERR_OUT_OF_MEM;
+		goto out;
+	}
+
+	nr = 0;
+	mfh_item_iter_init(&iter, MFH_ITEM_ANY, bs_head(fw), bs_size(fw));
+	while (!is_err_status(mfh_ctx->iterate(mfh_ctx, &iter))) {
+		cln_fw_flash_item_t *p = item + nr++;
+
+		p->index = iter.index;
+		p->type = iter.type;
+		p->type_name = mfh_flash_item_type_name(iter.type);
+		p->addr = iter.addr;
+		p->length = iter.len;
+		p->offset = iter.data ? iter.data - bs_head(fw) :
+			    CLN_FW_OFFSET_NONE;
+	}
+
+	*out = item;
+	*nr_item = nr;
+
+out:
+	mfh_ctx->destroy(mfh_ctx);
+
+	return err;
+}
+
+static void
+run_extract_job(void *arg)
+{
+	extract_job_t *job = arg;
+	cln_fw_extract_t *extract = job->extract;
+	cln_fw_parser_t *parser = job->parser;
+
+	/*
+	 * The input offset is passed explicitly, so the jobs share the
+	 * file descriptor of firmware without racing on its position.
+	 */
+	if (write_file_extent(extract->fd, parser->fw_fd,
+			      bs_head(&parser->firmware), extract->offset,
+			      extract->length))
+		extract->status = CLN_FW_ERR_IO;
+	else
+		extract->status = CLN_FW_ERR_NONE;
+}
+
+/*
+ * Copy the extents of firmware to their files concurrently. If the
+ * firmware is backed by a file, the bytes are moved by the kernel.
+ * The first failure is returned and the status of each extent is set.
+ */
+err_status_t
+cln_fw_parser_extract(cln_fw_parser_t *parser, cln_fw_extract_t *extract,
+		      unsigned long nr_extract, unsigned int nr_thread)
+{
+	buffer_stream_t *fw = &parser->firmware;
+	extract_job_t *job;
+	thread_pool_t *pool;
+	unsigned long i;
+	err_status_t err;
+
+	if (!extract || !nr_extract)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	for (i = 0; i < nr_extract; ++i) {
+		if (extract[i].fd < 0 || extract[i].offset > bs_size(fw)
+				|| extract[i].length > bs_size(fw)
+						       - extract[i].offset)
+			return CLN_FW_ERR_INVALID_PARAMETER;
+
+		/* Nothing is fetched on demand from the worker threads */
+		if (parser->fw_fd < 0) {
+			err = bs_fetch_at(fw, extract[i].length,
+					  extract[i].offset);
+			if (is_err_status(err))
+				return err;
+		}
+	}
+
+	job = eee_malloc(nr_extract * sizeof(*job));
+	if (!job)
+		return CLN_FW_ERR_OUT_OF_MEM;
+
+	for (i = 0; i < nr_extract; ++i) {
+		job[i].parser = parser;
+		job[i].extract = extract + i;
+	}
+
+	if (!nr_thread)
+		nr_thread = thread_pool_nr_cpu();
+
+	if (nr_thread > nr_extract)
+		nr_thread = nr_extract;
+
+	pool = NULL;
+	if (nr_thread > 1) {
+		err = thread_pool_create(nr_thread, &pool);
+		if (is_err_status(err))
+			goto out;
+	}
+
+	for (i = 0; i < nr_extract; ++i) {
+		if (pool)
+			err = thread_pool_submit(pool, run_extract_job,
+						 job + i);
+
+		if (!pool || is_err_status(err))
+			run_extract_job(job + i);
+	}
+
+	thread_pool_wait(pool);
+	thread_pool_destroy(pool);
+
+	err = CLN_FW_ERR_NONE;
+	for (i = 0; i < nr_extract; ++i) {
+		if (is_err_status(extract[i].status)) {
+			err = extract[i].status;
+			break;
+		}
+	}
+
+out:
+	eee_mfree(job);
+
+	return err;
+}
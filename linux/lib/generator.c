@@ -0,0 +1,253 @@
+/*
+ * Synthetic firmware image generator
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <err_status.h>
+#include <cln_fw.h>
+#include "internal.h"
+#include "mfh.h"
+#include "skm.h"
+
+/* The flash items are laid out below MFH in this granularity */
+#define GEN_ITEM_ALIGN			0x1000
+#define GEN_MIN_FW_SIZE			0x100000
+
+static const unsigned int gen_default_item_type[] = {
+	mfh_kernel,
+	mfh_ramdisk,
+	mfh_bootloader,
+	host_fw_stage2,
+};
+
+static const unsigned int gen_default_pdata_id[] = {
+	PDATA_ID_PLATFORM_ID,
+	PDATA_ID_SERIAL_NUMBER,
+	PDATA_ID_1ST_MAC,
+	PDATA_ID_2ND_MAC,
+	PDATA_ID_MEM_CFG,
+	PDATA_ID_MRC,
+};
+
+/* xorshift64* keeps the contents reproducible from the seed */
+static uint64_t
+gen_random(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+static void
+gen_fill(void *buf, unsigned long len, unsigned long seed, unsigned long tag)
+{
+	uint64_t state = (seed + 1) * 0x9e3779b97f4a7c15ULL ^ (tag << 32 | tag);
+	uint8_t *p = buf;
+
+	if (!state)
+		state = 1;
+
+	for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+		uint64_t v = gen_random(&state);
+
+		eee_memcpy(p, &v, sizeof(v));
+		p += sizeof(v);
+	}
+
+	if (len) {
+		uint64_t v = gen_random(&state);
+
+		eee_memcpy(p, &v, len);
+	}
+}
+
+static err_status_t
+gen_flash_items(const cln_fw_gen_param_t *param, uint8_t *fw,
+		unsigned long fw_len)
+{
+	const unsigned int *type = gen_default_item_type;
+	unsigned int nr_type = sizeof(gen_default_item_type)
+			       / sizeof(gen_default_item_type[0]);
+	unsigned long area = fw_len + mfh_offset();
+	unsigned long item_len = param->flash_item_len;
+	uint32_t base = (uint32_t)(0x100000000ULL - fw_len);
+	void *mfh = fw + area;
+	unsigned long i;
+	err_status_t err;
+
+	if (param->flash_item_type && param->nr_flash_item_type) {
+		type = param->flash_item_type;
+		nr_type = param->nr_flash_item_type;
+	}
+
+	for (i = 0; i < nr_type; ++i) {
+		if (type[i] >= mfh_flash_item_type_max
+				|| type[i] == mfh_version) {
+			err(T("Invalid flash item type: 0x%x\n"), type[i]);
+			return CLN_FW_ERR_INVALID_PARAMETER;
+		}
+	}
+
+	if (!item_len && param->nr_flash_item)
+		item_len = area / param->nr_flash_item
+			   & ~(GEN_ITEM_ALIGN - 1UL);
+
+	if (param->nr_flash_item && (!item_len
+			|| item_len * param->nr_flash_item > area)) {
+		err(T("No room for %d flash item(s) below MFH\n"),
+		    param->nr_flash_item);
+		return CLN_FW_ERR_INVALID_PARAMETER;
+	}
+
+	/* The version item is always appended */
+	err = mfh_create(mfh, platform_data_offset() - mfh_offset(),
+			 param->nr_boot_item, param->nr_flash_item + 1);
+	if (is_err_status(err)) {
+		err(T("Invalid number of flash items or boot items\n"));
+		return err;
+	}
+
+	for (i = 0; i < param->nr_flash_item; ++i) {
+		unsigned long off = i * item_len;
+
+		gen_fill(fw + off, item_len, param->seed, i);
+		mfh_set_flash_item(mfh, i, type[i % nr_type], base + off,
+				   item_len, 0);
+	}
+
+	/* Yes the firmware version is stored in the Reserved field */
+	mfh_set_flash_item(mfh, i, mfh_version, 0, 0, param->fw_version);
+
+	return CLN_FW_ERR_NONE;
+}
+
+static err_status_t
+gen_pdata(const cln_fw_gen_param_t *param, uint8_t *fw, unsigned long fw_len)
+{
+	const unsigned int *id = gen_default_pdata_id;
+	unsigned int nr_id = sizeof(gen_default_pdata_id)
+			     / sizeof(gen_default_pdata_id[0]);
+	uint8_t *pdata = fw + fw_len + platform_data_offset();
+	uint8_t *item_buf = pdata + platform_data_header_size();
+	unsigned long item_size, i;
+
+	if (param->pdata_item_id && param->nr_pdata_item_id) {
+		id = param->pdata_item_id;
+		nr_id = param->nr_pdata_item_id;
+	}
+
+	for (i = 0; i < nr_id; ++i) {
+		if (id[i] == PDATA_ID_INVALID || id[i] >= PDATA_ID_MAX) {
+			err(T("Invalid platform data item id: 0x%x\n"), id[i]);
+			return CLN_FW_ERR_INVALID_PARAMETER;
+		}
+	}
+
+	item_size = sizeof(platform_data_item_t) + param->pdata_item_len;
+	if (param->pdata_item_len > 0xffff
+			|| platform_data_header_size()
+			   + param->nr_pdata_item * item_size
+			   > platform_data_max_size()) {
+		err(T("No room for %d platform data item(s) of %d bytes\n"),
+		    param->nr_pdata_item, param->pdata_item_len);
+		return CLN_FW_ERR_INVALID_PARAMETER;
+	}
+
+	for (i = 0; i < param->nr_pdata_item; ++i) {
+		platform_data_item_t *item;
+		char desc[32];
+
+		item = (platform_data_item_t *)(item_buf + i * item_size);
+		item->id = id[i % nr_id];
+		item->length = param->pdata_item_len;
+		item->version = 0;
+		snprintf(desc, sizeof(desc), "gen-%ld", i);
+		eee_strncpy(item->desc, desc, sizeof(item->desc));
+		gen_fill(item->data, item->length, param->seed, ~i);
+
+		/* Let the SB records be recognized as db certificates */
+		if (item->id == PDATA_ID_SB_RECORD
+				&& item->length >= sizeof(uint32_t)) {
+			uint32_t cert_header = PDATA_DB_CERT_HEADER;
+
+			eee_memcpy(item->data, &cert_header,
+				   sizeof(cert_header));
+		}
+	}
+
+	((platform_data_header_t *)pdata)->magic = PLATFORM_DATA_MAGIC;
+	platform_data_update_header(NULL, pdata, item_buf,
+				    param->nr_pdata_item * item_size,
+				    param->nr_pdata_item);
+
+	return CLN_FW_ERR_NONE;
+}
+
+static err_status_t
+gen_skm(const cln_fw_gen_param_t *param, uint8_t *fw, unsigned long fw_len)
+{
+	uint8_t *skm = fw + fw_len + skm_offset();
+
+	/* The public keys get random moduli */
+	gen_fill(skm, skm_size(), param->seed, ~0UL);
+
+	return skm_create(skm, skm_size());
+}
+
+/*
+ * Generate a firmware image in the Quark layout for benchmarks and scale
+ * tests. The flash items are filled with the pseudo-random contents
+ * derived from the seed, so the same parameters always produce the same
+ * image and different seeds produce different ones.
+ */
+err_status_t
+cln_fw_util_generate_firmware(const cln_fw_gen_param_t *param, void **out,
+			      unsigned long *out_len)
+{
+	unsigned long fw_len;
+	uint8_t *fw;
+	err_status_t err;
+
+	if (!param || !out || !out_len)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	fw_len = param->fw_len ? param->fw_len : FIRMWARE_SIZE;
+	if (fw_len < GEN_MIN_FW_SIZE || fw_len > 0x100000000ULL
+			|| fw_len & (GEN_ITEM_ALIGN - 1)) {
+		err(T("Invalid firmware size: 0x%lx\n"), fw_len);
+		return CLN_FW_ERR_INVALID_PARAMETER;
+	}
+
+	fw = eee_malloc(fw_len);
+	if (!fw)
+		return CLN_FW_ERR_OUT_OF_MEM;
+
+	/* As the erased flash */
+	eee_memset(fw, 0xff, fw_len);
+
+	err = gen_flash_items(param, fw, fw_len);
+	if (!is_err_status(err))
+		err = gen_pdata(param, fw, fw_len);
+	if (!is_err_status(err))
+		err = gen_skm(param, fw, fw_len);
+	if (is_err_status(err)) {
+		eee_mfree(fw);
+		return err;
+	}
+
+	*out = fw;
+	*out_len = fw_len;
+
+	return CLN_FW_ERR_NONE;
+}
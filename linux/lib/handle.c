@@ -14,6 +14,7 @@
 #include "internal.h"
 #include "bcll.h"
 #include "skm.h"
+#include "window.h"
 
 err_status_t
 cln_fw_handle_open(cln_fw_handle_t *handle, void *fw, unsigned long fw_len)
@@ -30,7 +31,7 @@ cln_fw_handle_open(cln_fw_handle_t *handle, void *fw, unsigned long fw_len)
 
 	err = cln_fw_parser_parse(parser);
 	if (is_err_status(err)) {
-		eee_mfree(parser);
+		cln_fw_parser_destroy(parser);
 		return err;
 	}
 
@@ -39,6 +40,128 @@ cln_fw_handle_open(cln_fw_handle_t *handle, void *fw, unsigned long fw_len)
 	return CLN_FW_ERR_NONE;
 }
 
+err_status_t
+cln_fw_handle_open_file(cln_fw_handle_t *handle, const char *file_path)
+{
+	cln_fw_parser_t *parser;
+	uint8_t *fw;
+	unsigned long fw_len;
+	int fd;
+	err_status_t err;
+
+	if (!handle || !file_path)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	if (map_file(file_path, &fw, &fw_len, &fd))
+		return CLN_FW_ERR_IO;
+
+	err = cln_fw_parser_create(fw, fw_len, &parser);
+	if (is_err_status(err)) {
+		unmap_file(fw, fw_len);
+		close(fd);
+		return err;
+	}
+
+	/* From now on the mapping is released along with the parser */
+	parser->fw_map = fw;
+	parser->fw_map_len = fw_len;
+	parser->fw_fd = fd;
+
+	err = cln_fw_parser_parse(parser);
+	if (is_err_status(err)) {
+		cln_fw_parser_destroy(parser);
+		return err;
+	}
+
+	*handle = (cln_fw_handle_t)parser;
+
+	return CLN_FW_ERR_NONE;
+}
+
+/*
+ * Open the handle on the window of firmware. From now on the window and
+ * file are released along with the parser, or at once on failure. The
+ * file is still used to copy the extents out.
+ */
+err_status_t
+handle_open_window(cln_fw_handle_t *handle, bs_source_t *src, int fd)
+{
+	cln_fw_parser_t *parser;
+	err_status_t err;
+
+	err = cln_fw_parser_create(src->buf, src->buf_len, &parser);
+	if (is_err_status(err)) {
+		src->release(src);
+		if (fd >= 0)
+			close(fd);
+		return err;
+	}
+
+	bs_init_source(&parser->firmware, src);
+	parser->fw_source = src;
+	parser->fw_fd = fd;
+
+	err = cln_fw_parser_parse(parser);
+	if (is_err_status(err)) {
+		cln_fw_parser_destroy(parser);
+		return err;
+	}
+
+	*handle = (cln_fw_handle_t)parser;
+
+	return CLN_FW_ERR_NONE;
+}
+
+/*
+ * Open the firmware file without loading it. Only the extents parsed or
+ * requested later are read with pread(), which suits the images stored
+ * on slow or network-mounted storage.
+ */
+err_status_t
+cln_fw_handle_open_file_lazy(cln_fw_handle_t *handle, const char *file_path)
+{
+	bs_source_t *src;
+	unsigned long fw_len;
+	int fd;
+	err_status_t err;
+
+	if (!handle || !file_path)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	fd = open_input_file(file_path, &fw_len);
+	if (fd < 0)
+		return CLN_FW_ERR_IO;
+
+	err = window_open_fd(fd, fw_len, &src);
+	if (is_err_status(err)) {
+		close(fd);
+		return err;
+	}
+
+	return handle_open_window(handle, src, fd);
+}
+
+/*
+ * Open the firmware in physical memory, e.g, the SPI flash mapped below
+ * 4 GiB on Quark. Only the pages touched by the parser are mapped.
+ */
+err_status_t
+cln_fw_handle_open_phys(cln_fw_handle_t *handle, const char *mem_path,
+			unsigned long phys_addr, unsigned long fw_len)
+{
+	bs_source_t *src;
+	err_status_t err;
+
+	if (!handle || !mem_path || !fw_len)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	err = window_open_phys(mem_path, phys_addr, fw_len, &src);
+	if (is_err_status(err))
+		return err;
+
+	return handle_open_window(handle, src, -1);
+}
+
 void
 cln_fw_handle_close(cln_fw_handle_t handle)
 {
@@ -48,14 +171,41 @@ cln_fw_handle_close(cln_fw_handle_t handle)
 	cln_fw_parser_destroy((cln_fw_parser_t *)handle);
 }
 
+err_status_t
+cln_fw_handle_firmware(cln_fw_handle_t handle, void **fw,
+		       unsigned long *fw_len)
+{
+	cln_fw_parser_t *parser;
+
+	if (!handle)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	parser = (cln_fw_parser_t *)handle;
+
+	if (fw) {
+		err_status_t err;
+
+		err = cln_fw_parser_fetch_all(parser);
+		if (is_err_status(err))
+			return err;
+
+		*fw = bs_head(&parser->firmware);
+	}
+
+	if (fw_len)
+		*fw_len = bs_size(&parser->firmware);
+
+	return CLN_FW_ERR_NONE;
+}
+
 
 static void
-show_skm(void *skm_buf, unsigned long skm_buf_len)
+show_skm(arena_t *arena, void *skm_buf, unsigned long skm_buf_len)
 {
 	skm_context_t *skm = NULL;
 	err_status_t err;
 
-	err = skm_context_new(&skm);
+	err = skm_context_new(arena, &skm);
 	if (is_err_status(err))
 		return;
 
@@ -69,6 +219,32 @@ show_skm(void *skm_buf, unsigned long skm_buf_len)
 	skm->destroy(skm);
 }
 
+err_status_t
+cln_fw_handle_firmware_version(cln_fw_handle_t handle,
+			       unsigned int *fw_version)
+{
+	cln_fw_parser_t *parser;
+	buffer_stream_t *bs;
+	uint32_t version;
+	err_status_t err;
+
+	if (!handle || !fw_version)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	parser = (cln_fw_parser_t *)handle;
+	bs = &parser->mfh;
+	if (bs_empty(bs))
+		return CLN_FW_ERR_INVALID_MFH;
+
+	err = mfh_get_fw_version(bs_head(bs), bs_size(bs), &version);
+	if (is_err_status(err))
+		return err;
+
+	*fw_version = version;
+
+	return CLN_FW_ERR_NONE;
+}
+
 void
 cln_fw_handle_show_all(cln_fw_handle_t handle)
 {
@@ -89,13 +265,13 @@ cln_fw_handle_show_all(cln_fw_handle_t handle)
 
 	bs = &parser->pdata;
 	if (!bs_empty(bs)) {
-		platform_data_show(bs_head(bs), bs_size(bs));
+		platform_data_show(&parser->pdata_view);
 		info_cont(T("\n"));
 	}
 
 	bs = &parser->skm;
 	if (!bs_empty(bs)) {
-		show_skm(bs_head(bs), bs_size(bs));
+		show_skm(parser->arena, bs_head(bs), bs_size(bs));
 		info_cont(T("\n"));
 	}
 }
@@ -134,7 +310,7 @@ cln_fw_handle_embed_key(cln_fw_handle_t handle, cln_fw_sb_key_t key,
 	if (cln_fw_verbose()) {
 		dbg(T("Showing platform data before embedding %s ...\n"),
 		    key_name[key]);
-		platform_data_show(bs_head(pdata), bs_size(pdata));
+		platform_data_show(&parser->pdata_view);
 	}
 
 	err = cln_fw_parser_embed_key(parser, key, in, in_len);
@@ -145,13 +321,56 @@ cln_fw_handle_embed_key(cln_fw_handle_t handle, cln_fw_sb_key_t key,
 	if (cln_fw_verbose()) {
 		dbg(T("Showing platform data after embedding %s ...\n"),
 		    key_name[key]);
-		platform_data_show(bs_head(pdata), bs_size(pdata));
+		platform_data_show(&parser->pdata_view);
 	}
 #endif
 
 	return CLN_FW_ERR_NONE;
 }
 
+err_status_t
+cln_fw_handle_flush_buffer(cln_fw_handle_t handle, void *buf,
+			   unsigned long buf_len)
+{
+	cln_fw_parser_t *parser;
+	buffer_stream_t *fw;
+	err_status_t err;
+
+	if (!handle || !buf)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	parser = (cln_fw_parser_t *)handle;
+	fw = &parser->firmware;
+	if (buf_len != bs_size(fw))
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	err = cln_fw_parser_fetch_all(parser);
+	if (is_err_status(err))
+		return err;
+
+	/*
+	 * Flushing to the firmware buffer itself only rewrites the platform
+	 * data region in place. This is not allowed for a file mapping or
+	 * the windows of a lazy source which are always read-only.
+	 */
+	if (buf == bs_head(fw)) {
+		if (parser->fw_map || parser->fw_source)
+			return CLN_FW_ERR_INVALID_PARAMETER;
+	} else
+		eee_memcpy(buf, bs_head(fw), buf_len);
+
+	return cln_fw_parser_flush(parser, buf, buf_len);
+}
+
+err_status_t
+cln_fw_handle_flush_fd(cln_fw_handle_t handle, int fd)
+{
+	if (!handle || fd < 0)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	return cln_fw_parser_flush_fd((cln_fw_parser_t *)handle, fd);
+}
+
 err_status_t
 cln_fw_handle_flush(cln_fw_handle_t handle, void **out,
 		    unsigned long *out_len)
@@ -170,9 +389,7 @@ cln_fw_handle_flush(cln_fw_handle_t handle, void **out,
 	if (!fw_buf)
 		return CLN_FW_ERR_OUT_OF_MEM;
 
-	eee_memcpy(fw_buf, bs_head(&parser->firmware), fw_buf_len);
-
-	err = cln_fw_parser_flush(parser, fw_buf, fw_buf_len);
+	err = cln_fw_handle_flush_buffer(handle, fw_buf, fw_buf_len);
 	if (is_err_status(err)) {
 		eee_mfree(fw_buf);
 		return err;
@@ -202,6 +419,31 @@ cln_fw_handle_generate_capsule(cln_fw_handle_t handle, int bios_only,
 	return CLN_FW_ERR_NONE;
 }
 
+err_status_t
+cln_fw_handle_write_capsule(cln_fw_handle_t handle, int bios_only, int fd)
+{
+	if (!handle || fd < 0)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	return cln_fw_parser_write_capsule((cln_fw_parser_t *)handle,
+					   bios_only, fd);
+}
+
+err_status_t
+cln_fw_handle_write_delta_capsule(cln_fw_handle_t handle,
+				  cln_fw_handle_t base_handle, int bios_only,
+				  int fd, unsigned int *nr_extent,
+				  unsigned long *payload_len)
+{
+	if (!handle || !base_handle || fd < 0)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	return cln_fw_parser_write_delta_capsule((cln_fw_parser_t *)handle,
+						 (cln_fw_parser_t *)base_handle,
+						 bios_only, fd, nr_extent,
+						 payload_len);
+}
+
 err_status_t
 cln_fw_handle_diagnose_firmware(cln_fw_handle_t handle, void *in,
 				unsigned long in_len)
@@ -209,13 +451,97 @@ cln_fw_handle_diagnose_firmware(cln_fw_handle_t handle, void *in,
 	cln_fw_parser_t *parser;
 	err_status_t err;
 
-	if (!handle || !in || !in_len)
+	if (!handle)
 		return CLN_FW_ERR_INVALID_PARAMETER;
 
 	parser = (cln_fw_parser_t *)handle;
+
+	/*
+	 * The firmware parsed by the handle is always diagnosed so in is
+	 * deprecated and should be NULL. If given, it must still be the
+	 * firmware returned by cln_fw_handle_firmware().
+	 */
+	if (in && (in != bs_head(&parser->firmware)
+		   || in_len != bs_size(&parser->firmware)))
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
 	err = cln_fw_parser_diagnose_firmware(parser);
 	if (is_err_status(err))
 		return err;
 
 	return CLN_FW_ERR_NONE;
-}
\ No newline at end of file
+}
+
+err_status_t
+cln_fw_handle_regions(cln_fw_handle_t handle, cln_fw_region_t **out,
+		      unsigned long *nr_region)
+{
+	if (!handle || !out || !nr_region)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	return cln_fw_parser_regions((cln_fw_parser_t *)handle, out,
+				     nr_region);
+}
+
+err_status_t
+cln_fw_handle_digest(cln_fw_handle_t handle, unsigned int nr_thread,
+		     cln_fw_digest_t **out, unsigned long *nr_digest)
+{
+	if (!handle || !out || !nr_digest)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	return cln_fw_parser_digest((cln_fw_parser_t *)handle, nr_thread,
+				    out, nr_digest);
+}
+
+err_status_t
+cln_fw_handle_flash_items(cln_fw_handle_t handle, cln_fw_flash_item_t **out,
+			  unsigned long *nr_item)
+{
+	if (!handle || !out || !nr_item)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	return cln_fw_parser_flash_items((cln_fw_parser_t *)handle, out,
+					 nr_item);
+}
+
+err_status_t
+cln_fw_handle_extract(cln_fw_handle_t handle, cln_fw_extract_t *extract,
+		      unsigned long nr_extract, unsigned int nr_thread)
+{
+	if (!handle || !extract || !nr_extract)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	return cln_fw_parser_extract((cln_fw_parser_t *)handle, extract,
+				     nr_extract, nr_thread);
+}
+
+err_status_t
+cln_fw_handle_update_flash_items(cln_fw_handle_t handle,
+				 const cln_fw_item_update_t *update,
+				 unsigned long nr_update,
+				 unsigned long erase_block, void **out,
+				 unsigned long *out_len,
+				 cln_fw_flash_cost_t *cost)
+{
+	if (!handle || !update || !nr_update || !out || !out_len)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	return cln_fw_parser_update_flash_items((cln_fw_parser_t *)handle,
+						update, nr_update,
+						erase_block, out, out_len,
+						cost);
+}
+
+err_status_t
+cln_fw_handle_diff(cln_fw_handle_t handle, cln_fw_handle_t other,
+		   cln_fw_diff_range_t **range, unsigned long *nr_range,
+		   cln_fw_diff_region_t **region, unsigned long *nr_region)
+{
+	if (!handle || !other)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	return cln_fw_parser_diff((cln_fw_parser_t *)handle,
+				  (cln_fw_parser_t *)other, range, nr_range,
+				  region, nr_region);
+}
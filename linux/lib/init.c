@@ -10,21 +10,23 @@
 
 #include <err_status.h>
 #include <cln_fw.h>
+#include <pthread.h>
 #include "internal.h"
 #include "class.h"
 #include "csbh.h"
 #include "mfh.h"
 #include "skm.h"
+#include "block_cmp.h"
 
-static int initialized;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
 
-void __attribute__ ((constructor))
-libclnfw_init(void)
+static void
+__libclnfw_init(void)
 {
 	err_status_t err;
 
-	if (initialized)
-		return;
+	crc32_setup();
+	block_cmp_setup();
 
 	err = mfh_context_class_init();
 	if (is_err_status(err)) {
@@ -44,10 +46,17 @@ libclnfw_init(void)
 		return;
 	}
 
-	initialized = 1;
+	class_freeze();
+}
+
+void __attribute__ ((constructor))
+libclnfw_init(void)
+{
+	pthread_once(&init_once, __libclnfw_init);
 }
 
 void __attribute__((destructor))
 libclnfw_fini(void)
 {
+	class_drain_pool();
 }
\ No newline at end of file
@@ -16,6 +16,10 @@
 #include "buffer_stream.h"
 #include "bcll.h"
 #include "mfh.h"
+#include "crc32.h"
+#include "arena.h"
+#include "platform_data.h"
+#include "capsule.h"
 
 #define stringify(x)		#x
 
@@ -33,16 +37,39 @@ typedef struct {
 	buffer_stream_t bs;
 } cln_fw_pdata_item_t;
 
+/*
+ * The slots of platform data item index. The item id is used as the
+ * slot directly, and the SB records are further keyed by cert header
+ * or by the key embedded.
+ */
+enum {
+	PDATA_INDEX_KEK = PDATA_ID_MAX,
+	PDATA_INDEX_DB,
+	PDATA_INDEX_DBX,
+	PDATA_INDEX_MAX
+};
+
 typedef struct {
 	buffer_stream_t firmware;
 	buffer_stream_t mfh;
 	buffer_stream_t pdata;
 	buffer_stream_t skm;
+	platform_data_view_t pdata_view;
 	/* For output */
 	buffer_stream_t pdata_header;
 	void *pdata_item;
 	bcll_t pdata_item_list;
 	unsigned long nr_pdata_item;
+	/* The first item for each slot in pdata_item_list */
+	cln_fw_pdata_item_t *pdata_index[PDATA_INDEX_MAX];
+	/* The file mapping backing the firmware buffer if owned */
+	void *fw_map;
+	unsigned long fw_map_len;
+	int fw_fd;
+	/* The backend fetching the firmware buffer on demand */
+	bs_source_t *fw_source;
+	/* The arena backing the parser and the objects it creates */
+	arena_t *arena;
 } cln_fw_parser_t;
 
 err_status_t
@@ -55,6 +82,9 @@ cln_fw_parser_destroy(cln_fw_parser_t *parser);
 err_status_t
 cln_fw_parser_parse(cln_fw_parser_t *parser);
 
+err_status_t
+cln_fw_parser_fetch_all(cln_fw_parser_t *parser);
+
 err_status_t
 cln_fw_parser_embed_key(cln_fw_parser_t *ctx, cln_fw_sb_key_t key, void *in,
 			unsigned long in_len);
@@ -63,6 +93,18 @@ err_status_t
 cln_fw_parser_flush(cln_fw_parser_t *parser, void *fw_buf,
 		    unsigned long fw_buf_len);
 
+err_status_t
+cln_fw_parser_flush_fd(cln_fw_parser_t *parser, int fd);
+
+err_status_t
+cln_fw_parser_write_capsule(cln_fw_parser_t *parser, int bios_only, int fd);
+
+err_status_t
+cln_fw_parser_write_delta_capsule(cln_fw_parser_t *parser,
+				  cln_fw_parser_t *base, int bios_only,
+				  int fd, unsigned int *nr_extent,
+				  unsigned long *payload_len);
+
 err_status_t
 cln_fw_parser_generate_capsule(cln_fw_parser_t *parser, int bios_only,
 			       void **out, unsigned long *out_len);
@@ -70,10 +112,50 @@ cln_fw_parser_generate_capsule(cln_fw_parser_t *parser, int bios_only,
 err_status_t
 cln_fw_parser_diagnose_firmware(cln_fw_parser_t *parser);
 
+err_status_t
+cln_fw_parser_flash_offset(cln_fw_parser_t *parser, uint32_t addr,
+			   uint32_t len, unsigned long *offset);
+
+err_status_t
+cln_fw_parser_regions(cln_fw_parser_t *parser, cln_fw_region_t **out,
+		      unsigned long *nr_region);
+
+err_status_t
+cln_fw_parser_detailed_regions(cln_fw_parser_t *parser,
+			       cln_fw_region_t **out,
+			       unsigned long *nr_region);
+
+err_status_t
+cln_fw_parser_digest(cln_fw_parser_t *parser, unsigned int nr_thread,
+		     cln_fw_digest_t **out, unsigned long *nr_digest);
+
+err_status_t
+cln_fw_parser_flash_items(cln_fw_parser_t *parser,
+			  cln_fw_flash_item_t **out, unsigned long *nr_item);
+
+err_status_t
+cln_fw_parser_extract(cln_fw_parser_t *parser, cln_fw_extract_t *extract,
+		      unsigned long nr_extract, unsigned int nr_thread);
+
+err_status_t
+cln_fw_parser_update_flash_items(cln_fw_parser_t *parser,
+				 const cln_fw_item_update_t *update,
+				 unsigned long nr_update,
+				 unsigned long erase_block, void **out,
+				 unsigned long *out_len,
+				 cln_fw_flash_cost_t *cost);
+
+err_status_t
+cln_fw_parser_diff(cln_fw_parser_t *parser, cln_fw_parser_t *other,
+		   cln_fw_diff_range_t **out_range, unsigned long *nr_range,
+		   cln_fw_diff_region_t **out_region, unsigned long *nr_region);
+
 /* MFH functions */
 
 unsigned long
 mfh_header_size(void);
+unsigned long
+mfh_size(void *mfh_buf);
 long
 mfh_offset(void);
 err_status_t
@@ -81,6 +163,9 @@ mfh_probe(void *mfh_buf, unsigned long *mfh_buf_len);
 err_status_t
 mfh_show(void *mfh_buf, unsigned long mfh_buf_len);
 err_status_t
+mfh_get_fw_version(void *mfh_buf, unsigned long mfh_buf_len,
+		   uint32_t *fw_version);
+err_status_t
 mfh_show_fw_version(void *mfh_buf, unsigned long mfh_buf_len);
 
 /* Signed key module functions */
@@ -108,49 +193,78 @@ platform_data_item_size(void *pdata_item_buf);
 uint16_t
 platform_data_item_id(void *pdata_item_buf);
 
+const char *
+platform_data_item_desc(void *pdata_item_buf);
+
 void
-platform_data_update_header(void *pdata, void *pdata_item,
-			    unsigned long pdata_item_len);
+platform_data_update_header(platform_data_view_t *view, void *pdata,
+			    void *pdata_item, unsigned long pdata_item_len,
+			    unsigned long nr_pdata_item);
 
 uint32_t
 platform_data_cert_header(void *pdata_item_buf);
 
 err_status_t
-platform_data_probe(void *pdata_buf, unsigned long *pdata_buf_len);
+platform_data_probe(void *pdata_buf, unsigned long pdata_buf_len,
+		    platform_data_view_t *view);
 
 void
-__platform_data_show(void *pdata_buf, unsigned long pdata_buf_len);
+platform_data_view_invalidate(platform_data_view_t *view);
 
 err_status_t
-platform_data_show(void *pdata_buf, unsigned long pdata_buf_len);
+platform_data_view_verify(platform_data_view_t *view);
 
 err_status_t
-platform_data_parse(void *pdata_buf, unsigned long pdata_buf_len,
-		    void **out_pdata_header_buf, void **out_pdata_item_buf,
-		    unsigned long *out_nr_pdata_item);
+platform_data_show(platform_data_view_t *view);
 
 err_status_t
-platform_data_search_item(void *pdata_buf, unsigned long pdata_buf_len,
-			  uint16_t id);
+platform_data_parse(arena_t *arena, platform_data_view_t *view,
+		    void **out_pdata_header_buf, void **out_pdata_item_buf,
+		    unsigned long *out_nr_pdata_item);
 
 err_status_t
-platform_data_create_item(uint16_t id, uint16_t version, const char desc[10],
-			  uint8_t *data, uint16_t data_len, void **out,
+platform_data_create_item(arena_t *arena, uint16_t id, uint16_t version,
+			  const char desc[10], uint8_t *data,
+			  uint16_t data_len, void **out,
 			  unsigned long *out_len);
 
 err_status_t
-platform_data_update_item(void *pdata_item_buf,
+platform_data_update_item(arena_t *arena, void *pdata_item_buf,
 			  unsigned long pdata_item_buf_len,
 			  uint16_t id, uint16_t *version,
 			  const char desc[10], uint8_t *data,
 			  uint16_t data_len, void **out,
 			  unsigned long *out_len);
 
-uint32_t
-crc32(uint8_t *buf, uint32_t size);
-
 /* Capsule functions */
 
+/* The maximum number of extents carried by a capsule */
+#define CAPSULE_MAX_EXTENTS		(CAPSULE_MAX_UPDATE_ENTRIES - 1)
+
+typedef struct {
+	/* Relative to the start of the flash range being updated */
+	unsigned long offset;
+	unsigned long size;
+} capsule_extent_t;
+
+unsigned long
+capsule_header_size(void);
+
+unsigned long
+capsule_update_entry_size(void);
+
+void
+capsule_init_header(void *cap_header_buf, unsigned long payload_len);
+
+void
+capsule_init_update_entry(void *update_entry_buf, uint32_t addr,
+			  uint32_t payload_len);
+
+void
+capsule_init_update_entries(void *update_entry_buf, uint32_t addr,
+			    const capsule_extent_t *extents,
+			    unsigned int nr_extent);
+
 err_status_t
 capsule_create_header(unsigned long payload_len, void **out,
 		      unsigned long *out_len);
@@ -0,0 +1,289 @@
+/*
+ * Erase block aware flash layout planner
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <err_status.h>
+#include <cln_fw.h>
+#include "internal.h"
+#include "layout.h"
+
+/*
+ * NOR flash programs the bits from 1 to 0 only. Writing into the blank
+ * sectors is cheap, whereas setting any bit back to 1 costs erasing and
+ * reprogramming the whole erase block. The planner tracks the sectors
+ * and charges a placement for the erase blocks it dirties on top of the
+ * ones already dirtied.
+ */
+enum {
+	/* All 0xff and claimed by nothing */
+	SECTOR_BLANK,
+	/* The stale contents of an item released */
+	SECTOR_STALE,
+	/* Items, the fixed regions or the data not described by MFH */
+	SECTOR_USED,
+};
+
+struct __layout {
+	uint8_t *fw;
+	unsigned long fw_len;
+	unsigned long erase_block;
+	uint8_t *sector;
+	unsigned long nr_sector;
+	/* The erase blocks to be erased and programmed again */
+	uint8_t *dirty;
+	unsigned long nr_block;
+};
+
+static int
+erased(const uint8_t *p, unsigned long len)
+{
+	while (len--) {
+		if (*p++ != 0xff)
+			return 0;
+	}
+
+	return 1;
+}
+
+err_status_t
+layout_create(uint8_t *fw, unsigned long fw_len, unsigned long erase_block,
+	      layout_t **out)
+{
+	layout_t *l;
+	unsigned long i;
+
+	if (!erase_block)
+		erase_block = LAYOUT_SECTOR_SIZE;
+
+	if (!fw || !out || erase_block % LAYOUT_SECTOR_SIZE
+			|| erase_block & (erase_block - 1))
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	l = eee_malloc(sizeof(*l));
+	if (!l)
+		return CLN_FW_ERR_OUT_OF_MEM;
+
+	l->fw = fw;
+	l->fw_len = fw_len;
+	l->erase_block = erase_block;
+	/* The partial sector at the end is never given out */
+	l->nr_sector = fw_len / LAYOUT_SECTOR_SIZE;
+	l->nr_block = (fw_len + erase_block - 1) / erase_block;
+	l->sector = eee_malloc(l->nr_sector + 1);
+	l->dirty = eee_malloc(l->nr_block + 1);
+	if (!l->sector || !l->dirty) {
+		layout_destroy(l);
+		return CLN_FW_ERR_OUT_OF_MEM;
+	}
+
+	for (i = 0; i < l->nr_sector; ++i)
+		l->sector[i] = erased(fw + i * LAYOUT_SECTOR_SIZE,
+				      LAYOUT_SECTOR_SIZE) ?
+			       SECTOR_BLANK : SECTOR_USED;
+
+	eee_memset(l->dirty, 0, l->nr_block);
+
+	*out = l;
+
+	return CLN_FW_ERR_NONE;
+}
+
+void
+layout_destroy(layout_t *l)
+{
+	if (!l)
+		return;
+
+	eee_mfree(l->dirty);
+	eee_mfree(l->sector);
+	eee_mfree(l);
+}
+
+/* Claim all the sectors touched by the extent */
+void
+layout_reserve(layout_t *l, unsigned long offset, unsigned long len)
+{
+	unsigned long i, end;
+
+	if (!len || offset >= l->fw_len)
+		return;
+
+	end = offset + len;
+	if (end > l->fw_len)
+		end = l->fw_len;
+
+	for (i = offset / LAYOUT_SECTOR_SIZE;
+			i * LAYOUT_SECTOR_SIZE < end && i < l->nr_sector; ++i)
+		l->sector[i] = SECTOR_USED;
+}
+
+/*
+ * Give back the sectors fully covered by the extent. The contents are
+ * left in place unless the erase block is dirtied anyway.
+ */
+void
+layout_release(layout_t *l, unsigned long offset, unsigned long len)
+{
+	unsigned long i, end;
+
+	if (!len || offset >= l->fw_len)
+		return;
+
+	end = offset + len;
+	if (end > l->fw_len)
+		end = l->fw_len;
+
+	for (i = (offset + LAYOUT_SECTOR_SIZE - 1) / LAYOUT_SECTOR_SIZE;
+			(i + 1) * LAYOUT_SECTOR_SIZE <= end; ++i)
+		l->sector[i] = erased(l->fw + i * LAYOUT_SECTOR_SIZE,
+				      LAYOUT_SECTOR_SIZE) ?
+			       SECTOR_BLANK : SECTOR_STALE;
+}
+
+/*
+ * The erase blocks newly dirtied by writing the sectors. A block is
+ * dirtied if any sector written in it is not blank.
+ */
+static unsigned long
+place_cost(layout_t *l, unsigned long first, unsigned long last,
+	   int commit)
+{
+	unsigned long per_block = l->erase_block / LAYOUT_SECTOR_SIZE;
+	unsigned long i, cost = 0;
+
+	for (i = first; i <= last; ++i) {
+		unsigned long block = i / per_block;
+
+		if (l->dirty[block] || l->sector[i] == SECTOR_BLANK)
+			continue;
+
+		++cost;
+		if (commit)
+			l->dirty[block] = 1;
+
+		/* Skip the rest of sectors in the block */
+		i = (block + 1) * per_block - 1;
+	}
+
+	return cost;
+}
+
+/*
+ * Find the extent dirtying the fewest erase blocks. The preferred extent,
+ * typically where the item is replaced in place, wins a tie. Otherwise
+ * the lowest sector aligned extent out of the sectors claimed wins.
+ */
+err_status_t
+layout_place(layout_t *l, unsigned long len, unsigned long prefer,
+	     unsigned long *offset)
+{
+	unsigned long nr = (len + LAYOUT_SECTOR_SIZE - 1) / LAYOUT_SECTOR_SIZE;
+	unsigned long i, run, first, last, cost;
+	unsigned long best = ~0UL, best_cost = ~0UL;
+
+	if (!len || !offset)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	if (prefer != LAYOUT_NO_PREFERENCE) {
+		if (prefer >= l->fw_len || len > l->fw_len - prefer)
+			return CLN_FW_ERR_INVALID_PARAMETER;
+
+		best = prefer;
+		best_cost = place_cost(l, prefer / LAYOUT_SECTOR_SIZE,
+				       (prefer + len - 1) / LAYOUT_SECTOR_SIZE,
+				       0);
+	}
+
+	/* The run of free sectors ending at the sector i */
+	for (i = 0, run = 0; i < l->nr_sector && best_cost; ++i) {
+		run = l->sector[i] == SECTOR_USED ? 0 : run + 1;
+		if (run < nr)
+			continue;
+
+		first = i + 1 - nr;
+		cost = place_cost(l, first, i, 0);
+		if (cost < best_cost) {
+			best = first * LAYOUT_SECTOR_SIZE;
+			best_cost = cost;
+		}
+	}
+
+	if (best == ~0UL)
+		return CLN_FW_ERR_OUT_OF_MEM;
+
+	first = best / LAYOUT_SECTOR_SIZE;
+	last = (best + len - 1) / LAYOUT_SECTOR_SIZE;
+	place_cost(l, first, last, 1);
+	for (i = first; i <= last; ++i)
+		l->sector[i] = SECTOR_USED;
+
+	*offset = best;
+
+	return CLN_FW_ERR_NONE;
+}
+
+/* The stale sectors in the erase blocks dirtied are erased for free */
+void
+layout_finish(layout_t *l)
+{
+	unsigned long per_block = l->erase_block / LAYOUT_SECTOR_SIZE;
+	unsigned long i;
+
+	for (i = 0; i < l->nr_sector; ++i) {
+		if (l->sector[i] != SECTOR_STALE || !l->dirty[i / per_block])
+			continue;
+
+		eee_memset(l->fw + i * LAYOUT_SECTOR_SIZE, 0xff,
+			   LAYOUT_SECTOR_SIZE);
+		l->sector[i] = SECTOR_BLANK;
+	}
+}
+
+/*
+ * Estimate the cost to program the new image over the old one. A block
+ * setting any bit from 0 to 1 is erased and programmed in whole, and
+ * the other blocks only have the bytes changed programmed.
+ */
+void
+layout_cost(const uint8_t *old, const uint8_t *new, unsigned long len,
+	    unsigned long erase_block, cln_fw_flash_cost_t *cost)
+{
+	unsigned long offset, i;
+
+	if (!erase_block)
+		erase_block = LAYOUT_SECTOR_SIZE;
+
+	eee_memset(cost, 0, sizeof(*cost));
+	cost->erase_block = erase_block;
+
+	for (offset = 0; offset < len; offset += erase_block) {
+		unsigned long size = len - offset, changed = 0;
+		int erase = 0;
+
+		if (size > erase_block)
+			size = erase_block;
+
+		for (i = offset; i < offset + size; ++i) {
+			if (new[i] & ~old[i])
+				erase = 1;
+			if (new[i] != old[i])
+				++changed;
+		}
+
+		if (erase) {
+			++cost->nr_erase;
+			for (i = offset; i < offset + size; ++i)
+				cost->program_bytes += new[i] != 0xff;
+		} else if (changed) {
+			++cost->nr_program;
+			cost->program_bytes += changed;
+		}
+	}
+}
@@ -0,0 +1,50 @@
+/*
+ * Erase block aware flash layout planner API
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#ifndef __LAYOUT_H__
+#define __LAYOUT_H__
+
+#include <eee.h>
+#include <err_status.h>
+#include <cln_fw.h>
+
+/* The SPI flash on Quark is erased in 4 KiB sectors at least */
+#define LAYOUT_SECTOR_SIZE		0x1000
+
+/* No extent preferred by layout_place() */
+#define LAYOUT_NO_PREFERENCE		(~0UL)
+
+typedef struct __layout			layout_t;
+
+err_status_t
+layout_create(uint8_t *fw, unsigned long fw_len, unsigned long erase_block,
+	      layout_t **out);
+
+void
+layout_destroy(layout_t *layout);
+
+void
+layout_reserve(layout_t *layout, unsigned long offset, unsigned long len);
+
+void
+layout_release(layout_t *layout, unsigned long offset, unsigned long len);
+
+err_status_t
+layout_place(layout_t *layout, unsigned long len, unsigned long prefer,
+	     unsigned long *offset);
+
+void
+layout_finish(layout_t *layout);
+
+void
+layout_cost(const uint8_t *old, const uint8_t *new, unsigned long len,
+	    unsigned long erase_block, cln_fw_flash_cost_t *cost);
+
+#endif	/* __LAYOUT_H__ */
@@ -10,6 +10,10 @@
 
 #include <eee.h>
 #include <cln_fw.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <errno.h>
+#include "stats.h"
 
 int
 read_phys_mem(const char *file_path, uint8_t **out, unsigned long size,
@@ -60,8 +64,8 @@ err:
 	return ret;
 }
 
-int
-load_file(const char *file_path, uint8_t **out, unsigned long *out_len)
+static int
+__load_file(const char *file_path, uint8_t **out, unsigned long *out_len)
 {
 	FILE *fp;
 	uint8_t *buf;
@@ -115,7 +119,126 @@ err:
 }
 
 int
-save_output_file(const char *file_path, uint8_t *buf, unsigned long size)
+load_file(const char *file_path, uint8_t **out, unsigned long *out_len)
+{
+	uint64_t start = stats_timer_start();
+	int ret;
+
+	ret = __load_file(file_path, out, out_len);
+	stats_timer_stop(CLN_FW_STAT_LOAD_FILE, start);
+
+	return ret;
+}
+
+int
+map_file(const char *file_path, uint8_t **out, unsigned long *out_len,
+	 int *out_fd)
+{
+	int fd;
+	struct stat st;
+	void *buf;
+	int ret;
+
+	if (!file_path || !out || !out_len) {
+		err(T("Invalid parameters specified\n"));
+		return -1;
+	}
+
+	dbg(T("Mapping file %s ...\n"), file_path);
+
+	fd = open(file_path, O_RDONLY | O_LARGEFILE);
+	if (fd < 0) {
+		err(T("Failed to open file %s.\n"), file_path);
+		return -1;
+	}
+
+	if (fstat(fd, &st)) {
+		ret = -1;
+		err(T("Failed to stat file.\n"));
+		goto err;
+	}
+
+	if (!st.st_size) {
+		ret = -1;
+		err(T("Empty file.\n"));
+		goto err;
+	}
+
+	/*
+	 * The mapping is private and read-only. The parser never writes
+	 * into the firmware buffer and the pages are only faulted in when
+	 * the parser touches the windows it needs.
+	 */
+	buf = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED) {
+		ret = -1;
+		err(T("Failed to map file.\n"));
+		goto err;
+	}
+
+	*out = buf;
+	*out_len = st.st_size;
+
+	/* Keep the file open if the caller wants to copy extents from it */
+	if (out_fd) {
+		*out_fd = fd;
+		return 0;
+	}
+
+	ret = 0;
+
+err:
+	close(fd);
+
+	return ret;
+}
+
+/* Open the file to be read through pread() on demand */
+int
+open_input_file(const char *file_path, unsigned long *out_len)
+{
+	int fd;
+	struct stat st;
+
+	if (!file_path || !out_len) {
+		err(T("Invalid parameters specified\n"));
+		return -1;
+	}
+
+	dbg(T("Opening file %s ...\n"), file_path);
+
+	fd = open(file_path, O_RDONLY | O_LARGEFILE);
+	if (fd < 0) {
+		err(T("Failed to open file %s.\n"), file_path);
+		return -1;
+	}
+
+	if (fstat(fd, &st)) {
+		err(T("Failed to stat file.\n"));
+		close(fd);
+		return -1;
+	}
+
+	if (!st.st_size) {
+		err(T("Empty file.\n"));
+		close(fd);
+		return -1;
+	}
+
+	*out_len = st.st_size;
+
+	return fd;
+}
+
+void
+unmap_file(uint8_t *buf, unsigned long len)
+{
+	if (buf)
+		munmap(buf, (size_t)len);
+}
+
+static int
+__save_output_file(const char *file_path, uint8_t *buf, unsigned long size)
 {
 	FILE *fp;
 
@@ -138,6 +261,256 @@ save_output_file(const char *file_path, uint8_t *buf, unsigned long size)
 	return 0;
 }
 
+int
+save_output_file(const char *file_path, uint8_t *buf, unsigned long size)
+{
+	uint64_t start = stats_timer_start();
+	int ret;
+
+	ret = __save_output_file(file_path, buf, size);
+	stats_timer_stop(CLN_FW_STAT_SAVE_FILE, start);
+
+	return ret;
+}
+
+int
+open_output_file(const char *file_path)
+{
+	int fd;
+
+	dbg(T("Creating output file %s ...\n"), file_path);
+
+	fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0666);
+	if (fd < 0)
+		err(T("Failed to create output file.\n"));
+
+	return fd;
+}
+
+/*
+ * The file an output path ends up in. A symlink is followed so that the
+ * file it points to is replaced rather than the symlink itself.
+ */
+static char *
+resolve_output_path(const char *file_path)
+{
+	char *path;
+
+	path = realpath(file_path, NULL);
+	if (!path)
+		path = strdup(file_path);
+	if (!path)
+		err(T("Failed to allocate the output file name\n"));
+
+	return path;
+}
+
+/*
+ * Create a temporary file next to the output file so that the output
+ * file is only replaced by close_output_tmp_file() once everything is
+ * written. The temporary file takes the mode of an existing output
+ * file. The output being a device or pipe is opened in place and
+ * *tmp_path is NULL then.
+ */
+int
+open_output_tmp_file(const char *file_path, char **tmp_path)
+{
+	static unsigned long seq;
+	struct stat st;
+	char *path;
+	int fd, exist;
+
+	*tmp_path = NULL;
+
+	path = resolve_output_path(file_path);
+	if (!path)
+		return -1;
+
+	exist = !stat(path, &st);
+	if (exist && !S_ISREG(st.st_mode)) {
+		free(path);
+		return open_output_file(file_path);
+	}
+
+	do {
+		free(*tmp_path);
+		if (asprintf(tmp_path, "%s.tmp.%d.%lu", path, getpid(),
+			     __atomic_fetch_add(&seq, 1,
+						__ATOMIC_RELAXED)) < 0) {
+			*tmp_path = NULL;
+			err(T("Failed to allocate the temporary file name\n"));
+			free(path);
+			return -1;
+		}
+
+		dbg(T("Creating temporary output file %s ...\n"), *tmp_path);
+
+		fd = open(*tmp_path, O_WRONLY | O_CREAT | O_EXCL |
+			  O_LARGEFILE, 0666);
+	} while (fd < 0 && errno == EEXIST);
+
+	free(path);
+
+	if (fd >= 0 && exist && fchmod(fd, st.st_mode & 07777)) {
+		close(fd);
+		unlink(*tmp_path);
+		fd = -1;
+	}
+
+	if (fd < 0) {
+		err(T("Failed to create output file.\n"));
+		free(*tmp_path);
+		*tmp_path = NULL;
+	}
+
+	return fd;
+}
+
+/*
+ * Close the file opened by open_output_tmp_file(). The temporary file
+ * replaces the output file unless failed is set or closing fails, in
+ * which case it is removed and the output file is left untouched.
+ */
+int
+close_output_tmp_file(int fd, char *tmp_path, const char *file_path,
+		      int failed)
+{
+	char *path;
+
+	if (close(fd))
+		failed = 1;
+
+	if (!tmp_path)
+		return failed ? -1 : 0;
+
+	if (!failed) {
+		path = resolve_output_path(file_path);
+		if (!path || rename(tmp_path, path)) {
+			err(T("Failed to rename the output file.\n"));
+			failed = 1;
+		}
+
+		free(path);
+	}
+
+	if (failed)
+		unlink(tmp_path);
+
+	free(tmp_path);
+
+	return failed ? -1 : 0;
+}
+
+int
+write_buffer(int fd, const void *buf, unsigned long size)
+{
+	while (size) {
+		ssize_t len;
+
+		len = write(fd, buf, size);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+
+			err(T("Failed to write output file.\n"));
+			return -1;
+		}
+
+		buf += len;
+		size -= len;
+	}
+
+	return 0;
+}
+
+/* The iovec array is consumed in place on partial writes */
+int
+write_vector(int fd, struct iovec *iov, int nr_iov)
+{
+	while (nr_iov) {
+		ssize_t len;
+
+		len = writev(fd, iov, nr_iov);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+
+			err(T("Failed to write output file.\n"));
+			return -1;
+		}
+
+		while (nr_iov && (size_t)len >= iov->iov_len) {
+			len -= iov->iov_len;
+			++iov;
+			--nr_iov;
+		}
+
+		if (nr_iov) {
+			iov->iov_base += len;
+			iov->iov_len -= len;
+		}
+	}
+
+	return 0;
+}
+
+int
+write_file_extent(int out_fd, int in_fd, const void *in_buf,
+		  unsigned long offset, unsigned long size)
+{
+	loff_t in_off = offset;
+	ssize_t len;
+
+	if (!size)
+		return 0;
+
+	if (in_fd < 0)
+		goto fallback_write;
+
+	/*
+	 * Let the kernel move the bytes without passing them through
+	 * user space. copy_file_range() may reflink the extent on the
+	 * file systems supporting it. sendfile() covers the cases where
+	 * the output is not a regular file.
+	 */
+	while (size) {
+		len = copy_file_range(in_fd, &in_off, out_fd, NULL, size, 0);
+		if (len <= 0)
+			break;
+
+		size -= len;
+	}
+
+	while (size) {
+		off_t off = in_off;
+
+		len = sendfile(out_fd, in_fd, &off, size);
+		if (len <= 0)
+			break;
+
+		in_off = off;
+		size -= len;
+	}
+
+	/* Copy through user space without touching the input buffer */
+	while (size) {
+		uint8_t buf[64 * 1024];
+
+		len = pread(in_fd, buf, size < sizeof(buf) ? size : sizeof(buf),
+			    in_off);
+		if (len <= 0 || write_buffer(out_fd, buf, len))
+			return -1;
+
+		in_off += len;
+		size -= len;
+	}
+
+	return 0;
+
+fallback_write:
+	return write_buffer(out_fd, in_buf + offset, size);
+}
+
 size_t
 eee_strlen(const char *s)
 {
@@ -174,6 +547,12 @@ eee_memcpy(void *dst, const void *src, unsigned long size)
 	return memcpy(dst, src, (size_t)size);
 }
 
+void *
+eee_memmove(void *dst, const void *src, unsigned long size)
+{
+	return memmove(dst, src, (size_t)size);
+}
+
 void *
 eee_memset(void *s, int c, unsigned long n)
 {
@@ -183,6 +562,8 @@ eee_memset(void *s, int c, unsigned long n)
 void *
 eee_malloc(unsigned long size)
 {
+	stats_count_alloc(size);
+
 	return malloc((size_t)size);
 }
 
@@ -0,0 +1,1048 @@
+/*
+ * Bulk firmware image loader
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <err_status.h>
+#include <cln_fw.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+/* Defined by linux/fs.h as well */
+#undef BLOCK_SIZE
+#endif
+#include "internal.h"
+#include "skm.h"
+#include "thread_pool.h"
+#include "window.h"
+
+#define LOADER_DEFAULT_QUEUE_DEPTH	32
+#define LOADER_MAX_QUEUE_DEPTH		1024
+/* The number of threads loading the images without io_uring */
+#define LOADER_MAX_THREADS		64
+
+typedef struct {
+	const char **path;
+	unsigned long nr_path;
+	unsigned int queue_depth;
+	unsigned long mem_cap;
+	cln_fw_loader_fn_t fn;
+	/* Hand the images over as the handles rather than the buffers */
+	cln_fw_opener_fn_t open_fn;
+	void *data;
+	/* The bytes of the buffers held by the slots or threads */
+	unsigned long mem_used;
+	/* The next image to be loaded */
+	unsigned long next;
+	/* Protect mem_used for the thread pool */
+	pthread_mutex_t lock;
+	pthread_cond_t mem_cond;
+} loader_t;
+
+/*
+ * An image is buffered only if it fits in the cap, or if nothing else is
+ * buffered so that an image larger than the cap is still loaded.
+ */
+static int
+mem_admit(loader_t *ld, unsigned long len)
+{
+	return !ld->mem_cap || !ld->mem_used
+	       || ld->mem_used + len <= ld->mem_cap;
+}
+
+static void
+report(loader_t *ld, unsigned long index, void *fw, unsigned long fw_len,
+       err_status_t status)
+{
+	ld->fn(ld->data, index, ld->path[index], fw, fw_len, status);
+}
+
+static void
+report_handle(loader_t *ld, unsigned long index, cln_fw_handle_t handle,
+	      err_status_t status)
+{
+	ld->open_fn(ld->data, index, ld->path[index], handle, status);
+	cln_fw_handle_close(handle);
+}
+
+static void
+report_error(loader_t *ld, unsigned long index, err_status_t status)
+{
+	if (ld->open_fn)
+		report_handle(ld, index, NULL, status);
+	else
+		report(ld, index, NULL, 0, status);
+}
+
+#ifdef __NR_io_uring_setup
+
+enum {
+	SLOT_FREE,
+	/* Opening and sizing the file */
+	SLOT_OPEN,
+	/* Waiting for the memory to buffer the image */
+	SLOT_MEM,
+	SLOT_READ,
+	SLOT_CLOSE,
+};
+
+typedef struct {
+	unsigned long offset;
+	unsigned long len;
+} uring_extent_t;
+
+#define URING_MAX_EXTENT		2
+
+/*
+ * Only the windows parsed for a handle are read ahead, i.e, the MFH room
+ * followed by the platform data, and the SKM. Any other extent is read
+ * on demand through the window. The windows beyond an image too small
+ * are skipped and left to the parser to reject.
+ */
+static unsigned int
+handle_windows(unsigned long fw_len, uring_extent_t *ext)
+{
+	long offset[URING_MAX_EXTENT] = { mfh_offset(), skm_offset() };
+	unsigned long len[URING_MAX_EXTENT] = {
+		platform_data_offset() - mfh_offset()
+		+ platform_data_max_size(),
+		skm_size(),
+	};
+	unsigned int i, nr;
+
+	for (i = 0, nr = 0; i < URING_MAX_EXTENT; ++i) {
+		if (fw_len < (unsigned long)-offset[i])
+			continue;
+
+		ext[nr].offset = fw_len + offset[i];
+		ext[nr].len = len[i];
+		++nr;
+	}
+
+	return nr;
+}
+
+typedef struct {
+	uint8_t *buf;
+	uring_extent_t ext;
+	unsigned long done;
+} uring_read_t;
+
+typedef struct {
+	int stage;
+	unsigned long index;
+	int fd;
+	/* The operations in flight */
+	int nr_op;
+	err_status_t status;
+	struct statx stx;
+	/*
+	 * The buffer is recycled for the following images, sparing the
+	 * page faults of a fresh allocation per image.
+	 */
+	uint8_t *buf;
+	unsigned long buf_size;
+	/* The bytes to be buffered */
+	unsigned long len;
+	/* The window read ahead for a handle */
+	bs_source_t *window;
+	/* The extents read in parallel */
+	uring_read_t read[URING_MAX_EXTENT];
+	unsigned int nr_read;
+} uring_slot_t;
+
+typedef struct {
+	int fd;
+	void *sq_ring;
+	unsigned long sq_ring_len;
+	void *cq_ring;
+	unsigned long cq_ring_len;
+	struct io_uring_sqe *sqes;
+	unsigned long sqes_len;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	/* The SQEs queued but not submitted yet */
+	unsigned int nr_queued;
+	uring_slot_t *slot;
+	unsigned int nr_slot;
+	unsigned long nr_active;
+	/* The slots in SLOT_MEM */
+	unsigned int nr_mem_wait;
+} uring_t;
+
+#define URING_DATA(slot, op)		(((uint64_t)(slot) << 16) | (op))
+#define URING_DATA_SLOT(data)		((data) >> 16)
+#define URING_DATA_OP(data)		((data) & 0xff)
+/* The extent of a read */
+#define URING_DATA_READ(data)		(((data) >> 8) & 0xff)
+
+static int
+uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+uring_enter(int fd, unsigned int to_submit, unsigned int min_complete)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			    IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+/* Check the operations used are all supported by the kernel */
+static int
+uring_probe(int fd)
+{
+	static const uint8_t ops[] = {
+		IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ,
+		IORING_OP_CLOSE,
+	};
+	struct io_uring_probe *probe;
+	unsigned int i, nr = IORING_OP_LAST;
+	int ret = -1;
+
+	probe = eee_malloc(sizeof(*probe) + nr * sizeof(probe->ops[0]));
+	if (!probe)
+		return -1;
+
+	eee_memset(probe, 0, sizeof(*probe) + nr * sizeof(probe->ops[0]));
+
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe,
+		    nr) < 0)
+		goto out;
+
+	for (i = 0; i < sizeof(ops) / sizeof(ops[0]); ++i) {
+		if (ops[i] > probe->last_op
+				|| !(probe->ops[ops[i]].flags
+				     & IO_URING_OP_SUPPORTED))
+			goto out;
+	}
+
+	ret = 0;
+
+out:
+	eee_mfree(probe);
+
+	return ret;
+}
+
+static void
+uring_destroy(uring_t *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_len);
+	if (ring->sq_ring)
+		munmap(ring->sq_ring, ring->sq_ring_len);
+	if (ring->fd >= 0)
+		close(ring->fd);
+	if (ring->slot) {
+		unsigned int i;
+
+		for (i = 0; i < ring->nr_slot; ++i)
+			eee_mfree(ring->slot[i].buf);
+		eee_mfree(ring->slot);
+	}
+}
+
+static int
+uring_init(uring_t *ring, unsigned int queue_depth)
+{
+	struct io_uring_params p;
+	void *ptr;
+
+	eee_memset(ring, 0, sizeof(*ring));
+
+	eee_memset(&p, 0, sizeof(p));
+	/* Each slot has at most two operations in flight */
+	ring->fd = uring_setup(queue_depth * 2, &p);
+	if (ring->fd < 0)
+		return -1;
+
+	if (uring_probe(ring->fd))
+		goto err;
+
+	ring->sq_ring_len = p.sq_off.array
+			    + p.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_len = p.cq_off.cqes
+			    + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_len > ring->sq_ring_len)
+			ring->sq_ring_len = ring->cq_ring_len;
+		ring->cq_ring_len = ring->sq_ring_len;
+	}
+
+	ptr = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED)
+		goto err;
+	ring->sq_ring = ptr;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cq_ring = ring->sq_ring;
+	else {
+		ptr = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ring->fd,
+			   IORING_OFF_CQ_RING);
+		if (ptr == MAP_FAILED)
+			goto err;
+		ring->cq_ring = ptr;
+	}
+
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ptr = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ptr == MAP_FAILED)
+		goto err;
+	ring->sqes = ptr;
+
+	ring->sq_tail = ring->sq_ring + p.sq_off.tail;
+	ring->sq_mask = ring->sq_ring + p.sq_off.ring_mask;
+	ring->sq_array = ring->sq_ring + p.sq_off.array;
+	ring->cq_head = ring->cq_ring + p.cq_off.head;
+	ring->cq_tail = ring->cq_ring + p.cq_off.tail;
+	ring->cq_mask = ring->cq_ring + p.cq_off.ring_mask;
+	ring->cqes = ring->cq_ring + p.cq_off.cqes;
+
+	ring->slot = eee_malloc(queue_depth * sizeof(*ring->slot));
+	if (!ring->slot)
+		goto err;
+
+	eee_memset(ring->slot, 0, queue_depth * sizeof(*ring->slot));
+	ring->nr_slot = queue_depth;
+
+	return 0;
+
+err:
+	uring_destroy(ring);
+
+	return -1;
+}
+
+/* The ring never overflows because it has two entries per slot */
+static struct io_uring_sqe *
+uring_get_sqe(uring_t *ring, unsigned long slot, int op)
+{
+	unsigned int tail = *ring->sq_tail + ring->nr_queued;
+	unsigned int idx = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = ring->sqes + idx;
+
+	eee_memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->user_data = URING_DATA(slot, op);
+	ring->sq_array[idx] = idx;
+	++ring->nr_queued;
+	++ring->slot[slot].nr_op;
+
+	return sqe;
+}
+
+static int
+uring_submit_and_wait(uring_t *ring)
+{
+	unsigned int nr = ring->nr_queued;
+	int ret;
+
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + nr, __ATOMIC_RELEASE);
+	ring->nr_queued = 0;
+
+	do {
+		ret = uring_enter(ring->fd, nr, 1);
+		if (ret >= 0) {
+			nr -= ret;
+			continue;
+		}
+
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			return -1;
+	} while (nr);
+
+	return 0;
+}
+
+static void
+uring_open(uring_t *ring, loader_t *ld, unsigned long slot)
+{
+	uring_slot_t *s = ring->slot + slot;
+	const char *path;
+	struct io_uring_sqe *sqe;
+
+	s->index = ld->next++;
+	s->stage = SLOT_OPEN;
+	s->fd = -1;
+	s->nr_op = 0;
+	s->status = CLN_FW_ERR_NONE;
+	s->len = 0;
+	s->nr_read = 0;
+	++ring->nr_active;
+
+	path = ld->path[s->index];
+
+	dbg(T("Opening file %s ...\n"), path);
+
+	/* The file is opened and sized at once */
+	sqe = uring_get_sqe(ring, slot, IORING_OP_OPENAT);
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (unsigned long)path;
+	sqe->open_flags = O_RDONLY | O_LARGEFILE;
+
+	sqe = uring_get_sqe(ring, slot, IORING_OP_STATX);
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (unsigned long)path;
+	sqe->len = STATX_SIZE;
+	sqe->off = (unsigned long)&s->stx;
+}
+
+static void
+uring_read(uring_t *ring, unsigned long slot, unsigned int i)
+{
+	uring_slot_t *s = ring->slot + slot;
+	uring_read_t *r = s->read + i;
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_get_sqe(ring, slot, IORING_OP_READ);
+	sqe->user_data |= (uint64_t)i << 8;
+	sqe->fd = s->fd;
+	sqe->addr = (unsigned long)(r->buf + r->done);
+	sqe->len = r->ext.len - r->done;
+	sqe->off = r->ext.offset + r->done;
+}
+
+static void
+uring_free_buffer(uring_t *ring, loader_t *ld, unsigned long slot)
+{
+	uring_slot_t *s = ring->slot + slot;
+
+	eee_mfree(s->buf);
+	ld->mem_used -= s->buf_size;
+	s->buf = NULL;
+	s->buf_size = 0;
+}
+
+static void
+uring_release(uring_t *ring, loader_t *ld, unsigned long slot)
+{
+	uring_slot_t *s = ring->slot + slot;
+
+	s->stage = SLOT_FREE;
+	--ring->nr_active;
+
+	if (ld->next < ld->nr_path)
+		uring_open(ring, ld, slot);
+	else
+		uring_free_buffer(ring, ld, slot);
+}
+
+static void
+uring_buffer(uring_t *ring, loader_t *ld, unsigned long slot);
+
+/*
+ * Pass the buffer to a slot waiting for the memory, or release it if
+ * none of them fits in, so that the waiting slots are not starved by
+ * the slots recycling their buffers.
+ */
+static void
+uring_hand_over(uring_t *ring, loader_t *ld, unsigned long slot)
+{
+	uring_slot_t *s = ring->slot + slot;
+	unsigned int i;
+
+	for (i = 0; i < ring->nr_slot; ++i) {
+		uring_slot_t *w = ring->slot + i;
+
+		if (w->stage != SLOT_MEM || w->len > s->buf_size)
+			continue;
+
+		w->buf = s->buf;
+		w->buf_size = s->buf_size;
+		s->buf = NULL;
+		s->buf_size = 0;
+		uring_buffer(ring, ld, i);
+		return;
+	}
+
+	uring_free_buffer(ring, ld, slot);
+}
+
+/* Open the handle on the window read ahead and report it */
+static void
+uring_report_handle(uring_t *ring, loader_t *ld, unsigned long slot)
+{
+	uring_slot_t *s = ring->slot + slot;
+	cln_fw_handle_t handle = NULL;
+	unsigned int i;
+
+	if (!s->window) {
+		report_handle(ld, s->index, NULL, s->status);
+		return;
+	}
+
+	for (i = 0; i < s->nr_read; ++i)
+		window_fill_end(s->window, s->read[i].ext.offset,
+				s->read[i].ext.len);
+
+	if (!is_err_status(s->status)) {
+		/* The handle takes over the window and file */
+		s->status = handle_open_window(&handle, s->window, s->fd);
+		s->fd = -1;
+	} else
+		s->window->release(s->window);
+
+	s->window = NULL;
+
+	report_handle(ld, s->index, handle, s->status);
+	ld->mem_used -= s->len;
+}
+
+/* Report the image and close the file */
+static void
+uring_finish(uring_t *ring, loader_t *ld, unsigned long slot)
+{
+	uring_slot_t *s = ring->slot + slot;
+	struct io_uring_sqe *sqe;
+
+	if (ld->open_fn)
+		uring_report_handle(ring, ld, slot);
+	else if (is_err_status(s->status))
+		report(ld, s->index, NULL, 0, s->status);
+	else
+		report(ld, s->index, s->buf, s->len, s->status);
+
+	if (s->fd >= 0) {
+		sqe = uring_get_sqe(ring, slot, IORING_OP_CLOSE);
+		sqe->fd = s->fd;
+		s->fd = -1;
+		s->stage = SLOT_CLOSE;
+	}
+
+	if (ring->nr_mem_wait)
+		uring_hand_over(ring, ld, slot);
+
+	if (s->stage != SLOT_CLOSE)
+		uring_release(ring, ld, slot);
+}
+
+/* Read the windows ahead into a window on the file */
+static void
+uring_window(uring_t *ring, loader_t *ld, unsigned long slot)
+{
+	uring_slot_t *s = ring->slot + slot;
+	unsigned int i;
+
+	if (!mem_admit(ld, s->len)) {
+		s->stage = SLOT_MEM;
+		++ring->nr_mem_wait;
+		return;
+	}
+
+	s->status = window_open_fd(s->fd, s->stx.stx_size, &s->window);
+	if (is_err_status(s->status)) {
+		uring_finish(ring, ld, slot);
+		return;
+	}
+
+	ld->mem_used += s->len;
+
+	for (i = 0; i < s->nr_read; ++i) {
+		uring_read_t *r = s->read + i;
+
+		r->buf = window_fill_begin(s->window, &r->ext.offset,
+					   &r->ext.len);
+		if (!r->buf) {
+			s->nr_read = i;
+			s->status = CLN_FW_ERR_IO;
+			uring_finish(ring, ld, slot);
+			return;
+		}
+	}
+
+	s->stage = SLOT_READ;
+	for (i = 0; i < s->nr_read; ++i)
+		uring_read(ring, slot, i);
+
+	if (!s->nr_read)
+		uring_finish(ring, ld, slot);
+}
+
+static void
+uring_buffer(uring_t *ring, loader_t *ld, unsigned long slot)
+{
+	uring_slot_t *s = ring->slot + slot;
+
+	if (s->stage == SLOT_MEM)
+		--ring->nr_mem_wait;
+
+	if (ld->open_fn) {
+		uring_window(ring, ld, slot);
+		return;
+	}
+
+	if (s->len > s->buf_size) {
+		uring_free_buffer(ring, ld, slot);
+
+		if (!mem_admit(ld, s->len)) {
+			s->stage = SLOT_MEM;
+			++ring->nr_mem_wait;
+			return;
+		}
+
+		s->buf = eee_malloc(s->len);
+		if (!s->buf) {
+			err(T("Failed to allocate memory for file.\n"));
+			s->status = CLN_FW_ERR_OUT_OF_MEM;
+			uring_finish(ring, ld, slot);
+			return;
+		}
+
+		s->buf_size = s->len;
+		ld->mem_used += s->len;
+	}
+
+	s->read[0].buf = s->buf;
+	s->read[0].ext.offset = 0;
+	s->read[0].ext.len = s->len;
+	s->read[0].done = 0;
+	s->nr_read = 1;
+
+	s->stage = SLOT_READ;
+	uring_read(ring, slot, 0);
+}
+
+static void
+uring_complete(uring_t *ring, loader_t *ld, struct io_uring_cqe *cqe)
+{
+	unsigned long slot = URING_DATA_SLOT(cqe->user_data);
+	uring_slot_t *s = ring->slot + slot;
+	const char *path = ld->path[s->index];
+	int res = cqe->res;
+
+	--s->nr_op;
+
+	switch (URING_DATA_OP(cqe->user_data)) {
+	case IORING_OP_OPENAT:
+		if (res < 0) {
+			err(T("Failed to open file %s.\n"), path);
+			s->status = CLN_FW_ERR_IO;
+		} else
+			s->fd = res;
+		break;
+	case IORING_OP_STATX:
+		if (res < 0) {
+			if (!is_err_status(s->status))
+				err(T("Failed to stat file %s.\n"), path);
+			s->status = CLN_FW_ERR_IO;
+		} else if (!s->stx.stx_size) {
+			err(T("Empty file %s.\n"), path);
+			s->status = CLN_FW_ERR_IO;
+		} else if (ld->open_fn) {
+			uring_extent_t ext[URING_MAX_EXTENT];
+			unsigned int i;
+
+			s->nr_read = handle_windows(s->stx.stx_size, ext);
+			for (i = 0; i < s->nr_read; ++i) {
+				s->read[i].ext = ext[i];
+				s->read[i].done = 0;
+				s->len += ext[i].len;
+			}
+		} else
+			s->len = s->stx.stx_size;
+		break;
+	case IORING_OP_READ: {
+		unsigned int i = URING_DATA_READ(cqe->user_data);
+		uring_read_t *r = s->read + i;
+
+		if (res == -EINTR || res == -EAGAIN) {
+			uring_read(ring, slot, i);
+			return;
+		}
+
+		if (res <= 0) {
+			if (!is_err_status(s->status))
+				err(T("Failed to read file %s.\n"), path);
+			s->status = CLN_FW_ERR_IO;
+		} else
+			r->done += res;
+
+		if (!is_err_status(s->status) && r->done < r->ext.len)
+			uring_read(ring, slot, i);
+		else if (!s->nr_op)
+			uring_finish(ring, ld, slot);
+		return;
+	}
+	case IORING_OP_CLOSE:
+		uring_release(ring, ld, slot);
+		return;
+	}
+
+	/* Both the open and statx are done */
+	if (s->nr_op)
+		return;
+
+	if (is_err_status(s->status))
+		uring_finish(ring, ld, slot);
+	else
+		uring_buffer(ring, ld, slot);
+}
+
+/*
+ * Give up the ring if it is broken. The images in flight are reported as
+ * failed, and the rest are left to the thread pool.
+ */
+static void
+uring_abort(uring_t *ring, loader_t *ld)
+{
+	unsigned int i, nr_busy = 0;
+
+	for (i = 0; i < ring->nr_slot; ++i) {
+		uring_slot_t *s = ring->slot + i;
+
+		if (s->stage == SLOT_FREE)
+			continue;
+
+		/* Reported already */
+		if (s->stage != SLOT_CLOSE)
+			report_error(ld, s->index, CLN_FW_ERR_IO);
+
+		if (s->fd >= 0)
+			close(s->fd);
+
+		if (s->nr_op) {
+			s->buf = NULL;
+			s->window = NULL;
+			++nr_busy;
+		} else if (s->window)
+			s->window->release(s->window);
+	}
+
+	/*
+	 * The operations in flight may still write to the buffers and
+	 * slots, which are leaked rather than freed.
+	 */
+	if (nr_busy) {
+		for (i = 0; i < ring->nr_slot; ++i)
+			eee_mfree(ring->slot[i].buf);
+		ring->slot = NULL;
+	}
+
+	ld->mem_used = 0;
+}
+
+static int
+load_uring(loader_t *ld)
+{
+	uring_t ring;
+	unsigned long i;
+
+	if (uring_init(&ring, ld->queue_depth))
+		return -1;
+
+	dbg(T("Loading %ld image(s) through io_uring with queue depth %d\n"),
+	    ld->nr_path, ld->queue_depth);
+
+	for (i = 0; i < ld->queue_depth && ld->next < ld->nr_path; ++i)
+		uring_open(&ring, ld, i);
+
+	while (ring.nr_active) {
+		unsigned int head, tail;
+
+		if (uring_submit_and_wait(&ring)) {
+			/* Never happens unless the ring is broken */
+			err(T("Failed to submit the loads\n"));
+			uring_abort(&ring, ld);
+			uring_destroy(&ring);
+			return -1;
+		}
+
+		head = *ring.cq_head;
+		tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail) {
+			uring_complete(&ring, ld,
+				       ring.cqes + (head & *ring.cq_mask));
+			++head;
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+		/* Retry the slots waiting for the memory released */
+		for (i = 0; i < ld->queue_depth; ++i) {
+			if (ring.slot[i].stage == SLOT_MEM)
+				uring_buffer(&ring, ld, i);
+		}
+	}
+
+	uring_destroy(&ring);
+
+	return 0;
+}
+
+#else
+
+static int
+load_uring(loader_t *ld)
+{
+	return -1;
+}
+
+#endif	/* __NR_io_uring_setup */
+
+static int
+pool_read(int fd, uint8_t *buf, unsigned long len)
+{
+	unsigned long done;
+
+	for (done = 0; done < len; ) {
+		ssize_t ret;
+
+		ret = pread(fd, buf + done, len - done, (off_t)done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0)
+			return -1;
+
+		done += ret;
+	}
+
+	return 0;
+}
+
+/* Like a slot of io_uring, each thread recycles its buffer */
+typedef struct {
+	uint8_t *buf;
+	unsigned long buf_size;
+} pool_buffer_t;
+
+static void
+pool_free_buffer(loader_t *ld, pool_buffer_t *b)
+{
+	pthread_mutex_lock(&ld->lock);
+	ld->mem_used -= b->buf_size;
+	pthread_cond_broadcast(&ld->mem_cond);
+	pthread_mutex_unlock(&ld->lock);
+
+	eee_mfree(b->buf);
+	b->buf = NULL;
+	b->buf_size = 0;
+}
+
+static err_status_t
+pool_get_buffer(loader_t *ld, pool_buffer_t *b, unsigned long len)
+{
+	if (len <= b->buf_size)
+		return CLN_FW_ERR_NONE;
+
+	pool_free_buffer(ld, b);
+
+	pthread_mutex_lock(&ld->lock);
+	while (!mem_admit(ld, len))
+		pthread_cond_wait(&ld->mem_cond, &ld->lock);
+	ld->mem_used += len;
+	pthread_mutex_unlock(&ld->lock);
+
+	b->buf = eee_malloc(len);
+	if (!b->buf) {
+		pthread_mutex_lock(&ld->lock);
+		ld->mem_used -= len;
+		pthread_cond_broadcast(&ld->mem_cond);
+		pthread_mutex_unlock(&ld->lock);
+
+		err(T("Failed to allocate memory for file.\n"));
+		return CLN_FW_ERR_OUT_OF_MEM;
+	}
+
+	b->buf_size = len;
+
+	return CLN_FW_ERR_NONE;
+}
+
+static void
+pool_load(loader_t *ld, unsigned long index, pool_buffer_t *b)
+{
+	unsigned long len;
+	err_status_t status;
+	int fd;
+
+	/* The windows are read on demand rather than ahead */
+	if (ld->open_fn) {
+		cln_fw_handle_t handle = NULL;
+
+		status = cln_fw_handle_open_file_lazy(&handle,
+						      ld->path[index]);
+		report_handle(ld, index, handle, status);
+		return;
+	}
+
+	fd = open_input_file(ld->path[index], &len);
+	if (fd < 0) {
+		report(ld, index, NULL, 0, CLN_FW_ERR_IO);
+		return;
+	}
+
+	status = pool_get_buffer(ld, b, len);
+	if (!is_err_status(status) && pool_read(fd, b->buf, len)) {
+		err(T("Failed to read file %s.\n"), ld->path[index]);
+		status = CLN_FW_ERR_IO;
+	}
+
+	close(fd);
+
+	if (is_err_status(status))
+		report_error(ld, index, status);
+	else
+		report(ld, index, b->buf, len, status);
+}
+
+static void
+pool_worker(void *arg)
+{
+	loader_t *ld = arg;
+	pool_buffer_t b = { NULL, 0 };
+	unsigned long i;
+
+	while ((i = __sync_fetch_and_add(&ld->next, 1)) < ld->nr_path)
+		pool_load(ld, i, &b);
+
+	pool_free_buffer(ld, &b);
+}
+
+static err_status_t
+load_pool(loader_t *ld)
+{
+	thread_pool_t *pool;
+	unsigned int i, nr_thread;
+	err_status_t err;
+
+	/* Nothing is left by io_uring */
+	if (ld->next >= ld->nr_path)
+		return CLN_FW_ERR_NONE;
+
+	nr_thread = ld->queue_depth;
+	if (nr_thread > LOADER_MAX_THREADS)
+		nr_thread = LOADER_MAX_THREADS;
+	if (nr_thread > ld->nr_path - ld->next)
+		nr_thread = ld->nr_path - ld->next;
+
+	err = thread_pool_create(nr_thread, &pool);
+	if (is_err_status(err))
+		return err;
+
+	dbg(T("Loading %ld image(s) through %d thread(s)\n"),
+	    ld->nr_path - ld->next, nr_thread);
+
+	for (i = 0; i < nr_thread; ++i) {
+		err = thread_pool_submit(pool, pool_worker, ld);
+		if (is_err_status(err))
+			break;
+	}
+
+	/* The jobs submitted load all images even if some failed */
+	if (i)
+		err = CLN_FW_ERR_NONE;
+
+	thread_pool_wait(pool);
+	thread_pool_destroy(pool);
+
+	return err;
+}
+
+static err_status_t
+load_files(loader_t *ld, const cln_fw_loader_param_t *param)
+{
+	err_status_t err;
+
+	ld->queue_depth = LOADER_DEFAULT_QUEUE_DEPTH;
+
+	if (param) {
+		if (param->queue_depth)
+			ld->queue_depth = param->queue_depth;
+		ld->mem_cap = param->mem_cap;
+	}
+
+	if (ld->queue_depth > LOADER_MAX_QUEUE_DEPTH)
+		ld->queue_depth = LOADER_MAX_QUEUE_DEPTH;
+
+	if ((!param || !param->no_uring) && !load_uring(ld))
+		return CLN_FW_ERR_NONE;
+
+	pthread_mutex_init(&ld->lock, NULL);
+	pthread_cond_init(&ld->mem_cond, NULL);
+
+	err = load_pool(ld);
+
+	pthread_cond_destroy(&ld->mem_cond);
+	pthread_mutex_destroy(&ld->lock);
+
+	return err;
+}
+
+/*
+ * Load a set of image files and hand each one to the callback. The files
+ * are opened and read through io_uring with up to queue_depth images in
+ * flight, or by a thread pool of the same size if io_uring is not
+ * available. The callback is invoked from the calling thread with
+ * io_uring, or concurrently from the threads of pool otherwise.
+ */
+err_status_t
+cln_fw_util_load_files(const char **path, unsigned long nr_path,
+		       const cln_fw_loader_param_t *param,
+		       cln_fw_loader_fn_t fn, void *data)
+{
+	loader_t ld;
+
+	if (!path || !fn)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	if (!nr_path)
+		return CLN_FW_ERR_NONE;
+
+	eee_memset(&ld, 0, sizeof(ld));
+	ld.path = path;
+	ld.nr_path = nr_path;
+	ld.fn = fn;
+	ld.data = data;
+
+	return load_files(&ld, param);
+}
+
+/*
+ * Like cln_fw_util_load_files() but hand each image over as a handle.
+ * Only the windows parsed for the handle are read through io_uring, and
+ * the rest of image is read on demand, so the images are never loaded as
+ * a whole. The memory cap bounds the windows read ahead.
+ */
+err_status_t
+cln_fw_util_open_files(const char **path, unsigned long nr_path,
+		       const cln_fw_loader_param_t *param,
+		       cln_fw_opener_fn_t fn, void *data)
+{
+	loader_t ld;
+
+	if (!path || !fn)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	if (!nr_path)
+		return CLN_FW_ERR_NONE;
+
+	eee_memset(&ld, 0, sizeof(ld));
+	ld.path = path;
+	ld.nr_path = nr_path;
+	ld.open_fn = fn;
+	ld.data = data;
+
+	return load_files(&ld, param);
+}
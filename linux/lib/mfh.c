@@ -15,11 +15,15 @@
 #include "mfh.h"
 #include "buffer_stream.h"
 #include "class.h"
+#include "stats.h"
 
 /* Refer to 330234-002US for the details */
 
 #define MFH_OFFSET			(-0xF8000)
 
+/* The flash is mapped right below 4 GiB */
+#define FLASH_MAP_END			0x100000000ULL
+
 #pragma pack(1)
 
 #define MFH_IDENTIFIER			0x5F4D4648U
@@ -45,6 +49,9 @@ typedef struct {
 
 #pragma pack()
 
+/* No item of the type, or no more items of the same type */
+#define MFH_ITEM_NONE			0xff
+
 typedef struct {
 	mfh_header_t *header;
 	mfh_flash_item_t *flash_item;
@@ -53,13 +60,66 @@ typedef struct {
 	unsigned long nr_boot_list;
 	unsigned long total_len;
 	buffer_stream_t bs;
+	/*
+	 * The items of each type are chained in the table order, so that
+	 * looking up a type doesn't walk the whole table.
+	 */
+	uint8_t first_item[mfh_flash_item_type_max];
+	uint8_t next_item[MFH_MAX_FLASH_ITEMS];
 } mfh_internal_t;
 
-typedef struct {
-	mfh_flash_item_t *start;
-	mfh_flash_item_t *end;
-	mfh_flash_item_t *current;
-} mfh_find_context_t;
+static const char *mfh_flash_item_type_names[] = {
+	[host_fw_stage1] = "host_fw_stage1",
+	[host_fw_stage1_signed] = "host_fw_stage1_signed",
+	[host_fw_stage2] = "host_fw_stage2",
+	[host_fw_stage2_signed] = "host_fw_stage2_signed",
+	[mfh_host_fw_stage2_conf] = "host_fw_stage2_conf",
+	[mfh_host_fw_stage2_conf_sign] = "host_fw_stage2_conf_signed",
+	[mfh_host_fw_parameters] = "host_fw_parameters",
+	[mfh_host_recovery_fw] = "host_recovery_fw",
+	[mfh_host_recovery_fw_signed] = "host_recovery_fw_signed",
+	[mfh_bootloader] = "bootloader",
+	[mfh_bootloader_signed] = "bootloader_signed",
+	[mfh_bootloader_conf] = "bootloader_conf",
+	[mfh_bootloader_conf_signed] = "bootloader_conf_signed",
+	[mfh_kernel] = "kernel",
+	[mfh_kernel_signed] = "kernel_signed",
+	[mfh_ramdisk] = "ramdisk",
+	[mfh_ramdisk_signed] = "ramdisk_signed",
+	[mfh_loadable_program] = "loadable_program",
+	[mfh_loadable_program_signed] = "loadable_program_signed",
+	[mfh_build_information] = "build_information",
+	[mfh_version] = "version",
+};
+
+const char *
+mfh_flash_item_type_name(mfh_flash_item_type_t type)
+{
+	if (type >= mfh_flash_item_type_max || !mfh_flash_item_type_names[type])
+		return "reserved";
+
+	return mfh_flash_item_type_names[type];
+}
+
+err_status_t
+cln_fw_util_flash_item_type(const char *name, unsigned int *type)
+{
+	unsigned int i;
+
+	if (!name || !type)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	for (i = 0; i < mfh_flash_item_type_max; ++i) {
+		if (mfh_flash_item_type_names[i]
+				&& !eee_strcmp(name,
+					       mfh_flash_item_type_names[i])) {
+			*type = i;
+			return CLN_FW_ERR_NONE;
+		}
+	}
+
+	return CLN_FW_ERR_INVALID_PARAMETER;
+}
 
 unsigned long
 mfh_header_size(void)
@@ -67,14 +127,124 @@ mfh_header_size(void)
 	return sizeof(mfh_header_t);
 }
 
+/*
+ * The size of header, boot priority list and flash items claimed by the
+ * header. The lists beyond the limits are not counted and left for
+ * mfh_probe() to reject.
+ */
+unsigned long
+mfh_size(void *mfh_buf)
+{
+	mfh_header_t *mfh = mfh_buf;
+	unsigned long size = sizeof(*mfh);
+
+	if (mfh->BootPriorityListCount <= MFH_MAX_BOOT_ITEMS)
+		size += mfh->BootPriorityListCount * sizeof(uint32_t);
+
+	if (mfh->FlashItemCount <= MFH_MAX_FLASH_ITEMS)
+		size += mfh->FlashItemCount * sizeof(mfh_flash_item_t);
+
+	return size;
+}
+
 long
 mfh_offset(void)
 {
 	return MFH_OFFSET;
 }
 
+/*
+ * Translate the flash address of an item to the offset in the image,
+ * which is mapped right below 4 GiB.
+ */
 err_status_t
-mfh_probe(void *mfh_buf, unsigned long *mfh_buf_len)
+mfh_flash_offset(uint32_t addr, uint32_t len, unsigned long image_len,
+		 unsigned long *offset)
+{
+	uint64_t base = FLASH_MAP_END - image_len;
+
+	if (addr < base || (uint64_t)addr + len > FLASH_MAP_END)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	*offset = addr - base;
+
+	return CLN_FW_ERR_NONE;
+}
+
+uint32_t
+mfh_flash_address(unsigned long offset, unsigned long image_len)
+{
+	return (uint32_t)(FLASH_MAP_END - image_len + offset);
+}
+
+void
+mfh_item_iter_init(mfh_item_iter_t *iter, mfh_flash_item_type_t filter,
+		   void *image, unsigned long image_len)
+{
+	eee_memset(iter, 0, sizeof(*iter));
+	iter->filter = filter;
+	iter->image = image;
+	iter->image_len = image_len;
+	iter->index = MFH_ITEM_START;
+}
+
+/*
+ * Lay out an MFH with the boot priority list referring to the first
+ * flash items in order. The flash items are left zeroed for
+ * mfh_set_flash_item().
+ */
+err_status_t
+mfh_create(void *mfh_buf, unsigned long mfh_buf_len,
+	   unsigned long nr_boot_item, unsigned long nr_flash_item)
+{
+	mfh_header_t *mfh = mfh_buf;
+	uint32_t *boot_list;
+	unsigned long i;
+
+	if (!nr_flash_item || nr_flash_item > MFH_MAX_FLASH_ITEMS
+			|| nr_boot_item > MFH_MAX_BOOT_ITEMS
+			|| nr_boot_item > nr_flash_item)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	if (mfh_buf_len < sizeof(*mfh) + nr_boot_item * sizeof(uint32_t)
+			  + nr_flash_item * sizeof(mfh_flash_item_t))
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	mfh->Identifier = MFH_IDENTIFIER;
+	mfh->Version = MFH_VERSION;
+	mfh->Flags = 0;
+	mfh->NextHeaderBlock = 0;
+	mfh->FlashItemCount = nr_flash_item;
+	mfh->BootPriorityListCount = nr_boot_item;
+
+	boot_list = (uint32_t *)(mfh + 1);
+	for (i = 0; i < nr_boot_item; ++i)
+		boot_list[i] = i;
+
+	eee_memset(boot_list + nr_boot_item, 0,
+		   nr_flash_item * sizeof(mfh_flash_item_t));
+
+	return CLN_FW_ERR_NONE;
+}
+
+void
+mfh_set_flash_item(void *mfh_buf, unsigned long index,
+		   mfh_flash_item_type_t type, uint32_t addr, uint32_t len,
+		   uint32_t reserved)
+{
+	mfh_header_t *mfh = mfh_buf;
+	mfh_flash_item_t *item;
+
+	item = (mfh_flash_item_t *)((uint32_t *)(mfh + 1)
+				    + mfh->BootPriorityListCount) + index;
+	item->Type = type;
+	item->FlashItemAddress = addr;
+	item->FlashItemLength = len;
+	item->Reserved = reserved;
+}
+
+static err_status_t
+__mfh_probe(void *mfh_buf, unsigned long *mfh_buf_len)
 {
 	buffer_stream_t bs;
 	mfh_header_t *mfh;
@@ -140,20 +310,38 @@ mfh_probe(void *mfh_buf, unsigned long *mfh_buf_len)
 	return CLN_FW_ERR_NONE;
 }
 
+err_status_t
+mfh_probe(void *mfh_buf, unsigned long *mfh_buf_len)
+{
+	uint64_t start = stats_timer_start();
+	err_status_t err;
+
+	err = __mfh_probe(mfh_buf, mfh_buf_len);
+	stats_timer_stop(CLN_FW_STAT_MFH_PROBE, start);
+
+	return err;
+}
+
 err_status_t
 mfh_show(void *mfh_buf, unsigned long mfh_buf_len)
 {
+	mfh_context_t *mfh_ctx;
+	mfh_internal_t *priv;
 	mfh_header_t *mfh;
-	uint32_t *boot_list;
-	mfh_flash_item_t *flash_item;
-	uint32_t i;
+	mfh_item_iter_t iter;
+	unsigned long i;
 	err_status_t err;
 
-	err = mfh_probe(mfh_buf, &mfh_buf_len);
+	err = mfh_context_new(NULL, &mfh_ctx);
 	if (is_err_status(err))
 		return err;
 
-	mfh = (mfh_header_t *)mfh_buf;
+	err = mfh_ctx->probe(mfh_ctx, mfh_buf, mfh_buf_len);
+	if (is_err_status(err))
+		goto probe_err;
+
+	priv = mfh_ctx->priv;
+	mfh = priv->header;
 
 	info_cont(T("MFH Header:\n"));
 	info_cont(T("  Identifier: 0x%x\n"), mfh->Identifier);
@@ -164,32 +352,32 @@ mfh_show(void *mfh_buf, unsigned long mfh_buf_len)
 	info_cont(T("  Boot Priority List Count: 0x%x\n"),
 		  mfh->BootPriorityListCount);
 
-	boot_list = (uint32_t *)(mfh + 1);
-	for (i = 0; i < mfh->BootPriorityListCount; i++)
-		info_cont(T("    [%d] Flash Item: %d\n"), i, boot_list[i]);
-
-	flash_item = (mfh_flash_item_t *)(boot_list
-		     + mfh->BootPriorityListCount);
-	for (i = 0; i < mfh->FlashItemCount; i++) {
-		info_cont(T("  Flash Item %d:\n"), i);
-		info_cont(T("    Type: 0x%x\n"), flash_item[i].Type);
-		info_cont(T("    Address: 0x%x\n"),
-			  flash_item[i].FlashItemAddress);
-		info_cont(T("    Length: 0x%x\n"),
-			  flash_item[i].FlashItemLength);
+	for (i = 0; i < priv->nr_boot_list; i++)
+		info_cont(T("    [%ld] Flash Item: %d\n"), i,
+			  priv->boot_list[i]);
+
+	mfh_item_iter_init(&iter, MFH_ITEM_ANY, NULL, 0);
+	while (!is_err_status(mfh_ctx->iterate(mfh_ctx, &iter))) {
+		info_cont(T("  Flash Item %ld:\n"), iter.index);
+		info_cont(T("    Type: 0x%x\n"), iter.type);
+		info_cont(T("    Address: 0x%x\n"), iter.addr);
+		info_cont(T("    Length: 0x%x\n"), iter.len);
 	}
 
-	return CLN_FW_ERR_NONE;
+probe_err:
+	mfh_ctx->destroy(mfh_ctx);
+
+	return err;
 }
 
 err_status_t
-mfh_show_fw_version(void *mfh_buf, unsigned long mfh_buf_len)
+mfh_get_fw_version(void *mfh_buf, unsigned long mfh_buf_len,
+		   uint32_t *fw_version)
 {
 	mfh_context_t *mfh_ctx;
-	uint32_t fw_version;
 	err_status_t err;
 
-	err = mfh_context_new(&mfh_ctx);
+	err = mfh_context_new(NULL, &mfh_ctx);
 	if (is_err_status(err))
 		return err;
 
@@ -197,76 +385,45 @@ mfh_show_fw_version(void *mfh_buf, unsigned long mfh_buf_len)
 	if (is_err_status(err))
 		goto probe_err;
 
-	err = mfh_ctx->firmware_version(mfh_ctx, &fw_version);
-	if (is_err_status(err))
-		goto get_fw_version_err;
-
-	info_cont(T("Firmware Version: %d.%d.%d (%s Edition %d)\n"),
-		  fw_version >> 24, (fw_version) >> 16 & 0xff,
-		  (fw_version >> 8) & 0xff,
-		  ((fw_version >> 4) & 0xf) == 0xf ? 
-		  "Wind River" : "Intel", fw_version & 0xf);
+	err = mfh_ctx->firmware_version(mfh_ctx, fw_version);
 
-get_fw_version_err:
 probe_err:
 	mfh_ctx->destroy(mfh_ctx);
 
 	return err;
 }
 
-static err_status_t
-__find_flash_item(mfh_find_context_t *find_ctx, mfh_flash_item_type_t type)
-{
-	while (find_ctx->current != find_ctx->end) {
-		if (type == find_ctx->current->Type)
-			break;
-
-		++find_ctx->current;
-	}
-
-	return find_ctx->current == find_ctx->end
-			? CLN_FW_ERR_MFH_FLASH_ITEM_NOT_FOUND
-			: CLN_FW_ERR_NONE;
-}
-
-#if 0
-static err_status_t
-find_next_flash_item(mfh_flash_item_type_t type, mfh_find_context_t *find_ctx)
+err_status_t
+mfh_show_fw_version(void *mfh_buf, unsigned long mfh_buf_len)
 {
-	if (!find_ctx || type >= mfh_flash_item_type_max)
-		return CLN_FW_ERR_INVALID_PARAMETER;
-
-	return __find_flash_item(find_ctx, type);
-}
-#endif
+	uint32_t fw_version;
+	err_status_t err;
 
-static err_status_t
-find_first_flash_item(mfh_internal_t *mfh, mfh_flash_item_type_t type,
-		      mfh_find_context_t *find_ctx)
-{
-	if (!mfh || !find_ctx || type >= mfh_flash_item_type_max)
-		return CLN_FW_ERR_INVALID_PARAMETER;
+	err = mfh_get_fw_version(mfh_buf, mfh_buf_len, &fw_version);
+	if (is_err_status(err))
+		return err;
 
-	find_ctx->current = find_ctx->start = mfh->flash_item;
-	find_ctx->end = find_ctx->start
-			+ mfh->nr_flash_item * sizeof(mfh_flash_item_t);
+	info_cont(T("Firmware Version: %d.%d.%d (%s Edition %d)\n"),
+		  fw_version >> 24, (fw_version) >> 16 & 0xff,
+		  (fw_version >> 8) & 0xff,
+		  ((fw_version >> 4) & 0xf) == 0xf ? 
+		  "Wind River" : "Intel", fw_version & 0xf);
 
-	return __find_flash_item(find_ctx, type);
+	return CLN_FW_ERR_NONE;
 }
 
 static err_status_t
 find_flash_item(mfh_internal_t *mfh, mfh_flash_item_type_t type,
 		mfh_flash_item_t **item)
 {
-	mfh_find_context_t find_ctx;
-	err_status_t err;
+	if (!mfh || type >= mfh_flash_item_type_max)
+		return CLN_FW_ERR_INVALID_PARAMETER;
 
-	err = find_first_flash_item(mfh, type, &find_ctx);
-	if (is_err_status(err))
-		return err;
+	if (mfh->first_item[type] == MFH_ITEM_NONE)
+		return CLN_FW_ERR_MFH_FLASH_ITEM_NOT_FOUND;
 
 	if (item)
-		*item = find_ctx.current;
+		*item = mfh->flash_item + mfh->first_item[type];
 
 	return CLN_FW_ERR_NONE;
 }
@@ -304,6 +461,70 @@ search_flash_item(mfh_context_t *ctx, mfh_flash_item_type_t type,
 	return CLN_FW_ERR_NONE;
 }
 
+static err_status_t
+get_next_item(mfh_context_t *ctx, mfh_flash_item_type_t type,
+	      unsigned long *index)
+{
+	mfh_internal_t *mfh = ctx->priv;
+	unsigned int next;
+
+	if (!mfh || !index || type >= mfh_flash_item_type_max)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	if (*index == MFH_ITEM_START)
+		next = mfh->first_item[type];
+	else if (*index < mfh->nr_flash_item
+			&& mfh->flash_item[*index].Type == type)
+		next = mfh->next_item[*index];
+	else
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	if (next == MFH_ITEM_NONE)
+		return CLN_FW_ERR_MFH_FLASH_ITEM_NOT_FOUND;
+
+	*index = next;
+
+	return CLN_FW_ERR_NONE;
+}
+
+static err_status_t
+iterate_flash_item(mfh_context_t *ctx, mfh_item_iter_t *iter)
+{
+	mfh_internal_t *mfh = ctx->priv;
+	mfh_flash_item_t *item;
+	unsigned long next, offset;
+	err_status_t err;
+
+	if (!mfh || !iter)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	if (iter->filter == MFH_ITEM_ANY) {
+		next = iter->index == MFH_ITEM_START ? 0 : iter->index + 1;
+		if (next >= mfh->nr_flash_item)
+			return CLN_FW_ERR_MFH_FLASH_ITEM_NOT_FOUND;
+
+		iter->index = next;
+	} else {
+		err = get_next_item(ctx, iter->filter, &iter->index);
+		if (is_err_status(err))
+			return err;
+	}
+
+	item = mfh->flash_item + iter->index;
+	iter->type = item->Type;
+	iter->addr = item->FlashItemAddress;
+	iter->len = item->FlashItemLength;
+	iter->data = NULL;
+
+	if (iter->image && iter->len
+			&& !is_err_status(mfh_flash_offset(iter->addr, iter->len,
+							   iter->image_len,
+							   &offset)))
+		iter->data = iter->image + offset;
+
+	return CLN_FW_ERR_NONE;
+}
+
 static err_status_t
 get_firmware_version(mfh_context_t *ctx, uint32_t *version)
 {
@@ -319,8 +540,62 @@ get_firmware_version(mfh_context_t *ctx, uint32_t *version)
 	return CLN_FW_ERR_NONE;
 }
 
+static unsigned long
+get_nr_flash_item(mfh_context_t *ctx)
+{
+	mfh_internal_t *mfh = ctx->priv;
+
+	if (!mfh)
+		return 0;
+
+	return mfh->header->FlashItemCount;
+}
+
 static err_status_t
-probe_mfh(mfh_context_t *ctx, void *buf, unsigned long buf_len)
+get_flash_item(mfh_context_t *ctx, unsigned long index,
+	       mfh_flash_item_type_t *type, uint32_t *addr, uint32_t *len)
+{
+	mfh_internal_t *mfh = ctx->priv;
+	mfh_flash_item_t *item;
+
+	if (index >= get_nr_flash_item(ctx))
+		return CLN_FW_ERR_MFH_FLASH_ITEM_NOT_FOUND;
+
+	item = mfh->flash_item + index;
+
+	if (type)
+		*type = item->Type;
+	if (addr)
+		*addr = item->FlashItemAddress;
+	if (len)
+		*len = item->FlashItemLength;
+
+	return CLN_FW_ERR_NONE;
+}
+
+/* Chain the items backward so that each chain is in the table order */
+static void
+build_item_index(mfh_internal_t *mfh)
+{
+	unsigned long i;
+
+	eee_memset(mfh->first_item, MFH_ITEM_NONE, sizeof(mfh->first_item));
+
+	for (i = mfh->nr_flash_item; i-- > 0;) {
+		mfh_flash_item_type_t type = mfh->flash_item[i].Type;
+
+		if (type >= mfh_flash_item_type_max) {
+			mfh->next_item[i] = MFH_ITEM_NONE;
+			continue;
+		}
+
+		mfh->next_item[i] = mfh->first_item[type];
+		mfh->first_item[type] = i;
+	}
+}
+
+static err_status_t
+__probe_mfh(mfh_context_t *ctx, void *buf, unsigned long buf_len)
 {
 	buffer_stream_t bs;
 	mfh_header_t *mfh;
@@ -386,21 +661,34 @@ probe_mfh(mfh_context_t *ctx, void *buf, unsigned long buf_len)
 		return err;
 	}
 
-	priv = eee_malloc(sizeof(*priv));
+	priv = arena_alloc(obj_arena(ctx), sizeof(*priv));
 	if (!priv)
 		return CLN_FW_ERR_OUT_OF_MEM;
 
 	priv->header = mfh;
 	priv->flash_item = flash_item;
-	priv->nr_flash_item = mfh->BootPriorityListCount;
+	priv->nr_flash_item = mfh->FlashItemCount;
 	priv->boot_list = boot_list;
 	priv->nr_boot_list = mfh->BootPriorityListCount;
 	priv->total_len = bs_tell(&bs);
+	build_item_index(priv);
 	ctx->priv = priv;
 
 	return CLN_FW_ERR_NONE;
 }
 
+static err_status_t
+probe_mfh(mfh_context_t *ctx, void *buf, unsigned long buf_len)
+{
+	uint64_t start = stats_timer_start();
+	err_status_t err;
+
+	err = __probe_mfh(ctx, buf, buf_len);
+	stats_timer_stop(CLN_FW_STAT_MFH_PROBE, start);
+
+	return err;
+}
+
 static void
 destroy_mfh(mfh_context_t *ctx)
 {
@@ -413,7 +701,7 @@ mfh_context_dtor(void *ctx)
 	mfh_internal_t *priv = ((mfh_context_t *)ctx)->priv;
 
 	if (priv)
-		eee_mfree(priv);
+		arena_free(obj_arena(ctx), priv);
 }
 
 static err_status_t
@@ -426,38 +714,137 @@ mfh_context_ctor(void *ctx)
 	mfh_ctx->destroy = destroy_mfh;
 	mfh_ctx->firmware_version = get_firmware_version;
 	mfh_ctx->find_item = search_flash_item;
+	mfh_ctx->nr_item = get_nr_flash_item;
+	mfh_ctx->get_item = get_flash_item;
+	mfh_ctx->next_item = get_next_item;
+	mfh_ctx->iterate = iterate_flash_item;
 
 	return CLN_FW_ERR_NONE;
 }
 
+static class_handle_t mfh_context_class;
+
 err_status_t
-mfh_context_new(mfh_context_t **ctx)
+mfh_context_new(arena_t *arena, mfh_context_t **ctx)
 {
 	if (!ctx)
 		return CLN_FW_ERR_INVALID_PARAMETER;
 
-	return obj_new("mfh_context_t", ctx);
+	return obj_new_from(arena, mfh_context_class, ctx);
 }
 
-#if 0
+/*
+ * Add or remove the flash item in the boot priority list. The list is
+ * followed by the flash item table which is moved along. The room of MFH
+ * is given by mfh_buf_len.
+ */
 err_status_t
-mfh_add_flash_item(mfh_context_t *mfh_ctx, void *data, unsigned long data_len,
-		   mfh_flash_item_type_t type, uint32_t addr, int bootable)
+mfh_set_flash_item_bootable(void *mfh_buf, unsigned long mfh_buf_len,
+			    unsigned long index, int bootable)
 {
+	mfh_header_t *mfh = mfh_buf;
+	uint32_t *boot_list = (uint32_t *)(mfh + 1);
+	unsigned long nr_boot_item = mfh->BootPriorityListCount;
+	unsigned long table_len = mfh->FlashItemCount
+				  * sizeof(mfh_flash_item_t);
+	unsigned long i;
+
+	if (index >= mfh->FlashItemCount)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	for (i = 0; i < nr_boot_item; ++i) {
+		if (boot_list[i] == index)
+			break;
+	}
+
+	if (bootable) {
+		if (i < nr_boot_item)
+			return CLN_FW_ERR_NONE;
+
+		if (nr_boot_item == MFH_MAX_BOOT_ITEMS
+				|| mfh_size(mfh) + sizeof(uint32_t)
+				   > mfh_buf_len) {
+			err(T("No room for more MFH boot items\n"));
+			return CLN_FW_ERR_INVALID_MFH;
+		}
+
+		eee_memmove(boot_list + nr_boot_item + 1,
+			    boot_list + nr_boot_item, table_len);
+		boot_list[nr_boot_item] = index;
+		++mfh->BootPriorityListCount;
+	} else {
+		if (i == nr_boot_item)
+			return CLN_FW_ERR_NONE;
+
+		eee_memmove(boot_list + i, boot_list + i + 1,
+			    (nr_boot_item - i - 1) * sizeof(uint32_t)
+			    + table_len);
+		--mfh->BootPriorityListCount;
+
+		/* As the erased flash */
+		eee_memset((uint8_t *)mfh_buf + mfh_size(mfh), 0xff,
+			   sizeof(uint32_t));
+	}
+
 	return CLN_FW_ERR_NONE;
 }
 
+/* Append a flash item to the table, and to the boot list if bootable */
 err_status_t
-mfh_set_flash_item_bootable(mfh_context_t *mfh_ctx, mfh_flash_item_type_t type,
-			    uint32_t addr, int bootable)
+mfh_add_flash_item(void *mfh_buf, unsigned long mfh_buf_len,
+		   mfh_flash_item_type_t type, uint32_t addr, uint32_t len,
+		   int bootable, unsigned long *index)
 {
+	mfh_header_t *mfh = mfh_buf;
+	unsigned long nr_flash_item = mfh->FlashItemCount;
+	err_status_t err;
+
+	if (type >= mfh_flash_item_type_max)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	if (nr_flash_item == MFH_MAX_FLASH_ITEMS
+			|| mfh_size(mfh) + sizeof(mfh_flash_item_t)
+			   > mfh_buf_len) {
+		err(T("No room for more MFH flash items\n"));
+		return CLN_FW_ERR_INVALID_MFH;
+	}
+
+	++mfh->FlashItemCount;
+	mfh_set_flash_item(mfh_buf, nr_flash_item, type, addr, len, 0);
+
+	if (bootable) {
+		err = mfh_set_flash_item_bootable(mfh_buf, mfh_buf_len,
+						  nr_flash_item, 1);
+		if (is_err_status(err)) {
+			--mfh->FlashItemCount;
+			return err;
+		}
+	}
+
+	if (index)
+		*index = nr_flash_item;
+
 	return CLN_FW_ERR_NONE;
 }
-#endif
+
+/* Point the flash item to the new extent, leaving the rest untouched */
+void
+mfh_move_flash_item(void *mfh_buf, unsigned long index, uint32_t addr,
+		    uint32_t len)
+{
+	mfh_header_t *mfh = mfh_buf;
+	mfh_flash_item_t *item;
+
+	item = (mfh_flash_item_t *)((uint32_t *)(mfh + 1)
+				    + mfh->BootPriorityListCount) + index;
+	item->FlashItemAddress = addr;
+	item->FlashItemLength = len;
+}
 
 err_status_t
 mfh_context_class_init(void)
 {
 	return class_register("mfh_context_t", NULL, mfh_context_ctor,
-			      mfh_context_dtor, sizeof(mfh_context_t));
+			      mfh_context_dtor, sizeof(mfh_context_t),
+			      &mfh_context_class);
 }
\ No newline at end of file
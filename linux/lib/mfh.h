@@ -12,6 +12,7 @@
 #define __MFH_H__
 
 #include <eee.h>
+#include "arena.h"
 
 typedef enum {
 	host_fw_stage1 = 0x00000000,
@@ -45,6 +46,29 @@ typedef enum {
 
 typedef struct __mfh_context		mfh_context_t;
 
+/* The index to start iterating the items of a type */
+#define MFH_ITEM_START			(~0UL)
+
+/* The type filter of mfh_item_iter_t to walk all the items */
+#define MFH_ITEM_ANY			mfh_flash_item_type_max
+
+/*
+ * The cursor of mfh_context_t.iterate(). The caller initializes it with
+ * mfh_item_iter_init() and reads the current item after each successful
+ * call. The data points into the image without copying, and it is NULL
+ * if the image is not given or the item is out of the image.
+ */
+typedef struct {
+	mfh_flash_item_type_t filter;
+	void *image;
+	unsigned long image_len;
+	unsigned long index;
+	mfh_flash_item_type_t type;
+	uint32_t addr;
+	uint32_t len;
+	void *data;
+} mfh_item_iter_t;
+
 struct __mfh_context {
 	err_status_t (*probe)(mfh_context_t *ctx, void *buf,
 			      unsigned long buf_len);
@@ -54,12 +78,58 @@ struct __mfh_context {
 				  void **out, unsigned long *out_len);
 	err_status_t (*firmware_version)(mfh_context_t *ctx,
 					 uint32_t *version);
+	unsigned long (*nr_item)(mfh_context_t *ctx);
+	err_status_t (*get_item)(mfh_context_t *ctx, unsigned long index,
+				 mfh_flash_item_type_t *type,
+				 uint32_t *addr, uint32_t *len);
+	/*
+	 * Advance the index to the next item of the type in the table
+	 * order. CLN_FW_ERR_MFH_FLASH_ITEM_NOT_FOUND ends the iteration.
+	 */
+	err_status_t (*next_item)(mfh_context_t *ctx,
+				  mfh_flash_item_type_t type,
+				  unsigned long *index);
+	/*
+	 * Move the cursor to the next item passing the type filter.
+	 * CLN_FW_ERR_MFH_FLASH_ITEM_NOT_FOUND ends the iteration.
+	 */
+	err_status_t (*iterate)(mfh_context_t *ctx, mfh_item_iter_t *iter);
 	void *priv;
 };
 
+const char *
+mfh_flash_item_type_name(mfh_flash_item_type_t type);
+
+err_status_t
+mfh_flash_offset(uint32_t addr, uint32_t len, unsigned long image_len,
+		 unsigned long *offset);
+uint32_t
+mfh_flash_address(unsigned long offset, unsigned long image_len);
+void
+mfh_item_iter_init(mfh_item_iter_t *iter, mfh_flash_item_type_t filter,
+		   void *image, unsigned long image_len);
+
+err_status_t
+mfh_create(void *mfh_buf, unsigned long mfh_buf_len,
+	   unsigned long nr_boot_item, unsigned long nr_flash_item);
+void
+mfh_set_flash_item(void *mfh_buf, unsigned long index,
+		   mfh_flash_item_type_t type, uint32_t addr, uint32_t len,
+		   uint32_t reserved);
+void
+mfh_move_flash_item(void *mfh_buf, unsigned long index, uint32_t addr,
+		    uint32_t len);
+err_status_t
+mfh_add_flash_item(void *mfh_buf, unsigned long mfh_buf_len,
+		   mfh_flash_item_type_t type, uint32_t addr, uint32_t len,
+		   int bootable, unsigned long *index);
+err_status_t
+mfh_set_flash_item_bootable(void *mfh_buf, unsigned long mfh_buf_len,
+			    unsigned long index, int bootable);
+
 err_status_t
 mfh_context_class_init(void);
 err_status_t
-mfh_context_new(mfh_context_t **ctx);
+mfh_context_new(arena_t *arena, mfh_context_t **ctx);
 
 #endif	/* __MFH_H__ */
\ No newline at end of file
@@ -14,34 +14,52 @@
 #include "internal.h"
 #include "platform_data.h"
 #include "capsule.h"
+#include "block_cmp.h"
 #include "buffer_stream.h"
 #include "mfh.h"
 #include "skm.h"
 #include "csbh.h"
+#include "stats.h"
 
-#define FLASH_SKM_SIZE			0x8000
-#define FLASH_SKM_OFFSET		(-0x28000)
+/* The descriptions of the items created for the keys */
+static const char sb_key_desc[][10] = {
+	[CLN_FW_SB_KEY_PK] = "pk",
+	[CLN_FW_SB_KEY_KEK] = "kek cert",
+	[CLN_FW_SB_KEY_DB] = "db cert",
+	[CLN_FW_SB_KEY_DBX] = "dbx cert",
+};
 
 err_status_t
 cln_fw_parser_create(void *fw, unsigned long fw_len,
 		     cln_fw_parser_t **out)
 {
 	cln_fw_parser_t *parser;
+	arena_t *arena;
+	err_status_t err;
 
 	if (!out)
 		return CLN_FW_ERR_INVALID_PARAMETER;
 
-	parser = eee_malloc(sizeof(*parser));
-	if (!parser)
+	/* Everything allocated for parsing is released with the parser */
+	err = arena_create(&arena);
+	if (is_err_status(err))
+		return err;
+
+	parser = arena_alloc(arena, sizeof(*parser));
+	if (!parser) {
+		arena_destroy(arena);
 		return CLN_FW_ERR_OUT_OF_MEM;
+	}
 
 	eee_memset(parser, 0, sizeof(*parser));
+	parser->arena = arena;
 	bs_init(&parser->firmware, fw, fw_len);
 	bs_init(&parser->mfh, NULL, 0);
 	bs_init(&parser->skm, NULL, 0);
 	bs_init(&parser->pdata, NULL, 0);
 	bs_init(&parser->pdata_header, NULL, 0);
 	bcll_init(&parser->pdata_item_list);
+	parser->fw_fd = -1;
 
 	*out = parser;
 
@@ -55,9 +73,11 @@ free_all_cln_fw_pdata_item(cln_fw_parser_t *parser)
 
 	bcll_for_each_link_safe(item, tmp, &parser->pdata_item_list, link) {
 		bcll_del(&item->link);
-		eee_mfree(item);
+		arena_free(parser->arena, item);
 		--parser->nr_pdata_item;
 	}
+
+	eee_memset(parser->pdata_index, 0, sizeof(parser->pdata_index));
 }
 
 void
@@ -66,23 +86,80 @@ cln_fw_parser_destroy(cln_fw_parser_t *parser)
 	if (!parser)
 		return;
 
-	free_all_cln_fw_pdata_item(parser);
+	if (parser->fw_map)
+		unmap_file(parser->fw_map, parser->fw_map_len);
 
-	if (parser->pdata_item)
-		eee_mfree(parser->pdata_item);
+	if (parser->fw_fd >= 0)
+		close(parser->fw_fd);
 
-	if (bs_head(&parser->pdata_header))
-		eee_mfree(bs_head(&parser->pdata_header));
+	if (parser->fw_source)
+		parser->fw_source->release(parser->fw_source);
 
-	eee_mfree(parser);
+	/* The parser itself is allocated from the arena */
+	arena_destroy(parser->arena);
+}
+
+/* Tell the index slot of a SecureBoot record */
+static int
+sb_record_slot(void *pdata_item)
+{
+	const char *dbx_desc = sb_key_desc[CLN_FW_SB_KEY_DBX];
+
+	/* The dbx records carry the cert header of db */
+	if (!eee_memcmp(platform_data_item_desc(pdata_item), dbx_desc,
+			eee_strlen(dbx_desc) + 1))
+		return PDATA_INDEX_DBX;
+
+	switch (platform_data_cert_header(pdata_item)) {
+	case PDATA_KEK_CERT_HEADER:
+		return PDATA_INDEX_KEK;
+	case PDATA_DB_CERT_HEADER:
+		return PDATA_INDEX_DB;
+	default:
+		return -1;
+	}
+}
+
+static void
+index_pdata_item(cln_fw_parser_t *parser, cln_fw_pdata_item_t *item)
+{
+	void *pdata_item = bs_head(&item->bs);
+	uint16_t id;
+	int slot;
+
+	id = platform_data_item_id(pdata_item);
+	if (id >= PDATA_ID_MAX)
+		return;
+
+	/* The first item wins like a linear search from the head */
+	if (!parser->pdata_index[id])
+		parser->pdata_index[id] = item;
+
+	if (id != PDATA_ID_SB_RECORD || bs_size(&item->bs) <
+			sizeof(platform_data_item_t) + sizeof(uint32_t))
+		return;
+
+	slot = sb_record_slot(pdata_item);
+	if (slot < 0)
+		return;
+
+	if (!parser->pdata_index[slot])
+		parser->pdata_index[slot] = item;
+}
+
+static cln_fw_pdata_item_t *
+lookup_pdata_item(cln_fw_parser_t *parser, int slot)
+{
+	return parser->pdata_index[slot];
 }
 
 static err_status_t
-add_cln_fw_pdata_item(cln_fw_parser_t *parser, void *pdata_item_buf)
+add_cln_fw_pdata_item(cln_fw_parser_t *parser, void *pdata_item_buf,
+		      cln_fw_pdata_item_t **out)
 {
 	cln_fw_pdata_item_t *item;
 
-	item = eee_malloc(sizeof(*item));
+	item = arena_alloc(parser->arena, sizeof(*item));
 	if (!item)
 		return CLN_FW_ERR_OUT_OF_MEM;
 
@@ -90,18 +167,26 @@ add_cln_fw_pdata_item(cln_fw_parser_t *parser, void *pdata_item_buf)
 		platform_data_item_size(pdata_item_buf));
 	bcll_add_tail(&parser->pdata_item_list, &item->link);
 	++parser->nr_pdata_item;
+	index_pdata_item(parser, item);
+
+	if (out)
+		*out = item;
 
 	return CLN_FW_ERR_NONE;
 }
 
-err_status_t
-cln_fw_parser_parse(cln_fw_parser_t *parser)
+static err_status_t
+__cln_fw_parser_parse(cln_fw_parser_t *parser)
 {
 	buffer_stream_t *fw = &parser->firmware;
 	void *mfh, *pdata, *skm;
 	unsigned long mfh_len, pdata_len;
 	err_status_t err;
 
+	/*
+	 * Fetch the header first so that only the lists it claims are
+	 * fetched then.
+	 */
 	err = bs_get_at(fw, &mfh, mfh_header_size(), mfh_offset());
 	if (is_err_status(err)) {
 		err(T("The length of firmware is not expected for ")
@@ -109,12 +194,29 @@ cln_fw_parser_parse(cln_fw_parser_t *parser)
 		return err;
 	}
 
-	mfh_len = bs_remain(fw);
-	err = mfh_probe(mfh, &mfh_len);
+	mfh_len = mfh_size(mfh);
+	if (mfh_len > bs_remain(fw))
+		mfh_len = bs_remain(fw);
+
+	err = bs_get_at(fw, &mfh, mfh_len, mfh_offset());
+	if (!is_err_status(err))
+		err = mfh_probe(mfh, &mfh_len);
 	if (!is_err_status(err) && bs_empty(&parser->mfh))
 		bs_init(&parser->mfh, mfh, mfh_len);
 
+	err = bs_get_at(fw, &pdata, platform_data_header_size(),
+			platform_data_offset());
+	if (is_err_status(err)) {
+		err(T("The length of firmware is not expected for ")
+		    T("searching platform data\n"));
+		return err;
+	}
+
+	/* Only the items claimed by the header are fetched */
 	pdata_len = platform_data_max_size();
+	if (platform_data_size(pdata) < pdata_len)
+		pdata_len = platform_data_size(pdata);
+
 	err = bs_get_at(fw, &pdata, pdata_len, platform_data_offset());
 	if (is_err_status(err)) {
 		err(T("The length of firmware is not expected for ")
@@ -122,12 +224,13 @@ cln_fw_parser_parse(cln_fw_parser_t *parser)
 		return err;
 	}
 
-	err = platform_data_probe(pdata, &pdata_len);
-	if (!is_err_status(err) && bs_empty(&parser->pdata)) {
+	if (bs_empty(&parser->pdata) &&
+			!is_err_status(platform_data_probe(pdata, pdata_len,
+							   &parser->pdata_view))) {
 		void *pdata_header_buf, *pdata_item_buf, *p;
 		unsigned long i, nr_pdata_item;
 
-		err = platform_data_parse(pdata, pdata_len,
+		err = platform_data_parse(parser->arena, &parser->pdata_view,
 					  &pdata_header_buf,
 					  &pdata_item_buf,
 					  &nr_pdata_item);
@@ -136,7 +239,7 @@ cln_fw_parser_parse(cln_fw_parser_t *parser)
 
 		p = pdata_item_buf;
 		for (i = 0; i < nr_pdata_item; ++i) {
-			err = add_cln_fw_pdata_item(parser, p);
+			err = add_cln_fw_pdata_item(parser, p, NULL);
 			if (is_err_status(err)) {
 				free_all_cln_fw_pdata_item(parser);
 				return err;
@@ -149,62 +252,78 @@ cln_fw_parser_parse(cln_fw_parser_t *parser)
 		bs_init(&parser->pdata_header, pdata_header_buf,
 			platform_data_header_size());
 
-		bs_init(&parser->pdata, pdata, pdata_len);
+		bs_init(&parser->pdata, pdata, parser->pdata_view.len);
 	}
 
-	err = bs_get_at(fw, &skm, FLASH_SKM_SIZE, FLASH_SKM_OFFSET);
+	err = bs_get_at(fw, &skm, skm_size(), skm_offset());
 	if (!is_err_status(err) && bs_empty(&parser->skm))
-		bs_init(&parser->skm, skm, FLASH_SKM_SIZE);
+		bs_init(&parser->skm, skm, skm_size());
 
 	return CLN_FW_ERR_NONE;
 }
 
+err_status_t
+cln_fw_parser_parse(cln_fw_parser_t *parser)
+{
+	uint64_t start = stats_timer_start();
+	err_status_t err;
+
+	err = __cln_fw_parser_parse(parser);
+	stats_timer_stop(CLN_FW_STAT_PARSE, start);
+
+	return err;
+}
+
+/*
+ * Fetch the entire firmware for the operations accessing it beyond the
+ * windows fetched by parsing.
+ */
+err_status_t
+cln_fw_parser_fetch_all(cln_fw_parser_t *parser)
+{
+	err_status_t err;
+
+	err = bs_fetch_all(&parser->firmware);
+	if (is_err_status(err))
+		err(T("Failed to fetch the firmware\n"));
+
+	return err;
+}
+
 err_status_t
 cln_fw_parser_embed_key(cln_fw_parser_t *parser, cln_fw_sb_key_t key,
 			void *in, unsigned long in_len)
 {
-	buffer_stream_t *pdata;
+	cln_fw_pdata_item_t *item;
 	uint16_t id;
+	int slot;
 	void *pdata_item;
 	unsigned long pdata_item_len;
 	err_status_t err;
 
-	if (key == CLN_FW_SB_KEY_PK)
+	if (key == CLN_FW_SB_KEY_PK) {
 		id = PDATA_ID_PK;
-	else
+		slot = PDATA_ID_PK;
+	} else {
+		const int sb_slot[] = {
+			[CLN_FW_SB_KEY_KEK] = PDATA_INDEX_KEK,
+			[CLN_FW_SB_KEY_DB] = PDATA_INDEX_DB,
+			[CLN_FW_SB_KEY_DBX] = PDATA_INDEX_DBX,
+		};
+
 		id = PDATA_ID_SB_RECORD;
+		slot = sb_slot[key];
+	}
 
-	pdata = &parser->pdata;
-	err = platform_data_search_item(bs_head(pdata), bs_size(pdata), id);
-	if (!is_err_status(err)) {
-		cln_fw_pdata_item_t *item, *tmp;
+	if (bs_empty(&parser->pdata))
+		return CLN_FW_ERR_INVALID_PDATA;
 
+	item = lookup_pdata_item(parser, slot);
+	if (item) {
 		dbg(T("Updating platform item ID %d ...\n"), id);
-		bcll_for_each_link_safe(item, tmp,
-				&parser->pdata_item_list, link) {
-			uint16_t pdata_item_id;
-			uint32_t header;
-			void *pdata_item = bs_head(&item->bs);
-
-			pdata_item_id = platform_data_item_id(pdata_item);
-			if (pdata_item_id != id)
-				continue;
 
-			if (key == CLN_FW_SB_KEY_PK)
-				break;
-
-			header = platform_data_cert_header(pdata_item);
-			if (header == PDATA_KEK_CERT_HEADER
-					&& key == CLN_FW_SB_KEY_KEK)
-				break;
-			else if (header == PDATA_DB_CERT_HEADER
-					&& key == CLN_FW_SB_KEY_DB)
-				break;
-		}
-		if (&item->link == &parser->pdata_item_list)
-			return CLN_FW_ERR_PDATA_ITEM_NOT_FOUND;
-
-		err = platform_data_update_item(bs_head(&item->bs),
+		err = platform_data_update_item(parser->arena,
+						 bs_head(&item->bs),
 						 bs_size(&item->bs), id,
 						 NULL, NULL, in, in_len,
 						 &pdata_item,
@@ -213,40 +332,79 @@ cln_fw_parser_embed_key(cln_fw_parser_t *parser, cln_fw_sb_key_t key,
 			return err;
 
 		bs_init(&item->bs, pdata_item, pdata_item_len);
-	} else if (err == CLN_FW_ERR_PDATA_ITEM_NOT_FOUND) {
-		const char desc[][10] = {
-			"pk",
-			"kek cert",
-			"db cert",
-			"dbx cert",
-		};
-
-		err = platform_data_create_item(id, 0, desc[key], in, in_len,
+	} else {
+		err = platform_data_create_item(parser->arena, id, 0,
+						 sb_key_desc[key], in, in_len,
 						 &pdata_item,
 						 &pdata_item_len);
 		if (is_err_status(err))
 			return err;
 
-		err = add_cln_fw_pdata_item(parser, pdata_item);
+		err = add_cln_fw_pdata_item(parser, pdata_item, &item);
 		if (is_err_status(err)) {
-			eee_mfree(pdata_item);
+			arena_free(parser->arena, pdata_item);
 			return err;
 		}
+
+		/* The cert header of key data may not tell the key type */
+		parser->pdata_index[slot] = item;
 	}
 
 	return CLN_FW_ERR_NONE;
 }
 
-err_status_t
-cln_fw_parser_flush(cln_fw_parser_t *parser, void *fw_buf,
-		    unsigned long fw_buf_len)
+/*
+ * Rewrite the platform data window with the current items. The window
+ * buffer must already hold the original contents of the window so that
+ * the bytes following the items are preserved.
+ */
+static err_status_t
+flush_pdata(cln_fw_parser_t *parser, void *pdata, unsigned long pdata_len)
 {
-	buffer_stream_t fw;
+	platform_data_view_t view;
+	buffer_stream_t bs;
 	cln_fw_pdata_item_t *item;
-	void *pdata, *pdata_item;
+	void *pdata_item;
 	unsigned long total_item_len;
 	err_status_t err;
 
+	bs_init(&bs, pdata, pdata_len);
+
+	err = bs_get_at(&bs, (void **)&pdata_item, 0,
+			platform_data_header_size());
+	if (is_err_status(err))
+		return err;
+
+	total_item_len = 0;
+	bcll_for_each_link(item, &parser->pdata_item_list, link) {
+		err = bs_post_put(&bs, bs_head(&item->bs), bs_size(&item->bs));
+		if (is_err_status(err)) {
+			err(T("The platform data items exceed the region\n"));
+			return err;
+		}
+
+		total_item_len += bs_size(&item->bs);
+	}
+
+	platform_data_update_header(&view, pdata, pdata_item, total_item_len,
+				    parser->nr_pdata_item);
+
+	if (cln_fw_verbose()) {
+		dbg(T("Showing platform data after embedding the key ...\n"));
+		platform_data_show(&view);
+	}
+
+	return CLN_FW_ERR_NONE;
+}
+
+static err_status_t
+__cln_fw_parser_flush(cln_fw_parser_t *parser, void *fw_buf,
+		      unsigned long fw_buf_len)
+{
+	buffer_stream_t fw;
+	void *pdata;
+	err_status_t err;
+
 	bs_init(&fw, fw_buf, fw_buf_len);
 
 	err = bs_get_at(&fw, (void **)&pdata, platform_data_max_size(),
@@ -257,56 +415,398 @@ cln_fw_parser_flush(cln_fw_parser_t *parser, void *fw_buf,
 		return err;
 	}
 
-	bs_seek(&fw, platform_data_header_size());
-	bs_get(&fw, (void **)&pdata_item, 0);
-
-	total_item_len = 0;
-	bcll_for_each_link(item, &parser->pdata_item_list, link) {
-		bs_post_put(&fw, bs_head(&item->bs), bs_size(&item->bs));
-		total_item_len += bs_size(&item->bs);
-	}
+	err = flush_pdata(parser, pdata, platform_data_max_size());
+	if (is_err_status(err))
+		return err;
 
-	platform_data_update_header(pdata, pdata_item, total_item_len);
+	/* The view of the handle no longer covers what was flushed in place */
+	if (fw_buf == bs_head(&parser->firmware)) {
+		platform_data_view_invalidate(&parser->pdata_view);
 
-	bs_put_at(&fw, pdata, platform_data_header_size(),
-		  platform_data_offset());
+		err = platform_data_probe(pdata, platform_data_max_size(),
+					  &parser->pdata_view);
+		if (is_err_status(err))
+			return err;
 
-	if (cln_fw_verbose()) {
-		dbg(T("Showing platform data after embedding the key ...\n"));
-		platform_data_show(pdata, platform_data_size(pdata));
+		bs_init(&parser->pdata, pdata, parser->pdata_view.len);
 	}
 
 	return CLN_FW_ERR_NONE;
 }
 
 err_status_t
-cln_fw_parser_generate_capsule(cln_fw_parser_t *parser, int bios_only,
-			       void **out, unsigned long *out_len)
+cln_fw_parser_flush(cln_fw_parser_t *parser, void *fw_buf,
+		    unsigned long fw_buf_len)
+{
+	uint64_t start = stats_timer_start();
+	err_status_t err;
+
+	err = __cln_fw_parser_flush(parser, fw_buf, fw_buf_len);
+	stats_timer_stop(CLN_FW_STAT_FLUSH, start);
+
+	return err;
+}
+
+/*
+ * Write the flushed firmware to a file descriptor. Only the platform
+ * data window is materialized in memory. The unchanged prefix and suffix
+ * are emitted as extents of the input, which are copied in kernel if the
+ * input is a file.
+ */
+static err_status_t
+__cln_fw_parser_flush_fd(cln_fw_parser_t *parser, int fd)
 {
 	buffer_stream_t *fw = &parser->firmware;
-	buffer_stream_t cap;
-	void *cap_header, *update_item;
-	unsigned long cap_header_len, update_item_len, payload_len, cap_len;
-	uint32_t addr;
+	void *orig_pdata, *pdata;
+	unsigned long pdata_off, pdata_len, suffix_off;
+	err_status_t err;
+
+	pdata_len = platform_data_max_size();
+	err = bs_get_at(fw, &orig_pdata, pdata_len, platform_data_offset());
+	if (is_err_status(err)) {
+		err(T("The length of firmware is not expected for ")
+		    T("searching platform data\n"));
+		return err;
+	}
+
+	pdata_off = bs_tell(fw);
+	suffix_off = pdata_off + pdata_len;
+
+	/* The extents are copied from the buffer without a file */
+	if (parser->fw_fd < 0) {
+		err = cln_fw_parser_fetch_all(parser);
+		if (is_err_status(err))
+			return err;
+	}
+
+	pdata = eee_malloc(pdata_len);
+	if (!pdata)
+		return CLN_FW_ERR_OUT_OF_MEM;
+
+	eee_memcpy(pdata, orig_pdata, pdata_len);
+
+	err = flush_pdata(parser, pdata, pdata_len);
+	if (is_err_status(err))
+		goto out;
+
+	if (write_file_extent(fd, parser->fw_fd, bs_head(fw), 0, pdata_off)
+			|| write_buffer(fd, pdata, pdata_len)
+			|| write_file_extent(fd, parser->fw_fd, bs_head(fw),
+					     suffix_off,
+					     bs_size(fw) - suffix_off))
+		err = CLN_FW_ERR_IO;
+
+out:
+	eee_mfree(pdata);
+
+	return err;
+}
+
+err_status_t
+cln_fw_parser_flush_fd(cln_fw_parser_t *parser, int fd)
+{
+	uint64_t start = stats_timer_start();
 	err_status_t err;
 
+	err = __cln_fw_parser_flush_fd(parser, fd);
+	stats_timer_stop(CLN_FW_STAT_FLUSH, start);
+
+	return err;
+}
+
+static err_status_t
+capsule_payload(cln_fw_parser_t *parser, int bios_only, uint32_t *addr,
+		unsigned long *payload_len)
+{
+	buffer_stream_t *fw = &parser->firmware;
+
 	if (!bios_only) {
-		addr = 0xFF800000;
-		payload_len = bs_size(fw);
-		if (payload_len != FIRMWARE_SIZE) {
+		*addr = 0xFF800000;
+		*payload_len = bs_size(fw);
+		if (*payload_len != FIRMWARE_SIZE) {
 			err(T("The firmware size is expected length\n"));
 			return CLN_FW_ERR_INVALID_PARAMETER;
 		}
 	} else {
-		addr = 0xFFD00000;
+		*addr = 0xFFD00000;
 		if (bs_size(fw) < BIOS_REGION_SIZE) {
 			err(T("The BIOS part in firmware is not big enough\n"));
 			return CLN_FW_ERR_INVALID_PARAMETER;
 		}
-		payload_len = BIOS_REGION_SIZE;
+		*payload_len = BIOS_REGION_SIZE;
+	}
+
+	*payload_len = (*payload_len + (BLOCK_SIZE - 1)) & ~(BLOCK_SIZE - 1);
+
+	return CLN_FW_ERR_NONE;
+}
+
+/*
+ * Write the capsule to a file descriptor without staging it in memory.
+ * The header and update entry table are gathered with the payload which
+ * is referenced in the input directly, or copied in kernel if the input
+ * is a file.
+ */
+err_status_t
+cln_fw_parser_write_capsule(cln_fw_parser_t *parser, int bios_only, int fd)
+{
+	buffer_stream_t *fw = &parser->firmware;
+	capsule_header_t cap_header;
+	capsule_update_entry_t update_entry[CAPSULE_MAX_UPDATE_ENTRIES];
+	struct iovec iov[3];
+	unsigned long payload_len, payload_off;
+	uint32_t addr;
+	err_status_t err;
+
+	err = capsule_payload(parser, bios_only, &addr, &payload_len);
+	if (is_err_status(err))
+		return err;
+
+	capsule_init_header(&cap_header, payload_len);
+	capsule_init_update_entry(update_entry, addr, payload_len);
+	payload_off = bs_size(fw) - payload_len;
+
+	if (parser->fw_fd < 0) {
+		err = bs_fetch_at(fw, payload_len, payload_off);
+		if (is_err_status(err))
+			return err;
+	}
+
+	iov[0].iov_base = &cap_header;
+	iov[0].iov_len = sizeof(cap_header);
+	iov[1].iov_base = update_entry;
+	iov[1].iov_len = sizeof(update_entry);
+
+	if (parser->fw_fd >= 0) {
+		if (write_vector(fd, iov, 2)
+				|| write_file_extent(fd, parser->fw_fd,
+						     bs_head(fw), payload_off,
+						     payload_len))
+			return CLN_FW_ERR_IO;
+	} else {
+		iov[2].iov_base = bs_head(fw) + payload_off;
+		iov[2].iov_len = payload_len;
+		if (write_vector(fd, iov, 3))
+			return CLN_FW_ERR_IO;
+	}
+
+	return CLN_FW_ERR_NONE;
+}
+
+/*
+ * Unchanged blocks between two changed extents are carried in the
+ * payload if they are cheaper than a separate update entry, which
+ * costs a flash erase and program cycle of its own.
+ */
+#define DELTA_ENTRY_COST_BLOCKS		2
+
+/*
+ * Merge the pair of neighbouring extents with the smallest gap between
+ * them. Return the gap in blocks.
+ */
+static unsigned long
+merge_closest_extents(capsule_extent_t *extents, unsigned int *nr_extent)
+{
+	unsigned long gap, min_gap;
+	unsigned int i, min;
+
+	min = 0;
+	min_gap = ~0UL;
+	for (i = 0; i + 1 < *nr_extent; ++i) {
+		gap = extents[i + 1].offset - extents[i].offset
+		      - extents[i].size;
+		if (gap < min_gap) {
+			min_gap = gap;
+			min = i;
+		}
 	}
 
-	payload_len = (payload_len + (BLOCK_SIZE - 1)) & ~(BLOCK_SIZE - 1);
+	extents[min].size = extents[min + 1].offset + extents[min + 1].size
+			    - extents[min].offset;
+	eee_memmove(extents + min + 1, extents + min + 2,
+		    (*nr_extent - min - 2) * sizeof(*extents));
+	--*nr_extent;
+
+	return min_gap / BLOCK_SIZE;
+}
+
+/*
+ * Coalesce the changed blocks into the extents. The runs closer than
+ * the cost of an update entry are merged first, and then the closest
+ * runs are merged until the update entry table can hold them.
+ */
+static err_status_t
+build_delta_extents(arena_t *arena, const uint8_t *changed,
+		    unsigned long nr_block, capsule_extent_t *out,
+		    unsigned int *nr_out)
+{
+	capsule_extent_t *extents;
+	unsigned int nr_extent;
+	unsigned long i;
+
+	/* At most one run for every other block */
+	extents = arena_alloc(arena, (nr_block / 2 + 1) * sizeof(*extents));
+	if (!extents)
+		return CLN_FW_ERR_OUT_OF_MEM;
+
+	for (i = 0, nr_extent = 0; i < nr_block; ++i) {
+		if (!changed[i])
+			continue;
+
+		if (nr_extent) {
+			capsule_extent_t *last = extents + nr_extent - 1;
+
+			if (i * BLOCK_SIZE - last->offset - last->size
+					<= DELTA_ENTRY_COST_BLOCKS * BLOCK_SIZE) {
+				last->size = (i + 1) * BLOCK_SIZE
+					     - last->offset;
+				continue;
+			}
+		}
+
+		extents[nr_extent].offset = i * BLOCK_SIZE;
+		extents[nr_extent].size = BLOCK_SIZE;
+		++nr_extent;
+	}
+
+	while (nr_extent > CAPSULE_MAX_EXTENTS)
+		merge_closest_extents(extents, &nr_extent);
+
+	eee_memcpy(out, extents, nr_extent * sizeof(*extents));
+	*nr_out = nr_extent;
+
+	arena_free(arena, extents);
+
+	return CLN_FW_ERR_NONE;
+}
+
+/*
+ * Write a capsule which only updates the blocks changed since the base
+ * image.
+ */
+err_status_t
+cln_fw_parser_write_delta_capsule(cln_fw_parser_t *parser,
+				  cln_fw_parser_t *base, int bios_only,
+				  int fd, unsigned int *nr_extent,
+				  unsigned long *payload_len)
+{
+	buffer_stream_t *fw = &parser->firmware;
+	capsule_header_t cap_header;
+	capsule_update_entry_t update_entry[CAPSULE_MAX_UPDATE_ENTRIES];
+	capsule_extent_t extents[CAPSULE_MAX_EXTENTS];
+	struct iovec iov[2 + CAPSULE_MAX_EXTENTS];
+	unsigned long range_len, range_off, nr_block, nr_changed, delta_len;
+	unsigned int nr, i;
+	uint8_t *changed;
+	uint32_t addr;
+	err_status_t err;
+
+	if (bs_size(&base->firmware) != bs_size(fw)) {
+		err(T("The base firmware size does not match\n"));
+		return CLN_FW_ERR_INVALID_PARAMETER;
+	}
+
+	err = capsule_payload(parser, bios_only, &addr, &range_len);
+	if (is_err_status(err))
+		return err;
+
+	range_off = bs_size(fw) - range_len;
+	nr_block = range_len / BLOCK_SIZE;
+
+	err = bs_fetch_at(fw, range_len, range_off);
+	if (!is_err_status(err))
+		err = bs_fetch_at(&base->firmware, range_len, range_off);
+	if (is_err_status(err))
+		return err;
+
+	changed = arena_alloc(parser->arena, nr_block);
+	if (!changed)
+		return CLN_FW_ERR_OUT_OF_MEM;
+
+	nr_changed = block_cmp_changed(bs_head(fw) + range_off,
+				       bs_head(&base->firmware) + range_off,
+				       range_len, BLOCK_SIZE, changed);
+	if (!nr_changed) {
+		err(T("No block is changed since the base firmware\n"));
+		err = CLN_FW_ERR_INVALID_PARAMETER;
+		goto out;
+	}
+
+	err = build_delta_extents(parser->arena, changed, nr_block, extents,
+				  &nr);
+	if (is_err_status(err))
+		goto out;
+
+	for (i = 0, delta_len = 0; i < nr; ++i)
+		delta_len += extents[i].size;
+
+	dbg(T("%ld of %ld blocks changed, carried by %d extents in %#lx ")
+	    T("bytes\n"), nr_changed, nr_block, nr, delta_len);
+
+	capsule_init_header(&cap_header, delta_len);
+	capsule_init_update_entries(update_entry, addr, extents, nr);
+
+	iov[0].iov_base = &cap_header;
+	iov[0].iov_len = sizeof(cap_header);
+	iov[1].iov_base = update_entry;
+	iov[1].iov_len = sizeof(update_entry);
+
+	err = CLN_FW_ERR_IO;
+
+	if (parser->fw_fd >= 0) {
+		if (write_vector(fd, iov, 2))
+			goto out;
+
+		for (i = 0; i < nr; ++i) {
+			if (write_file_extent(fd, parser->fw_fd, bs_head(fw),
+					      range_off + extents[i].offset,
+					      extents[i].size))
+				goto out;
+		}
+	} else {
+		for (i = 0; i < nr; ++i) {
+			iov[2 + i].iov_base = bs_head(fw) + range_off
+					      + extents[i].offset;
+			iov[2 + i].iov_len = extents[i].size;
+		}
+
+		if (write_vector(fd, iov, 2 + nr))
+			goto out;
+	}
+
+	if (nr_extent)
+		*nr_extent = nr;
+
+	if (payload_len)
+		*payload_len = delta_len;
+
+	err = CLN_FW_ERR_NONE;
+
+out:
+	arena_free(parser->arena, changed);
+
+	return err;
+}
+
+err_status_t
+cln_fw_parser_generate_capsule(cln_fw_parser_t *parser, int bios_only,
+			       void **out, unsigned long *out_len)
+{
+	buffer_stream_t *fw = &parser->firmware;
+	buffer_stream_t cap;
+	void *cap_header, *update_item;
+	unsigned long cap_header_len, update_item_len, payload_len, cap_len;
+	uint32_t addr;
+	err_status_t err;
+
+	err = capsule_payload(parser, bios_only, &addr, &payload_len);
+	if (is_err_status(err))
+		return err;
+
+	err = bs_fetch_at(fw, payload_len, bs_size(fw) - payload_len);
+	if (is_err_status(err))
+		return err;
+
 	err = capsule_create_header(payload_len, &cap_header,
 				    &cap_header_len);
 	if (is_err_status(err))
@@ -363,8 +863,8 @@ cln_fw_parser_diagnose_firmware(cln_fw_parser_t *parser)
 	mfh_context_t *mfh_ctx;
 	skm_context_t *skm_ctx;
 	buffer_stream_t *fw = &parser->firmware;
-	void *skm, *mfh, *pdata;
-	unsigned long skm_max_len, mfh_len, pdata_len;
+	void *skm, *mfh;
+	unsigned long skm_max_len, mfh_len;
 	err_status_t err;
 	int skm_status, mfh_status, pdata_status;
 	uint32_t fw_version;
@@ -377,7 +877,7 @@ cln_fw_parser_diagnose_firmware(cln_fw_parser_t *parser)
 		return err;
 	}
 
-	err = skm_context_new(&skm_ctx);
+	err = skm_context_new(parser->arena, &skm_ctx);
 	if (is_err_status(err))
 		return err;
 
@@ -414,6 +914,8 @@ show_skm_status:
 			info_cont(T("- N/A\n"));
 	}
 
+	skm_ctx->destroy(skm_ctx);
+
 	err = bs_get_at(fw, &mfh, mfh_header_size(), mfh_offset());
 	if (is_err_status(err)) {
 		err(T("The length of firmware is not expected for ")
@@ -421,7 +923,7 @@ show_skm_status:
 		return err;
 	}
 
-	err = mfh_context_new(&mfh_ctx);
+	err = mfh_context_new(parser->arena, &mfh_ctx);
 	if (is_err_status(err))
 		return err;
 
@@ -482,36 +984,24 @@ show_mfh_status:
 			info_cont(T("- N/A\n"));
 	}
 
-	pdata_len = platform_data_max_size();
-	err = bs_get_at(fw, &pdata, pdata_len, platform_data_offset());
-	if (is_err_status(err)) {
-		err(T("The length of firmware is not expected for ")
-		    T("searching platform data\n"));
-		return err;
-	}
+	mfh_ctx->destroy(mfh_ctx);
 
-	pdata_status = 0;
-	err = platform_data_probe(pdata, &pdata_len);
-	if (is_err_status(err)) {
+	/* The platform data is probed and indexed during parsing */
+	if (bs_empty(&parser->pdata)) {
 		pdata_status = -1;
 		goto show_pdata_status;
 	}
 
-	err = platform_data_search_item(pdata, pdata_len,
-					PDATA_ID_SERIAL_NUMBER);
-	if (!is_err_status(err))
+	pdata_status = 0;
+	if (lookup_pdata_item(parser, PDATA_ID_SERIAL_NUMBER))
 		pdata_status |= PDATA_ITEM_SERIAL_NUMBER;
-	err = platform_data_search_item(pdata, pdata_len, PDATA_ID_1ST_MAC);
-	if (!is_err_status(err))
+	if (lookup_pdata_item(parser, PDATA_ID_1ST_MAC))
 		pdata_status |= PDATA_ITEM_1ST_MAC;
-	err = platform_data_search_item(pdata, pdata_len, PDATA_ID_2ND_MAC);
-	if (!is_err_status(err))
+	if (lookup_pdata_item(parser, PDATA_ID_2ND_MAC))
 		pdata_status |= PDATA_ITEM_2ND_MAC;
-	err = platform_data_search_item(pdata, pdata_len, PDATA_ID_PK);
-	if (!is_err_status(err))
+	if (lookup_pdata_item(parser, PDATA_ID_PK))
 		pdata_status |= PDATA_ITEM_PK;
-	err = platform_data_search_item(pdata, pdata_len, PDATA_ID_SB_RECORD);
-	if (!is_err_status(err))
+	if (lookup_pdata_item(parser, PDATA_ID_SB_RECORD))
 		pdata_status |= PDATA_ITEM_SB_RECORD;
 
 show_pdata_status:
@@ -15,6 +15,7 @@
 #include "internal.h"
 #include "buffer_stream.h"
 #include "bcll.h"
+#include "stats.h"
 
 unsigned long
 platform_data_header_size(void)
@@ -62,13 +63,33 @@ platform_data_item_id(void *pdata_item_buf)
 	return pdata_item->id;
 }
 
+const char *
+platform_data_item_desc(void *pdata_item_buf)
+{
+	platform_data_item_t *pdata_item = pdata_item_buf;
+	return pdata_item->desc;
+}
+
+/*
+ * Update the header for the items just written and refresh the view to
+ * cover the updated buffer without validating it again.
+ */
 void
-platform_data_update_header(void *pdata, void *pdata_item,
-			    unsigned long pdata_item_len)
+platform_data_update_header(platform_data_view_t *view, void *pdata,
+			    void *pdata_item, unsigned long pdata_item_len,
+			    unsigned long nr_pdata_item)
 {
 	platform_data_header_t *pdata_header = pdata;
 	pdata_header->length = pdata_item_len;
 	pdata_header->crc32 = crc32(pdata_item, pdata_item_len);
+
+	if (view) {
+		view->header = pdata_header;
+		view->len = sizeof(*pdata_header) + pdata_item_len;
+		view->nr_item = nr_pdata_item;
+		view->crc32 = pdata_header->crc32;
+		view->crc32_valid = 1;
+	}
 }
 
 uint32_t
@@ -78,16 +99,21 @@ platform_data_cert_header(void *pdata_item_buf)
 	return *(uint32_t *)(pdata_item + 1);
 }
 
-err_status_t
-platform_data_probe(void *pdata_buf, unsigned long *pdata_buf_len)
+static err_status_t
+__platform_data_probe(void *pdata_buf, unsigned long pdata_buf_len,
+		      platform_data_view_t *view)
 {
 	buffer_stream_t bs;
 	platform_data_header_t *pdata;
 	unsigned long nr_pdata_item;
-	uint16_t total_item_len;
+	uint32_t total_item_len;
+	uint32_t crc;
 	err_status_t err;
 
-	bs_init(&bs, pdata_buf, *pdata_buf_len);
+	if (!view)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	bs_init(&bs, pdata_buf, pdata_buf_len);
 
 	err = bs_post_get(&bs, (void **)&pdata, sizeof(*pdata));
 	if (is_err_status(err)) {
@@ -146,23 +172,74 @@ platform_data_probe(void *pdata_buf, unsigned long *pdata_buf_len)
 		return CLN_FW_ERR_INVALID_PDATA;
 	}
 
-	if (crc32((uint8_t *)(pdata + 1), pdata->length) != pdata->crc32) {
+	crc = crc32((uint8_t *)(pdata + 1), pdata->length);
+	if (crc != pdata->crc32) {
 		err(T("Invalid platform data CRC32: 0x%x\n"), pdata->crc32);
 		return CLN_FW_ERR_INVALID_PDATA;
 	}
 
-	*pdata_buf_len = bs_tell(&bs);
+	view->header = pdata;
+	view->len = bs_tell(&bs);
+	view->nr_item = nr_pdata_item;
+	view->crc32 = crc;
+	view->crc32_valid = 1;
 
 	return CLN_FW_ERR_NONE;
 }
 
+err_status_t
+platform_data_probe(void *pdata_buf, unsigned long pdata_buf_len,
+		    platform_data_view_t *view)
+{
+	uint64_t start = stats_timer_start();
+	err_status_t err;
+
+	err = __platform_data_probe(pdata_buf, pdata_buf_len, view);
+	stats_timer_stop(CLN_FW_STAT_PDATA_PROBE, start);
+
+	return err;
+}
+
+/* Must be called once the buffer covered by the view is mutated */
 void
+platform_data_view_invalidate(platform_data_view_t *view)
+{
+	view->crc32_valid = 0;
+}
+
+/*
+ * The structure of items is validated by probe. Only the CRC needs to
+ * be checked again if the buffer was mutated since then.
+ */
+err_status_t
+platform_data_view_verify(platform_data_view_t *view)
+{
+	platform_data_header_t *pdata = view->header;
+
+	if (!pdata)
+		return CLN_FW_ERR_INVALID_PDATA;
+
+	if (view->crc32_valid)
+		return CLN_FW_ERR_NONE;
+
+	view->crc32 = crc32((uint8_t *)(pdata + 1), pdata->length);
+	if (view->crc32 != pdata->crc32) {
+		err(T("Invalid platform data CRC32: 0x%x\n"), pdata->crc32);
+		return CLN_FW_ERR_INVALID_PDATA;
+	}
+
+	view->crc32_valid = 1;
+
+	return CLN_FW_ERR_NONE;
+}
+
+static void
 __platform_data_show(void *pdata_buf, unsigned long pdata_buf_len)
 {
 	platform_data_header_t *pdata;
 	platform_data_item_t *pdata_item;
 	unsigned long nr_pdata_item;
-	uint16_t total_item_len;
+	uint32_t total_item_len;
 
 	pdata = (platform_data_header_t *)pdata_buf;
 
@@ -205,57 +282,37 @@ __platform_data_show(void *pdata_buf, unsigned long pdata_buf_len)
 }
 
 err_status_t
-platform_data_show(void *pdata_buf, unsigned long pdata_buf_len)
+platform_data_show(platform_data_view_t *view)
 {
 	err_status_t err;
 
-	err = platform_data_probe(pdata_buf, &pdata_buf_len);
+	err = platform_data_view_verify(view);
 	if (is_err_status(err))
 		return err;
 
-	__platform_data_show(pdata_buf, pdata_buf_len);
+	__platform_data_show(view->header, view->len);
 
 	return CLN_FW_ERR_NONE;
 }
 
-static unsigned long
-count_pdata_item(platform_data_header_t *pdata)
-{
-	platform_data_item_t *pdata_item;
-	unsigned long nr_pdata_item;
-	uint16_t total_item_len;
-
-	pdata_item = (platform_data_item_t *)(pdata + 1);
-	for (nr_pdata_item = 0, total_item_len = 0;
-			total_item_len < pdata->length; ++nr_pdata_item) {
-		uint8_t *pdata_item_data = (uint8_t *)(pdata_item + 1);
-
-		total_item_len += sizeof(*pdata_item) + pdata_item->length;
-		pdata_item = (platform_data_item_t *)(pdata_item_data
-			      + pdata_item->length);
-	}
-
-	return nr_pdata_item;
-}
-
 err_status_t
-platform_data_parse(void *pdata_buf, unsigned long pdata_buf_len,
+platform_data_parse(arena_t *arena, platform_data_view_t *view,
 		    void **out_pdata_header_buf, void **out_pdata_item_buf,
 		    unsigned long *out_nr_pdata_item)
 {
 	platform_data_header_t *pdata;
 	err_status_t err;
 
-	err = platform_data_probe(pdata_buf, &pdata_buf_len);
+	err = platform_data_view_verify(view);
 	if (is_err_status(err))
 		return err;
 
-	pdata = (platform_data_header_t *)pdata_buf;
+	pdata = view->header;
 
 	if (out_pdata_header_buf) {
 		platform_data_header_t *out_pdata;
 
-		out_pdata = eee_malloc(sizeof(*out_pdata));
+		out_pdata = arena_alloc(arena, sizeof(*out_pdata));
 		if (!out_pdata)
 			return CLN_FW_ERR_OUT_OF_MEM;
 
@@ -267,10 +324,10 @@ platform_data_parse(void *pdata_buf, unsigned long pdata_buf_len,
 		platform_data_item_t *pdata_item, *out_pdata_item;
 
 		pdata_item = (platform_data_item_t *)(pdata + 1);
-		out_pdata_item = eee_malloc(pdata->length);
+		out_pdata_item = arena_alloc(arena, pdata->length);
 		if (!out_pdata_item) {
 			if (out_pdata_header_buf)
-				eee_mfree(*out_pdata_header_buf);
+				arena_free(arena, *out_pdata_header_buf);
 			return CLN_FW_ERR_OUT_OF_MEM;
 		}
 
@@ -279,51 +336,7 @@ platform_data_parse(void *pdata_buf, unsigned long pdata_buf_len,
 	}
 
 	if (out_nr_pdata_item)
-		*out_nr_pdata_item = count_pdata_item(pdata);
-
-	return CLN_FW_ERR_NONE;
-}
-
-static int
-search_pdata_item(platform_data_header_t *pdata, uint16_t id,
-		   platform_data_item_t **out)
-{
-	platform_data_item_t *pdata_item;
-	unsigned long total_item_len;
-
-	pdata_item = (platform_data_item_t *)(pdata + 1);
-	for (total_item_len = 0; total_item_len < pdata->length;) {
-		uint8_t *item_data;
-
-		if (id == pdata_item->id) {
-			if (out)
-				*out = pdata_item;
-			return 1;
-		}
-		total_item_len += sizeof(*pdata_item) + pdata_item->length;
-		item_data = (uint8_t *)(pdata_item + 1);
-		pdata_item = (platform_data_item_t *)(item_data
-			      + pdata_item->length);
-	}
-
-	return 0;
-}
-
-err_status_t
-platform_data_search_item(void *pdata_buf, unsigned long pdata_buf_len,
-			   uint16_t id)
-{
-	platform_data_header_t *pdata;
-	platform_data_item_t *pdata_item;
-	err_status_t err;
-
-	err = platform_data_probe(pdata_buf, &pdata_buf_len);
-	if (is_err_status(err))
-		return err;
-
-	pdata = (platform_data_header_t *)pdata_buf;
-	if (!search_pdata_item(pdata, id, &pdata_item))
-		return CLN_FW_ERR_PDATA_ITEM_NOT_FOUND;
+		*out_nr_pdata_item = view->nr_item;
 
 	return CLN_FW_ERR_NONE;
 }
@@ -340,8 +353,9 @@ init_pdata_item(platform_data_item_t *item, uint16_t id, uint16_t version,
 }
 
 err_status_t
-platform_data_create_item(uint16_t id, uint16_t version, const char desc[10],
-			  uint8_t *data, uint16_t data_len, void **out,
+platform_data_create_item(arena_t *arena, uint16_t id, uint16_t version,
+			  const char desc[10], uint8_t *data,
+			  uint16_t data_len, void **out,
 			  unsigned long *out_len)
 {
 	platform_data_item_t *pdata_item;
@@ -349,7 +363,7 @@ platform_data_create_item(uint16_t id, uint16_t version, const char desc[10],
 	if (!out && !out_len)
 		return CLN_FW_ERR_INVALID_PARAMETER;
 
-	pdata_item = eee_malloc(sizeof(*pdata_item) + data_len);
+	pdata_item = arena_alloc(arena, sizeof(*pdata_item) + data_len);
 	if (!pdata_item)
 		return CLN_FW_ERR_OUT_OF_MEM;
 
@@ -365,7 +379,7 @@ platform_data_create_item(uint16_t id, uint16_t version, const char desc[10],
 }
 
 err_status_t
-platform_data_update_item(void *pdata_item_buf,
+platform_data_update_item(arena_t *arena, void *pdata_item_buf,
 			  unsigned long pdata_item_buf_len,
 			  uint16_t id, uint16_t *version,
 			  const char desc[10], uint8_t *data,
@@ -373,9 +387,7 @@ platform_data_update_item(void *pdata_item_buf,
 			  unsigned long *out_len)
 {
 	platform_data_item_t *pdata_item;
-	buffer_stream_t bs;
 	unsigned long pdata_item_len;
-	err_status_t err;
 
 	if (!out && !out_len)
 		return CLN_FW_ERR_INVALID_PARAMETER;
@@ -384,14 +396,18 @@ platform_data_update_item(void *pdata_item_buf,
 			platform_data_item_size((void *)pdata_item_buf))
 		return CLN_FW_ERR_INVALID_PARAMETER;
 
-	bs_init(&bs, pdata_item_buf, pdata_item_buf_len);
-
-	err = bs_reserve_at(&bs, data_len, sizeof(*pdata_item));
-	if (is_err_status(err))
-		return err;
-
+	/* Update in place unless the item grows */
 	pdata_item_len = sizeof(*pdata_item) + data_len;
-	bs_get_at(&bs, (void **)&pdata_item, pdata_item_len, 0);
+	if (pdata_item_len > pdata_item_buf_len) {
+		pdata_item = arena_alloc(arena, pdata_item_len);
+		if (!pdata_item) {
+			err(T("Failed to extend out buffer\n"));
+			return CLN_FW_ERR_OUT_OF_MEM;
+		}
+
+		eee_memcpy(pdata_item, pdata_item_buf, pdata_item_buf_len);
+	} else
+		pdata_item = pdata_item_buf;
 
 	if (version)
 		pdata_item->version = *version;
@@ -410,4 +426,4 @@ platform_data_update_item(void *pdata_item_buf,
 		*out_len = pdata_item_len;
 
 	return CLN_FW_ERR_NONE;
-}
\ No newline at end of file
+}
@@ -70,4 +70,19 @@ typedef struct {
 
 #pragma pack()
 
+/*
+ * The view of a platform data buffer validated by platform_data_probe().
+ * The other platform data functions take it to avoid validating the
+ * same buffer again.
+ */
+typedef struct {
+	platform_data_header_t *header;
+	/* The length of header and all items */
+	unsigned long len;
+	unsigned long nr_item;
+	/* CRC32 of all items, valid until the buffer is mutated */
+	uint32_t crc32;
+	int crc32_valid;
+} platform_data_view_t;
+
 #endif	/* __PLATFORM_DATA_H__ */
\ No newline at end of file
@@ -0,0 +1,241 @@
+/*
+ * Firmware region enumeration
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <stdarg.h>
+#include <err_status.h>
+#include <cln_fw.h>
+#include "internal.h"
+#include "buffer_stream.h"
+#include "mfh.h"
+#include "csbh.h"
+
+err_status_t
+cln_fw_parser_flash_offset(cln_fw_parser_t *parser, uint32_t addr,
+			   uint32_t len, unsigned long *offset)
+{
+	return mfh_flash_offset(addr, len, bs_size(&parser->firmware), offset);
+}
+
+static unsigned long
+sub_stream_offset(cln_fw_parser_t *parser, buffer_stream_t *bs)
+{
+	return bs_head(bs) - bs_head(&parser->firmware);
+}
+
+static void
+set_region(cln_fw_region_t *region, unsigned long offset,
+	   unsigned long length, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(region->name, sizeof(region->name), fmt, ap);
+	va_end(ap);
+
+	region->offset = offset;
+	region->length = length;
+}
+
+/* Add the platform data header and the items laid out in the firmware */
+static unsigned long
+pdata_regions(cln_fw_parser_t *parser, cln_fw_region_t *region)
+{
+	buffer_stream_t *pdata = &parser->pdata;
+	unsigned long nr, i, offset, end;
+
+	offset = sub_stream_offset(parser, pdata);
+	end = offset + bs_size(pdata);
+	set_region(region, offset, platform_data_header_size(),
+		   "platform data header");
+	offset += platform_data_header_size();
+	nr = 1;
+
+	for (i = 0; i < parser->pdata_view.nr_item; ++i) {
+		platform_data_item_t *item;
+		unsigned long len;
+
+		if (offset + sizeof(*item) > end)
+			break;
+
+		item = bs_head(&parser->firmware) + offset;
+		len = platform_data_item_size(item);
+		if (offset + len > end)
+			break;
+
+		set_region(region + nr++, offset, len,
+			   "platform data item %ld (%.10s)", i, item->desc);
+		offset += len;
+	}
+
+	return nr;
+}
+
+static unsigned long
+skm_regions(cln_fw_parser_t *parser, csbh_context_t *csbh,
+	    cln_fw_region_t *region)
+{
+	unsigned long nr, i, nr_field, offset;
+
+	offset = sub_stream_offset(parser, &parser->skm);
+	nr_field = csbh->nr_field(csbh);
+	for (i = 0, nr = 0; i < nr_field; ++i) {
+		const char *name;
+		unsigned long field_offset, len;
+
+		csbh->get_field(csbh, i, &name, &field_offset, &len);
+		if (!len)
+			continue;
+
+		set_region(region + nr++, offset + field_offset, len,
+			   "skm csbh %s", name);
+	}
+
+	return nr;
+}
+
+static err_status_t
+collect_regions(cln_fw_parser_t *parser, int detailed,
+		cln_fw_region_t **out, unsigned long *nr_region)
+{
+	cln_fw_region_t *region;
+	mfh_context_t *mfh_ctx;
+	mfh_item_iter_t iter;
+	csbh_context_t *csbh;
+	unsigned long nr, max_nr, nr_item;
+	err_status_t err;
+
+	if (!out || !nr_region)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	mfh_ctx = NULL;
+	nr_item = 0;
+	if (!bs_empty(&parser->mfh)) {
+		err = mfh_context_new(parser->arena, &mfh_ctx);
+		if (is_err_status(err))
+			return err;
+
+		err = mfh_ctx->probe(mfh_ctx, bs_head(&parser->mfh),
+				     bs_size(&parser->mfh));
+		if (is_err_status(err)) {
+			mfh_ctx->destroy(mfh_ctx);
+			return err;
+		}
+
+		nr_item = mfh_ctx->nr_item(mfh_ctx);
+	}
+
+	/* Image, MFH, platform data, SKM and all flash items */
+	max_nr = 4 + nr_item;
+
+	csbh = NULL;
+	if (detailed) {
+		/* Platform data header and items */
+		max_nr += 1 + parser->pdata_view.nr_item;
+
+		/* The CSBH is optional for the details */
+		if (!bs_empty(&parser->skm)
+				&& !is_err_status(csbh_context_new(parser->arena,
+								   &csbh))) {
+			err = csbh->probe(csbh, bs_head(&parser->skm),
+					  bs_size(&parser->skm));
+			if (is_err_status(err)) {
+				csbh->destroy(csbh);
+				csbh = NULL;
+			} else
+				max_nr += csbh->nr_field(csbh);
+		}
+	}
+
+	region = eee_malloc(max_nr * sizeof(*region));
+	if (!region) {
+		err = CLN_FW_ERR_OUT_OF_MEM;
+		goto out;
+	}
+
+	nr = 0;
+	set_region(region + nr++, 0, bs_size(&parser->firmware), "image");
+
+	if (mfh_ctx) {
+		set_region(region + nr++,
+			   sub_stream_offset(parser, &parser->mfh),
+			   bs_size(&parser->mfh), "mfh");
+
+		mfh_item_iter_init(&iter, MFH_ITEM_ANY,
+				   bs_head(&parser->firmware),
+				   bs_size(&parser->firmware));
+		while (!is_err_status(mfh_ctx->iterate(mfh_ctx, &iter))) {
+			if (!iter.len)
+				continue;
+
+			if (!iter.data) {
+				warn(T("MFH flash item %ld is out of the ")
+				     T("firmware: 0x%x@0x%x\n"), iter.index,
+				     iter.len, iter.addr);
+				continue;
+			}
+
+			set_region(region + nr++,
+				   iter.data - bs_head(&parser->firmware),
+				   iter.len, "mfh item %ld (%s)", iter.index,
+				   mfh_flash_item_type_name(iter.type));
+		}
+	}
+
+	if (!bs_empty(&parser->pdata)) {
+		set_region(region + nr++,
+			   sub_stream_offset(parser, &parser->pdata),
+			   bs_size(&parser->pdata), "platform data");
+
+		if (detailed)
+			nr += pdata_regions(parser, region + nr);
+	}
+
+	if (!bs_empty(&parser->skm)) {
+		set_region(region + nr++,
+			   sub_stream_offset(parser, &parser->skm),
+			   bs_size(&parser->skm), "skm");
+
+		if (csbh)
+			nr += skm_regions(parser, csbh, region + nr);
+	}
+
+	*out = region;
+	*nr_region = nr;
+	err = CLN_FW_ERR_NONE;
+
+out:
+	if (csbh)
+		csbh->destroy(csbh);
+
+	if (mfh_ctx)
+		mfh_ctx->destroy(mfh_ctx);
+
+	return err;
+}
+
+err_status_t
+cln_fw_parser_regions(cln_fw_parser_t *parser, cln_fw_region_t **out,
+		      unsigned long *nr_region)
+{
+	return collect_regions(parser, 0, out, nr_region);
+}
+
+/*
+ * Enumerate the regions down to the platform data items and the CSBH
+ * fields of SKM, in addition to the ones by cln_fw_parser_regions().
+ */
+err_status_t
+cln_fw_parser_detailed_regions(cln_fw_parser_t *parser,
+			       cln_fw_region_t **out,
+			       unsigned long *nr_region)
+{
+	return collect_regions(parser, 1, out, nr_region);
+}
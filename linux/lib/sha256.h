@@ -0,0 +1,38 @@
+/*
+ * SHA-256 API
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#ifndef __SHA256_H__
+#define __SHA256_H__
+
+#include <eee.h>
+
+#define SHA256_DIGEST_SIZE			32
+#define SHA256_BLOCK_SIZE			64
+
+typedef struct {
+	uint32_t state[8];
+	uint64_t count;
+	uint8_t buf[SHA256_BLOCK_SIZE];
+} sha256_context_t;
+
+void
+sha256_init(sha256_context_t *ctx);
+
+void
+sha256_update(sha256_context_t *ctx, const void *data, unsigned long len);
+
+void
+sha256_final(sha256_context_t *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+void
+sha256(const void *data, unsigned long len,
+       uint8_t digest[SHA256_DIGEST_SIZE]);
+
+#endif	/* __SHA256_H__ */
@@ -15,6 +15,7 @@
 #include "class.h"
 #include "csbh.h"
 #include "skm.h"
+#include "stats.h"
 
 #define SKM_SIZE		(32 * 1024)
 #define SKM_OFFSET		(-0x28000)
@@ -47,6 +48,28 @@ skm_offset(void)
 	return SKM_OFFSET;
 }
 
+/* Wrap the stage1 public key with CSBH. The modulus is left as is */
+err_status_t
+skm_create(void *skm_buf, unsigned long skm_buf_len)
+{
+	stage1_rsa_pubkey_t *stage1_key;
+	err_status_t err;
+
+	if (skm_buf_len > SKM_SIZE)
+		skm_buf_len = SKM_SIZE;
+
+	err = csbh_create(skm_buf, skm_buf_len, sizeof(*stage1_key),
+			  (void **)&stage1_key);
+	if (is_err_status(err))
+		return err;
+
+	stage1_key->ModulusSize = sizeof(stage1_key->Modulus);
+	stage1_key->ExponentSize = sizeof(stage1_key->Exponent);
+	stage1_key->Exponent = 65537;
+
+	return CLN_FW_ERR_NONE;
+}
+
 static void
 show_skm(skm_context_t *ctx)
 {
@@ -70,7 +93,7 @@ show_skm(skm_context_t *ctx)
 }
 
 static err_status_t
-probe_skm(skm_context_t *ctx, void *buf, unsigned long buf_len)
+__probe_skm(skm_context_t *ctx, void *buf, unsigned long buf_len)
 {
 	buffer_stream_t bs;
 	csbh_context_t *csbh;
@@ -82,7 +105,7 @@ probe_skm(skm_context_t *ctx, void *buf, unsigned long buf_len)
 		return CLN_FW_ERR_INVALID_PARAMETER;
 
 	csbh = NULL;
-	err = csbh_context_new(&csbh);
+	err = csbh_context_new(obj_arena(ctx), &csbh);
 	if (is_err_status(err))
 		return err;
 
@@ -101,7 +124,7 @@ probe_skm(skm_context_t *ctx, void *buf, unsigned long buf_len)
 		return err;
 	}
 
-	priv = eee_malloc(sizeof(*priv));
+	priv = arena_alloc(obj_arena(ctx), sizeof(*priv));
 	if (!priv) {
 		csbh->destroy(csbh);
 		return CLN_FW_ERR_OUT_OF_MEM;
@@ -115,6 +138,18 @@ probe_skm(skm_context_t *ctx, void *buf, unsigned long buf_len)
 	return CLN_FW_ERR_NONE;
 }
 
+static err_status_t
+probe_skm(skm_context_t *ctx, void *buf, unsigned long buf_len)
+{
+	uint64_t start = stats_timer_start();
+	err_status_t err;
+
+	err = __probe_skm(ctx, buf, buf_len);
+	stats_timer_stop(CLN_FW_STAT_SKM_PROBE, start);
+
+	return err;
+}
+
 static void
 destroy_skm(skm_context_t *ctx)
 {
@@ -129,7 +164,7 @@ skm_context_dtor(void *ctx)
 	if (priv) {
 		if (priv->csbh)
 			priv->csbh->destroy(priv->csbh);
-		eee_mfree(priv);
+		arena_free(obj_arena(ctx), priv);
 	}
 }
 
@@ -147,13 +182,15 @@ skm_context_ctor(void *ctx)
 	return CLN_FW_ERR_NONE;
 }
 
+static class_handle_t skm_context_class;
+
 err_status_t
-skm_context_new(skm_context_t **ctx)
+skm_context_new(arena_t *arena, skm_context_t **ctx)
 {
 	if (!ctx)
 		return CLN_FW_ERR_INVALID_PARAMETER;
 
-	return obj_new("skm_context_t", ctx);
+	return obj_new_from(arena, skm_context_class, ctx);
 }
 
 err_status_t
@@ -161,5 +198,5 @@ skm_context_class_init(void)
 {
 	return class_register("skm_context_t", NULL,
 			      skm_context_ctor, skm_context_dtor,
-			      sizeof(skm_context_t));
+			      sizeof(skm_context_t), &skm_context_class);
 }
\ No newline at end of file
@@ -30,9 +30,12 @@ skm_size(void);
 long
 skm_offset(void);
 
+err_status_t
+skm_create(void *skm_buf, unsigned long skm_buf_len);
+
 err_status_t
 skm_context_class_init(void);
 err_status_t
-skm_context_new(skm_context_t **ctx);
+skm_context_new(arena_t *arena, skm_context_t **ctx);
 
 #endif	/* __SKM_H__ */
\ No newline at end of file
@@ -0,0 +1,120 @@
+/*
+ * Statistics of the library
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <err_status.h>
+#include <cln_fw.h>
+#include <time.h>
+#include "class.h"
+#include "stats.h"
+
+static const char *stat_name[CLN_FW_STAT_MAX] = {
+	[CLN_FW_STAT_LOAD_FILE] = "load_file",
+	[CLN_FW_STAT_PARSE] = "parse",
+	[CLN_FW_STAT_MFH_PROBE] = "mfh_probe",
+	[CLN_FW_STAT_PDATA_PROBE] = "platform_data_probe",
+	[CLN_FW_STAT_SKM_PROBE] = "skm_probe",
+	[CLN_FW_STAT_CSBH_PROBE] = "csbh_probe",
+	[CLN_FW_STAT_CRC32] = "crc32",
+	[CLN_FW_STAT_FLUSH] = "flush",
+	[CLN_FW_STAT_SAVE_FILE] = "save_output_file",
+};
+
+const char *
+cln_fw_stat_name(cln_fw_stat_t stat)
+{
+	if (stat >= CLN_FW_STAT_MAX)
+		return NULL;
+
+	return stat_name[stat];
+}
+
+#ifdef CLN_FW_STATS
+static int stats_enabled;
+
+/* Shared by all threads */
+static cln_fw_stats_t stats;
+
+int
+stats_is_enabled(void)
+{
+	return __atomic_load_n(&stats_enabled, __ATOMIC_RELAXED);
+}
+
+uint64_t
+stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+stats_add_time(cln_fw_stat_t stat, uint64_t start)
+{
+	cln_fw_stat_timer_t *timer = stats.timer + stat;
+
+	__atomic_add_fetch(&timer->count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&timer->nsec, stats_now() - start,
+			   __ATOMIC_RELAXED);
+}
+
+void
+stats_add_alloc(unsigned long size)
+{
+	__atomic_add_fetch(&stats.nr_alloc, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&stats.alloc_bytes, size, __ATOMIC_RELAXED);
+}
+
+err_status_t
+cln_fw_stats_enable(int enable)
+{
+	__atomic_store_n(&stats_enabled, !!enable, __ATOMIC_RELAXED);
+
+	return CLN_FW_ERR_NONE;
+}
+
+err_status_t
+cln_fw_stats_get(cln_fw_stats_t *out)
+{
+	unsigned int i;
+
+	if (!out)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	for (i = 0; i < CLN_FW_STAT_MAX; ++i) {
+		out->timer[i].count = __atomic_load_n(&stats.timer[i].count,
+						      __ATOMIC_RELAXED);
+		out->timer[i].nsec = __atomic_load_n(&stats.timer[i].nsec,
+						     __ATOMIC_RELAXED);
+	}
+
+	out->nr_alloc = __atomic_load_n(&stats.nr_alloc, __ATOMIC_RELAXED);
+	out->alloc_bytes = __atomic_load_n(&stats.alloc_bytes,
+					   __ATOMIC_RELAXED);
+	class_pool_stats(NULL, &out->nr_pool_hit, &out->nr_pool_miss);
+
+	return CLN_FW_ERR_NONE;
+}
+#else
+err_status_t
+cln_fw_stats_enable(int enable)
+{
+	return CLN_FW_ERR_UNSUPPORTED;
+}
+
+err_status_t
+cln_fw_stats_get(cln_fw_stats_t *out)
+{
+	return CLN_FW_ERR_UNSUPPORTED;
+}
+#endif
@@ -0,0 +1,76 @@
+/*
+ * Statistics of the library
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <eee.h>
+#include <cln_fw.h>
+
+/*
+ * The timers are inclusive, e.g, the time of crc32 called by a probe is
+ * also counted in the probe. Without CLN_FW_STATS, the hooks below are
+ * empty and compiled out.
+ */
+#ifdef CLN_FW_STATS
+int
+stats_is_enabled(void);
+
+uint64_t
+stats_now(void);
+
+void
+stats_add_time(cln_fw_stat_t stat, uint64_t start);
+
+void
+stats_add_alloc(unsigned long size);
+
+static inline uint64_t
+stats_timer_start(void)
+{
+	if (!stats_is_enabled())
+		return 0;
+
+	return stats_now();
+}
+
+static inline void
+stats_timer_stop(cln_fw_stat_t stat, uint64_t start)
+{
+	/* The timer started before the statistics were enabled */
+	if (start)
+		stats_add_time(stat, start);
+}
+
+static inline void
+stats_count_alloc(unsigned long size)
+{
+	if (stats_is_enabled())
+		stats_add_alloc(size);
+}
+#else
+static inline uint64_t
+stats_timer_start(void)
+{
+	return 0;
+}
+
+static inline void
+stats_timer_stop(cln_fw_stat_t stat, uint64_t start)
+{
+}
+
+static inline void
+stats_count_alloc(unsigned long size)
+{
+}
+#endif
+
+#endif	/* __STATS_H__ */
@@ -0,0 +1,181 @@
+/*
+ * Fixed-size thread pool
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <err_status.h>
+#include <cln_fw.h>
+#include <pthread.h>
+#include "internal.h"
+#include "bcll.h"
+#include "thread_pool.h"
+
+typedef struct {
+	bcll_t link;
+	thread_pool_fn_t fn;
+	void *arg;
+} thread_pool_job_t;
+
+struct __thread_pool {
+	pthread_mutex_t lock;
+	/* Signaled when a job is queued or the pool is shutting down */
+	pthread_cond_t job_cond;
+	/* Signaled when the last pending job completes */
+	pthread_cond_t idle_cond;
+	bcll_t job_list;
+	unsigned long nr_pending;
+	int shutdown;
+	unsigned int nr_thread;
+	pthread_t thread[0];
+};
+
+unsigned int
+thread_pool_nr_cpu(void)
+{
+	long nr_cpu;
+
+	nr_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_cpu < 1)
+		return 1;
+
+	return nr_cpu;
+}
+
+static void *
+thread_pool_worker(void *arg)
+{
+	thread_pool_t *pool = arg;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (1) {
+		thread_pool_job_t *job;
+
+		while (bcll_empty(&pool->job_list) && !pool->shutdown)
+			pthread_cond_wait(&pool->job_cond, &pool->lock);
+
+		if (bcll_empty(&pool->job_list))
+			break;
+
+		job = container_of(pool->job_list.next, thread_pool_job_t,
+				   link);
+		bcll_del(&job->link);
+		pthread_mutex_unlock(&pool->lock);
+
+		job->fn(job->arg);
+		eee_mfree(job);
+
+		pthread_mutex_lock(&pool->lock);
+		if (!--pool->nr_pending)
+			pthread_cond_broadcast(&pool->idle_cond);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+err_status_t
+thread_pool_create(unsigned int nr_thread, thread_pool_t **out)
+{
+	thread_pool_t *pool;
+	unsigned int i;
+
+	if (!out)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	if (!nr_thread)
+		nr_thread = thread_pool_nr_cpu();
+
+	pool = eee_malloc(sizeof(*pool) + nr_thread * sizeof(pthread_t));
+	if (!pool)
+		return CLN_FW_ERR_OUT_OF_MEM;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->job_cond, NULL);
+	pthread_cond_init(&pool->idle_cond, NULL);
+	bcll_init(&pool->job_list);
+	pool->nr_pending = 0;
+	pool->shutdown = 0;
+
+	for (i = 0; i < nr_thread; ++i) {
+		if (pthread_create(pool->thread + i, NULL, thread_pool_worker,
+				   pool))
+			break;
+	}
+
+	pool->nr_thread = i;
+	if (!i) {
+		thread_pool_destroy(pool);
+		return CLN_FW_ERR_OUT_OF_MEM;
+	}
+
+	*out = pool;
+
+	return CLN_FW_ERR_NONE;
+}
+
+err_status_t
+thread_pool_submit(thread_pool_t *pool, thread_pool_fn_t fn, void *arg)
+{
+	thread_pool_job_t *job;
+
+	if (!pool || !fn)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	job = eee_malloc(sizeof(*job));
+	if (!job)
+		return CLN_FW_ERR_OUT_OF_MEM;
+
+	job->fn = fn;
+	job->arg = arg;
+
+	pthread_mutex_lock(&pool->lock);
+	bcll_add_tail(&pool->job_list, &job->link);
+	++pool->nr_pending;
+	pthread_cond_signal(&pool->job_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	return CLN_FW_ERR_NONE;
+}
+
+void
+thread_pool_wait(thread_pool_t *pool)
+{
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->nr_pending)
+		pthread_cond_wait(&pool->idle_cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void
+thread_pool_destroy(thread_pool_t *pool)
+{
+	unsigned int i;
+
+	if (!pool)
+		return;
+
+	/* The queued jobs are drained before the workers exit */
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->job_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nr_thread; ++i)
+		pthread_join(pool->thread[i], NULL);
+
+	pthread_cond_destroy(&pool->idle_cond);
+	pthread_cond_destroy(&pool->job_cond);
+	pthread_mutex_destroy(&pool->lock);
+	eee_mfree(pool);
+}
@@ -0,0 +1,36 @@
+/*
+ * Thread pool API
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <eee.h>
+#include <err_status.h>
+
+typedef struct __thread_pool		thread_pool_t;
+
+typedef void (*thread_pool_fn_t)(void *arg);
+
+unsigned int
+thread_pool_nr_cpu(void);
+
+err_status_t
+thread_pool_create(unsigned int nr_thread, thread_pool_t **out);
+
+err_status_t
+thread_pool_submit(thread_pool_t *pool, thread_pool_fn_t fn, void *arg);
+
+void
+thread_pool_wait(thread_pool_t *pool);
+
+void
+thread_pool_destroy(thread_pool_t *pool);
+
+#endif	/* __THREAD_POOL_H__ */
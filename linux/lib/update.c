@@ -0,0 +1,340 @@
+/*
+ * MFH flash item replacement and addition
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <err_status.h>
+#include <cln_fw.h>
+#include "internal.h"
+#include "buffer_stream.h"
+#include "mfh.h"
+#include "skm.h"
+#include "layout.h"
+
+typedef struct {
+	unsigned long offset;
+	unsigned long len;
+} extent_t;
+
+typedef struct {
+	uint8_t *fw;
+	unsigned long fw_len;
+	void *mfh;
+	unsigned long mfh_len;
+	layout_t *layout;
+	/* The extents of items in the image, indexed as in MFH */
+	extent_t *item;
+	unsigned long nr_item;
+} update_t;
+
+static int
+overlapped(extent_t *e, unsigned long offset, unsigned long len)
+{
+	return e->len && offset < e->offset + e->len
+	       && e->offset < offset + len;
+}
+
+static void
+update_fini(update_t *u)
+{
+	eee_mfree(u->item);
+	layout_destroy(u->layout);
+}
+
+static err_status_t
+update_init(update_t *u, uint8_t *fw, unsigned long fw_len,
+	    unsigned long erase_block, unsigned long nr_add)
+{
+	mfh_context_t *mfh_ctx;
+	mfh_item_iter_t iter;
+	err_status_t err;
+
+	if (fw_len < (unsigned long)-mfh_offset())
+		return CLN_FW_ERR_INVALID_MFH;
+
+	eee_memset(u, 0, sizeof(*u));
+	u->fw = fw;
+	u->fw_len = fw_len;
+	u->mfh = fw + fw_len + mfh_offset();
+	u->mfh_len = platform_data_offset() - mfh_offset();
+
+	err = layout_create(fw, fw_len, erase_block, &u->layout);
+	if (is_err_status(err))
+		return err;
+
+	/* MFH, platform data and SKM are fixed */
+	layout_reserve(u->layout, fw_len + mfh_offset(), u->mfh_len);
+	layout_reserve(u->layout, fw_len + platform_data_offset(),
+		       platform_data_max_size());
+	layout_reserve(u->layout, fw_len + skm_offset(), skm_size());
+
+	err = mfh_context_new(NULL, &mfh_ctx);
+	if (is_err_status(err))
+		goto err_mfh;
+
+	err = mfh_ctx->probe(mfh_ctx, u->mfh, u->mfh_len);
+	if (is_err_status(err))
+		goto out;
+
+	/* Leave the room for the items added */
+	u->item = eee_malloc((mfh_ctx->nr_item(mfh_ctx) + nr_add)
+			     * sizeof(*u->item));
+	if (!u->item) {
+		err = CLN_FW_ERR_OUT_OF_MEM;
+		goto out;
+	}
+
+	mfh_item_iter_init(&iter, MFH_ITEM_ANY, fw, fw_len);
+	while (!is_err_status(mfh_ctx->iterate(mfh_ctx, &iter))) {
+		extent_t *e = u->item + u->nr_item++;
+
+		/* The items out of the image don't take any room */
+		e->offset = iter.data ? (uint8_t *)iter.data - fw : 0;
+		e->len = iter.data ? iter.len : 0;
+		layout_reserve(u->layout, e->offset, e->len);
+	}
+
+out:
+	mfh_ctx->destroy(mfh_ctx);
+
+err_mfh:
+	if (is_err_status(err))
+		update_fini(u);
+
+	return err;
+}
+
+static err_status_t
+place_item(update_t *u, unsigned long index, const void *data,
+	   unsigned long len, unsigned long *out)
+{
+	extent_t *e = u->item + index;
+	unsigned long i, offset, prefer;
+	err_status_t err;
+
+	/* Nothing is written if the contents are the same */
+	if (e->len == len && !eee_memcmp(u->fw + e->offset, data, len)) {
+		*out = e->offset;
+		return CLN_FW_ERR_NONE;
+	}
+
+	prefer = e->len ? e->offset : LAYOUT_NO_PREFERENCE;
+
+	/* The extent shared with other items is left alone */
+	for (i = 0; i < u->nr_item && prefer != LAYOUT_NO_PREFERENCE; ++i) {
+		if (i != index && overlapped(u->item + i, e->offset, e->len))
+			prefer = LAYOUT_NO_PREFERENCE;
+	}
+
+	if (prefer != LAYOUT_NO_PREFERENCE) {
+		layout_release(u->layout, e->offset, e->len);
+
+		/* Rewriting in place competes with moving if it fits */
+		if (len > e->len)
+			prefer = LAYOUT_NO_PREFERENCE;
+	}
+	e->len = 0;
+
+	err = layout_place(u->layout, len, prefer, &offset);
+	if (is_err_status(err)) {
+		err(T("No room for 0x%lx bytes of flash item\n"), len);
+		return err;
+	}
+
+	eee_memcpy(u->fw + offset, data, len);
+	e->offset = offset;
+	e->len = len;
+	*out = offset;
+
+	return CLN_FW_ERR_NONE;
+}
+
+static err_status_t
+apply_update(update_t *u, const cln_fw_item_update_t *update)
+{
+	unsigned long index, offset;
+	uint32_t addr;
+	err_status_t err;
+
+	if (!update->data || !update->data_len
+			|| update->data_len > 0xffffffffUL)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	if (update->index != CLN_FW_FLASH_ITEM_NEW) {
+		index = update->index;
+		if (index >= u->nr_item)
+			return CLN_FW_ERR_MFH_FLASH_ITEM_NOT_FOUND;
+
+		err = place_item(u, index, update->data, update->data_len,
+				 &offset);
+		if (is_err_status(err))
+			return err;
+
+		addr = mfh_flash_address(offset, u->fw_len);
+		mfh_move_flash_item(u->mfh, index, addr, update->data_len);
+
+		return CLN_FW_ERR_NONE;
+	}
+
+	index = u->nr_item;
+	u->item[index].len = 0;
+
+	err = place_item(u, index, update->data, update->data_len, &offset);
+	if (is_err_status(err))
+		return err;
+
+	addr = mfh_flash_address(offset, u->fw_len);
+	err = mfh_add_flash_item(u->mfh, u->mfh_len, update->type, addr,
+				 update->data_len, update->bootable, NULL);
+	if (is_err_status(err))
+		return err;
+
+	++u->nr_item;
+
+	return CLN_FW_ERR_NONE;
+}
+
+/* Parse the output again and read each item back through MFH */
+static err_status_t
+validate_update(void *fw, unsigned long fw_len,
+		const cln_fw_item_update_t *update, unsigned long *index,
+		unsigned long nr_update)
+{
+	cln_fw_parser_t *parser;
+	cln_fw_flash_item_t *item;
+	unsigned long i, nr_item;
+	err_status_t err;
+
+	err = cln_fw_parser_create(fw, fw_len, &parser);
+	if (is_err_status(err))
+		return err;
+
+	err = cln_fw_parser_parse(parser);
+	if (!is_err_status(err))
+		err = cln_fw_parser_flash_items(parser, &item, &nr_item);
+	if (is_err_status(err))
+		goto out;
+
+	for (i = 0; i < nr_update; ++i) {
+		cln_fw_flash_item_t *p = item + index[i];
+		unsigned long k;
+
+		/* The item may be replaced again by a later update */
+		for (k = i + 1; k < nr_update; ++k) {
+			if (index[k] == index[i])
+				break;
+		}
+		if (k < nr_update)
+			continue;
+
+		if (index[i] >= nr_item || p->offset == CLN_FW_OFFSET_NONE
+				|| p->length != update[i].data_len
+				|| eee_memcmp((uint8_t *)fw + p->offset,
+					      update[i].data,
+					      update[i].data_len)) {
+			err(T("Flash item %ld is corrupted by the ")
+			    T("update\n"), index[i]);
+			err = CLN_FW_ERR_INVALID_MFH;
+			break;
+		}
+	}
+
+	eee_mfree(item);
+
+out:
+	cln_fw_parser_destroy(parser);
+
+	return err;
+}
+
+/*
+ * Replace or add the flash items in a copy of the firmware. The layout
+ * planner places each item where the fewest erase blocks are dirtied,
+ * preferring the extent in place if it fits. MFH is rewritten
+ * accordingly and the cost to program the output over the input is
+ * estimated if asked for.
+ */
+err_status_t
+cln_fw_parser_update_flash_items(cln_fw_parser_t *parser,
+				 const cln_fw_item_update_t *update,
+				 unsigned long nr_update,
+				 unsigned long erase_block, void **out,
+				 unsigned long *out_len,
+				 cln_fw_flash_cost_t *cost)
+{
+	buffer_stream_t *fw = &parser->firmware;
+	unsigned long i, nr_add, fw_len = bs_size(fw);
+	unsigned long *index;
+	uint8_t *buf;
+	update_t u;
+	err_status_t err;
+
+	if (!update || !nr_update || !out || !out_len)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	err = cln_fw_parser_fetch_all(parser);
+	if (is_err_status(err))
+		return err;
+
+	buf = eee_malloc(fw_len);
+	index = eee_malloc(nr_update * sizeof(*index));
+	if (!buf || !index) {
+		err = CLN_FW_ERR_OUT_OF_MEM;
+		goto err_alloc;
+	}
+
+	eee_memcpy(buf, bs_head(fw), fw_len);
+
+	for (i = 0, nr_add = 0; i < nr_update; ++i) {
+		if (update[i].index == CLN_FW_FLASH_ITEM_NEW)
+			++nr_add;
+	}
+
+	err = update_init(&u, buf, fw_len, erase_block, nr_add);
+	if (is_err_status(err))
+		goto err_alloc;
+
+	for (i = 0; i < nr_update; ++i) {
+		index[i] = update[i].index == CLN_FW_FLASH_ITEM_NEW ?
+			   u.nr_item : update[i].index;
+
+		err = apply_update(&u, update + i);
+		if (is_err_status(err))
+			break;
+	}
+
+	/* Wipe out the stale contents in the blocks erased anyway */
+	if (!is_err_status(err))
+		layout_finish(u.layout);
+
+	update_fini(&u);
+
+	if (is_err_status(err))
+		goto err_alloc;
+
+	err = validate_update(buf, fw_len, update, index, nr_update);
+	if (is_err_status(err))
+		goto err_alloc;
+
+	if (cost)
+		layout_cost(bs_head(fw), buf, fw_len, erase_block, cost);
+
+	eee_mfree(index);
+
+	*out = buf;
+	*out_len = fw_len;
+
+	return CLN_FW_ERR_NONE;
+
+err_alloc:
+	eee_mfree(index);
+	eee_mfree(buf);
+
+	return err;
+}
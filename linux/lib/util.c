@@ -14,19 +14,77 @@
 #include "uefi.h"
 #include "buffer_stream.h"
 #include "platform_data.h"
+#include "internal.h"
+
+#include <stdarg.h>
+
+/* The library state of the calling thread */
+typedef struct {
+	/* Negative to follow the process-wide verbosity */
+	int verbose;
+	cln_fw_log_sink_t sink;
+	void *sink_data;
+} cln_fw_thread_state_t;
 
 static int show_verbose;
+static __thread cln_fw_thread_state_t thread_state = {
+	.verbose = -1,
+};
 
 int
 cln_fw_verbose(void)
 {
-	return show_verbose;
+	if (thread_state.verbose >= 0)
+		return thread_state.verbose;
+
+	return __atomic_load_n(&show_verbose, __ATOMIC_RELAXED);
 }
 
 void
 cln_fw_set_verbosity(int verbose)
 {
-	show_verbose = verbose;
+	__atomic_store_n(&show_verbose, verbose, __ATOMIC_RELAXED);
+}
+
+void
+cln_fw_thread_set_verbosity(int verbose)
+{
+	thread_state.verbose = verbose;
+}
+
+void
+cln_fw_thread_set_log_sink(cln_fw_log_sink_t sink, void *data)
+{
+	thread_state.sink = sink;
+	thread_state.sink_data = data;
+}
+
+void
+cln_fw_log(cln_fw_log_level_t level, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+
+	if (thread_state.sink) {
+		char *msg;
+
+		if (vasprintf(&msg, fmt, ap) >= 0) {
+			thread_state.sink(level, msg, thread_state.sink_data);
+			free(msg);
+		}
+	} else {
+		FILE *fp;
+
+		if (level == CLN_FW_LOG_WARN || level == CLN_FW_LOG_ERROR)
+			fp = stderr;
+		else
+			fp = stdout;
+
+		vfprintf(fp, fmt, ap);
+	}
+
+	va_end(ap);
 }
 
 /*
@@ -191,7 +249,7 @@ cln_fw_util_show_firmware(void *fw, unsigned long fw_len)
 }
 
 static err_status_t
-der2db(void **out, unsigned long *out_len,
+der2db(arena_t *arena, void **out, unsigned long *out_len,
 	void *der, unsigned long der_len)
 {
 	void *buf;
@@ -204,7 +262,7 @@ der2db(void **out, unsigned long *out_len,
 	buffer_stream_t bs;
 
 	buf_len = sizeof(*header) + sizeof(*data) + der_len;
-	buf = eee_malloc(buf_len);
+	buf = arena_alloc(arena, buf_len);
 	if (!buf)
 		return CLN_FW_ERR_OUT_OF_MEM;
 
@@ -223,7 +281,7 @@ der2db(void **out, unsigned long *out_len,
 }
 
 static err_status_t
-der2kek(void **out, unsigned long *out_len,
+der2kek(arena_t *arena, void **out, unsigned long *out_len,
 	void *der, unsigned long der_len)
 {
 	void *buf;
@@ -232,7 +290,7 @@ der2kek(void **out, unsigned long *out_len,
 	buffer_stream_t bs;
 
 	buf_len = sizeof(*header) + der_len;
-	buf = eee_malloc(buf_len);
+	buf = arena_alloc(arena, buf_len);
 	if (!buf)
 		return CLN_FW_ERR_OUT_OF_MEM;
 
@@ -249,21 +307,23 @@ der2kek(void **out, unsigned long *out_len,
 }
 
 err_status_t
-cln_fw_util_embed_sb_keys(void *fw, unsigned long fw_len,
-			  void *pk, unsigned long pk_len,
-			  void *kek, unsigned long kek_len,
-			  void *db, unsigned long db_len,
-			  void *dbx, unsigned long dbx_len,
-			  void **out, unsigned long *out_len)
+cln_fw_handle_embed_sb_keys(cln_fw_handle_t handle,
+			    void *pk, unsigned long pk_len,
+			    void *kek, unsigned long kek_len,
+			    void *db, unsigned long db_len,
+			    void *dbx, unsigned long dbx_len)
 {
-	cln_fw_handle_t handle;
+	arena_t *arena;
 	void *extra_buf;
 	unsigned long extra_buf_len;
 	err_status_t err;
 
-	if (!fw || !fw_len)
+	if (!handle)
 		return CLN_FW_ERR_INVALID_PARAMETER;
 
+	/* The temporary buffers are released along with the handle */
+	arena = ((cln_fw_parser_t *)handle)->arena;
+
 	if (!pk && !kek && !db && !dbx)
 		return CLN_FW_ERR_INVALID_PARAMETER;
 
@@ -279,67 +339,85 @@ cln_fw_util_embed_sb_keys(void *fw, unsigned long fw_len,
 	if (dbx && !dbx_len)
 		return CLN_FW_ERR_INVALID_PARAMETER;
 
-	handle = NULL;
-	err = cln_fw_handle_open(&handle, fw, fw_len);
-	if (is_err_status(err))
-		return err;
-
 	if (pk) {
 		err = cln_fw_handle_embed_key(handle, CLN_FW_SB_KEY_PK, pk,
 					      pk_len);
 		if (is_err_status(err))
-			goto err_embed_key;
+			return err;
 	}
 
 	if (kek) {
 		extra_buf = NULL;
 		extra_buf_len = 0;
-		err = der2kek(&extra_buf, &extra_buf_len, kek, kek_len);
+		err = der2kek(arena, &extra_buf, &extra_buf_len, kek, kek_len);
 		if (is_err_status(err))
-			goto err_der2kek;
+			return err;
 
 		err = cln_fw_handle_embed_key(handle, CLN_FW_SB_KEY_KEK,
 					      extra_buf, extra_buf_len);
-		eee_mfree(extra_buf);
+		arena_free(arena, extra_buf);
 		if (is_err_status(err))
-			goto err_embed_key;
+			return err;
 	}
 
 	if (db) {
 		extra_buf = NULL;
 		extra_buf_len = 0;
-		err = der2db(&extra_buf, &extra_buf_len, db, db_len);
+		err = der2db(arena, &extra_buf, &extra_buf_len, db, db_len);
 		if (is_err_status(err))
-			goto err_der2db;
+			return err;
 
 		err = cln_fw_handle_embed_key(handle, CLN_FW_SB_KEY_DB,
 					      extra_buf, extra_buf_len);
-		eee_mfree(extra_buf);
+		arena_free(arena, extra_buf);
 		if (is_err_status(err))
-			goto err_embed_key;
+			return err;
 	}
 
 	if (dbx) {
 		extra_buf = NULL;
 		extra_buf_len = 0;
-		err = der2db(&extra_buf, &extra_buf_len, dbx, dbx_len);
+		err = der2db(arena, &extra_buf, &extra_buf_len, dbx, dbx_len);
 		if (is_err_status(err))
-			goto err_der2db;
+			return err;
 
 		err = cln_fw_handle_embed_key(handle, CLN_FW_SB_KEY_DBX,
 					      extra_buf, extra_buf_len);
-		eee_mfree(extra_buf);
+		arena_free(arena, extra_buf);
 		if (is_err_status(err))
-			goto err_embed_key;
+			return err;
 	}
 
-	err = cln_fw_handle_flush(handle, out, out_len);
+	return CLN_FW_ERR_NONE;
+}
+
+err_status_t
+cln_fw_util_embed_sb_keys(void *fw, unsigned long fw_len,
+			  void *pk, unsigned long pk_len,
+			  void *kek, unsigned long kek_len,
+			  void *db, unsigned long db_len,
+			  void *dbx, unsigned long dbx_len,
+			  void **out, unsigned long *out_len)
+{
+	cln_fw_handle_t handle;
+	err_status_t err;
+
+	if (!fw || !fw_len)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	handle = NULL;
+	err = cln_fw_handle_open(&handle, fw, fw_len);
+	if (is_err_status(err))
+		return err;
+
+	err = cln_fw_handle_embed_sb_keys(handle, pk, pk_len, kek, kek_len,
+					  db, db_len, dbx, dbx_len);
 	if (is_err_status(err))
 		goto err_embed_key;
 
+	err = cln_fw_handle_flush(handle, out, out_len);
+
 err_embed_key:
-err_der2db:
-err_der2kek:
 	cln_fw_handle_close(handle);
 
 	return err;
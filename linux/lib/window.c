@@ -0,0 +1,287 @@
+/*
+ * Windowed firmware access
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <eee.h>
+#include <err_status.h>
+#include <cln_fw.h>
+#include <sys/mman.h>
+#include "internal.h"
+#include "window.h"
+
+typedef struct __window			window_t;
+
+/*
+ * The address range of firmware is reserved up front without any access
+ * permitted, and the pages are made accessible by the backend only when
+ * an extent covering them is fetched.
+ */
+struct __window {
+	bs_source_t source;
+	/* Fill the page-aligned extent relative to the reservation */
+	int (*map)(window_t *w, unsigned long offset, unsigned long len);
+	void *reserved;
+	unsigned long reserved_len;
+	unsigned long page_size;
+	/* The offset of buffer in the first page */
+	unsigned long delta;
+	uint8_t *present;
+	unsigned long nr_present;
+	int fd;
+	/* Not closed on release if the fd is owned by the caller */
+	int fd_owned;
+	unsigned long file_offset;
+};
+
+static err_status_t
+window_fetch(bs_source_t *src, unsigned long offset, unsigned long len)
+{
+	window_t *w = (window_t *)src;
+	unsigned long page, last;
+
+	page = (w->delta + offset) / w->page_size;
+	last = (w->delta + offset + len - 1) / w->page_size;
+
+	while (page <= last) {
+		unsigned long end;
+
+		if (w->present[page]) {
+			++page;
+			continue;
+		}
+
+		/* Map the run of absent pages at once */
+		for (end = page + 1; end <= last && !w->present[end]; ++end)
+			;
+
+		if (w->map(w, page * w->page_size, (end - page) * w->page_size))
+			return CLN_FW_ERR_IO;
+
+		eee_memset(w->present + page, 1, end - page);
+		w->nr_present += end - page;
+		page = end;
+	}
+
+	return CLN_FW_ERR_NONE;
+}
+
+static void
+window_release(bs_source_t *src)
+{
+	window_t *w = (window_t *)src;
+
+	dbg(T("Fetched %ld KiB of %ld KiB through the window\n"),
+	    w->nr_present * w->page_size / 1024, w->reserved_len / 1024);
+
+	munmap(w->reserved, w->reserved_len);
+	if (w->fd >= 0 && w->fd_owned)
+		close(w->fd);
+	eee_mfree(w->present);
+	eee_mfree(w);
+}
+
+static window_t *
+window_create(unsigned long file_offset, unsigned long len)
+{
+	window_t *w;
+	unsigned long nr_page;
+
+	w = eee_malloc(sizeof(*w));
+	if (!w)
+		return NULL;
+
+	eee_memset(w, 0, sizeof(*w));
+	w->fd = -1;
+	w->page_size = sysconf(_SC_PAGESIZE);
+	w->delta = file_offset & (w->page_size - 1);
+	w->file_offset = file_offset - w->delta;
+	w->reserved_len = align_up(w->delta + len, w->page_size);
+
+	nr_page = w->reserved_len / w->page_size;
+	w->present = eee_malloc(nr_page);
+	if (!w->present)
+		goto err_alloc_present;
+	eee_memset(w->present, 0, nr_page);
+
+	w->reserved = mmap(NULL, w->reserved_len, PROT_NONE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (w->reserved == MAP_FAILED)
+		goto err_reserve;
+
+	w->source.fetch = window_fetch;
+	w->source.release = window_release;
+	w->source.buf = w->reserved + w->delta;
+	w->source.buf_len = len;
+
+	return w;
+
+err_reserve:
+	eee_mfree(w->present);
+
+err_alloc_present:
+	eee_mfree(w);
+
+	return NULL;
+}
+
+static int
+map_phys(window_t *w, unsigned long offset, unsigned long len)
+{
+	void *p;
+
+	p = mmap(w->reserved + offset, len, PROT_READ, MAP_SHARED | MAP_FIXED,
+		 w->fd, (off_t)(w->file_offset + offset));
+	if (p == MAP_FAILED) {
+		err(T("Failed to map physical memory at 0x%lx\n"),
+		    w->file_offset + offset);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Access the physical memory through the device such as /dev/mem. Only
+ * the pages covering the extents fetched are mapped.
+ */
+err_status_t
+window_open_phys(const char *path, unsigned long phys_addr,
+		 unsigned long len, bs_source_t **out)
+{
+	window_t *w;
+
+	if (!path || !len || !out)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	w = window_create(phys_addr, len);
+	if (!w)
+		return CLN_FW_ERR_OUT_OF_MEM;
+
+	w->fd = open(path, O_RDONLY | O_SYNC);
+	if (w->fd < 0) {
+		err(T("Failed to open file %s.\n"), path);
+		window_release(&w->source);
+		return CLN_FW_ERR_IO;
+	}
+
+	w->fd_owned = 1;
+	w->map = map_phys;
+	*out = &w->source;
+
+	return CLN_FW_ERR_NONE;
+}
+
+/*
+ * The pages are populated with pread() and kept as the cache of the
+ * extents fetched. The tail beyond the end of file is left zeroed.
+ */
+static int
+map_pread(window_t *w, unsigned long offset, unsigned long len)
+{
+	void *p = w->reserved + offset;
+	unsigned long done;
+	ssize_t ret;
+
+	if (mprotect(p, len, PROT_READ | PROT_WRITE)) {
+		err(T("Failed to populate the window at 0x%lx\n"), offset);
+		return -1;
+	}
+
+	for (done = 0; done < len; done += ret) {
+		ret = pread(w->fd, p + done, len - done,
+			    (off_t)(w->file_offset + offset + done));
+		if (!ret)
+			break;
+
+		if (ret < 0) {
+			err(T("Failed to read the file at 0x%lx\n"),
+			    w->file_offset + offset + done);
+			return -1;
+		}
+	}
+
+	/* Catch the writes as a read-only file mapping does */
+	mprotect(p, len, PROT_READ);
+
+	return 0;
+}
+
+/*
+ * Access the file through pread() so that only the extents fetched are
+ * read. The file descriptor is still owned by the caller.
+ */
+err_status_t
+window_open_fd(int fd, unsigned long len, bs_source_t **out)
+{
+	window_t *w;
+
+	if (fd < 0 || !len || !out)
+		return CLN_FW_ERR_INVALID_PARAMETER;
+
+	w = window_create(0, len);
+	if (!w)
+		return CLN_FW_ERR_OUT_OF_MEM;
+
+	w->fd = fd;
+	w->map = map_pread;
+	*out = &w->source;
+
+	return CLN_FW_ERR_NONE;
+}
+
+/*
+ * Let the caller fill an extent of the window by itself, e.g, with the
+ * reads queued through io_uring. The extent is widened to the pages
+ * covering it, which are taken as present and stay writable until
+ * window_fill_end() is called.
+ */
+void *
+window_fill_begin(bs_source_t *src, unsigned long *offset,
+		  unsigned long *len)
+{
+	window_t *w = (window_t *)src;
+	unsigned long start, end, page;
+
+	/* Only the windows on a file start at a page boundary */
+	if (w->delta || !*len || *offset + *len > src->buf_len)
+		return NULL;
+
+	start = *offset & ~(w->page_size - 1);
+	end = align_up(*offset + *len, w->page_size);
+	if (end > src->buf_len)
+		end = src->buf_len;
+
+	if (mprotect(w->reserved + start, end - start,
+		     PROT_READ | PROT_WRITE)) {
+		err(T("Failed to populate the window at 0x%lx\n"), start);
+		return NULL;
+	}
+
+	for (page = start / w->page_size; page * w->page_size < end; ++page) {
+		if (w->present[page])
+			continue;
+
+		w->present[page] = 1;
+		++w->nr_present;
+	}
+
+	*offset = start;
+	*len = end - start;
+
+	return w->reserved + start;
+}
+
+/* The extent is what window_fill_begin() returned */
+void
+window_fill_end(bs_source_t *src, unsigned long offset, unsigned long len)
+{
+	window_t *w = (window_t *)src;
+
+	mprotect(w->reserved + offset, align_up(len, w->page_size), PROT_READ);
+}
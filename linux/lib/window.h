@@ -0,0 +1,36 @@
+/*
+ * Windowed firmware access API
+ *
+ * Copyright (c) 2015-2016 Wind River Systems, Inc.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author: Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#ifndef __WINDOW_H__
+#define __WINDOW_H__
+
+#include <eee.h>
+#include <err_status.h>
+#include <cln_fw.h>
+#include "buffer_stream.h"
+
+err_status_t
+window_open_phys(const char *path, unsigned long phys_addr,
+		 unsigned long len, bs_source_t **out);
+
+err_status_t
+window_open_fd(int fd, unsigned long len, bs_source_t **out);
+
+void *
+window_fill_begin(bs_source_t *src, unsigned long *offset,
+		  unsigned long *len);
+
+void
+window_fill_end(bs_source_t *src, unsigned long offset, unsigned long len);
+
+err_status_t
+handle_open_window(cln_fw_handle_t *handle, bs_source_t *src, int fd);
+
+#endif	/* __WINDOW_H__ */